@@ -45,11 +45,28 @@ class GradualFlowPlugin(BackendPlugin):
     def getPort(self):
         return super().getPort() if not self.isDebug() else int(os.environ["CURAENGINE_GCODE_PATHS_MODIFY_PORT"])
 
+    def getAddress(self):
+        return f"unix:{self.getSocketPath()}" if self.getSocketPath() is not None else super().getAddress()
+
+    def getSocketPath(self):
+        """Path of the unix domain socket the plugin listens on instead of a TCP port, if any.
+
+        The engine connects to "{address}:{port}", so the socket file is this path followed by ":" and the port.
+        """
+        return os.environ.get("CURAENGINE_GCODE_PATHS_MODIFY_SOCKET", None) if platform.system() != "Windows" else None
+
+    def getSocketFile(self):
+        """The socket file the engine connects to, once the port is chosen."""
+        return f"{self.getSocketPath()}:{self.getPort()}"
+
     def isDebug(self):
         return not hasattr(sys, "frozen") and os.environ.get("CURAENGINE_GCODE_PATHS_MODIFY_PORT", None) is not None
 
     def start(self):
         if not self.isDebug():
+            if self.getSocketPath() is not None:
+                # the port is only chosen right before the plugin starts
+                self._plugin_command = [self.binaryPath().as_posix(), "--socket", self.getSocketFile()]
             super().start()
 
     def binaryPath(self) -> Path:
@@ -0,0 +1,19 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef BENCHMARK_ALLOCATION_COUNTER_H
+#define BENCHMARK_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+namespace plugin::gradual_flow::benchmark
+{
+
+/*
+ * @return the number of calls to the global operator new so far, by any thread of the benchmarks
+ */
+std::uint64_t allocationCount() noexcept;
+
+} // namespace plugin::gradual_flow::benchmark
+
+#endif // BENCHMARK_ALLOCATION_COUNTER_H
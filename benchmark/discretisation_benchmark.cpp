@@ -0,0 +1,122 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#include "gradual_flow/fixed_point_gcode_state.h"
+#include "layer_generator.h"
+
+#include <benchmark/benchmark.h>
+
+namespace plugin::gradual_flow::benchmark
+{
+
+/*
+ * Compares the step sizes of the fixed discretisation mode with the adaptive mode, for gentle and
+ * steep flow accelerations. The "segments" counter holds the number of output paths per layer.
+ *
+ * Arguments: flow acceleration in mm^3/s^2 * 100, step size in ms, 0 for the adaptive mode
+ */
+static void BM_Discretisation(::benchmark::State& state)
+{
+    const auto flow_acceleration = static_cast<double>(state.range(0)) * 1e-2 * 1e9; // um^3/s^2
+    const auto step_size = static_cast<double>(state.range(1)) * 1e-3; // s
+    const auto adaptive = state.range(1) == 0;
+
+    LayerGenerator generator;
+    const auto gcode_paths = generator.islands(20, 50000000);
+
+    std::size_t segment_count = 0;
+    for (auto _ : state)
+    {
+        GCodeState gcode_state{
+            .current_flow = gcode_paths.front().targetFlow(),
+            .flow_acceleration = flow_acceleration,
+            .flow_deceleration = flow_acceleration,
+            .discretized_duration = adaptive ? 0.2 : step_size,
+            .target_end_flow = gcode_paths.front().targetFlow(),
+            .reset_flow_duration = 2.0,
+            .flow_step_tolerance = adaptive ? 0.5e9 : 0.0,
+        };
+        const auto limited_flow_acceleration_paths = gcode_state.processGcodePaths(gcode_paths);
+        segment_count = limited_flow_acceleration_paths.size();
+        ::benchmark::DoNotOptimize(limited_flow_acceleration_paths.data());
+    }
+    state.counters["segments"] = static_cast<double>(segment_count);
+}
+
+BENCHMARK(BM_Discretisation)->ArgsProduct({ { 25, 400 }, { 25, 100, 400, 0 } })->ArgNames({ "acceleration", "step" })->Unit(::benchmark::kMicrosecond);
+
+/*
+ * Compares the double and the fixed point kernel on layers with short and long polylines.
+ *
+ * Arguments: flow acceleration in mm^3/s^2 * 100, points per path, fixed point kernel (0 or 1)
+ */
+static void BM_FixedPointDiscretisation(::benchmark::State& state)
+{
+    const auto flow_acceleration = static_cast<double>(state.range(0)) * 1e-2 * 1e9; // um^3/s^2
+    const auto fixed_point = state.range(2) != 0;
+
+    LayerGenerator generator;
+    const auto gcode_paths = generator.islands(20, 50000000, static_cast<int>(state.range(1)));
+    const GCodeState layer_state{
+        .current_flow = gcode_paths.front().targetFlow(),
+        .flow_acceleration = flow_acceleration,
+        .flow_deceleration = flow_acceleration,
+        .discretized_duration = 0.2,
+        .target_end_flow = gcode_paths.front().targetFlow(),
+        .reset_flow_duration = 2.0,
+    };
+
+    for (auto _ : state)
+    {
+        if (fixed_point)
+        {
+            FixedPointGCodeState gcode_state{ layer_state };
+            ::benchmark::DoNotOptimize(gcode_state.processGcodePaths(gcode_paths).data());
+        }
+        else
+        {
+            auto gcode_state = layer_state;
+            ::benchmark::DoNotOptimize(gcode_state.processGcodePaths(gcode_paths).data());
+        }
+    }
+}
+
+BENCHMARK(BM_FixedPointDiscretisation)
+    ->ArgsProduct({ { 25, 400 }, { 2, 64 }, { 0, 1 } })
+    ->ArgNames({ "acceleration", "points", "fixed_point" })
+    ->Unit(::benchmark::kMicrosecond);
+
+/*
+ * Runs a single pass over a layer, to compare the specializations of GCodeState::processGcodePath
+ * per direction, and flow models.
+ *
+ * Argument: points per path
+ */
+template<utils::Direction direction>
+static void BM_Pass(::benchmark::State& state)
+{
+    LayerGenerator generator;
+    const auto gcode_paths = generator.islands(20, 50000000, static_cast<int>(state.range(0)));
+    const GCodeState layer_state{
+        .current_flow = gcode_paths.front().targetFlow(),
+        .flow_acceleration = 0.25e9,
+        .flow_deceleration = 0.25e9,
+        .discretized_duration = 0.2,
+        .target_end_flow = gcode_paths.front().targetFlow(),
+        .reset_flow_duration = 2.0,
+    };
+
+    for (auto _ : state)
+    {
+        auto gcode_state = layer_state;
+        for (const auto& gcode_path : gcode_paths)
+        {
+            ::benchmark::DoNotOptimize(gcode_state.processGcodePath<direction>(gcode_path).data());
+        }
+    }
+}
+
+BENCHMARK(BM_Pass<utils::Direction::Forward>)->Arg(2)->Arg(64)->ArgName("points")->Unit(::benchmark::kMicrosecond);
+BENCHMARK(BM_Pass<utils::Direction::Backward>)->Arg(2)->Arg(64)->ArgName("points")->Unit(::benchmark::kMicrosecond);
+
+} // namespace plugin::gradual_flow::benchmark
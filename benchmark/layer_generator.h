@@ -0,0 +1,74 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef CURAENGINE_PLUGIN_GRADUAL_FLOW_BENCHMARK_LAYER_GENERATOR_H
+#define CURAENGINE_PLUGIN_GRADUAL_FLOW_BENCHMARK_LAYER_GENERATOR_H
+
+#include "gradual_flow/gcode_path.h"
+
+#include <deque>
+#include <vector>
+
+namespace plugin::gradual_flow::benchmark
+{
+
+/*
+ * Generates layers made up of islands; every island has a slow start, a long fast path and a slow
+ * end, and the islands are connected by retracted travels.
+ */
+struct LayerGenerator
+{
+    std::deque<cura::plugins::v0::GCodePath> messages; // keeps the original path data alive, a deque does not move its elements
+
+    const cura::plugins::v0::GCodePath* message(const double velocity, const bool retract = false) // velocity in mm/s
+    {
+        auto& original_gcode_path_data = messages.emplace_back();
+        original_gcode_path_data.set_flow(retract ? 0.0 : 1.0);
+        original_gcode_path_data.set_width_factor(1.0);
+        original_gcode_path_data.set_speed_back_pressure_factor(1.0);
+        original_gcode_path_data.set_speed_factor(1.0);
+        original_gcode_path_data.set_line_width(400);
+        original_gcode_path_data.set_layer_thickness(200);
+        original_gcode_path_data.set_flow_ratio(1.0);
+        original_gcode_path_data.set_retract(retract);
+        original_gcode_path_data.mutable_speed_derivatives()->set_velocity(velocity);
+        return &original_gcode_path_data;
+    }
+
+    /*
+     * @param island_count number of islands in the layer
+     * @param island_length length of the fast path of an island in um
+     * @param points_per_path number of points every extruding path is made up of
+     */
+    std::vector<GCodePath> islands(const int island_count, const long long island_length, const int points_per_path = 2)
+    {
+        const auto* slow = message(20.);
+        const auto* fast = message(150.);
+        const auto* retract = message(200., true);
+
+        std::vector<GCodePath> gcode_paths;
+        const auto add_path = [&](const cura::plugins::v0::GCodePath* original_gcode_path_data, const long long x0, const long long x1, const long long y, const int point_count)
+        {
+            geometry::polyline<> points;
+            for (int i = 0; i < point_count; ++i)
+            {
+                points.emplace_back(x0 + (x1 - x0) * i / (point_count - 1), y);
+            }
+            gcode_paths.emplace_back(GCodePath{ .original_gcode_path_data = original_gcode_path_data, .points = points });
+        };
+
+        for (int island = 0; island < island_count; ++island)
+        {
+            const auto y = island * 10000LL;
+            add_path(slow, 0, 2000, y, points_per_path);
+            add_path(fast, 2000, 2000 + island_length, y, points_per_path);
+            add_path(slow, 2000 + island_length, 4000 + island_length, y, points_per_path);
+            add_path(retract, 4000 + island_length, 0, y + 10000, 2);
+        }
+        return gcode_paths;
+    }
+};
+
+} // namespace plugin::gradual_flow::benchmark
+
+#endif // CURAENGINE_PLUGIN_GRADUAL_FLOW_BENCHMARK_LAYER_GENERATOR_H
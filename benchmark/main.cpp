@@ -0,0 +1,44 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#include "allocation_counter.h"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+std::atomic<std::uint64_t> allocation_count{ 0 };
+} // namespace
+
+// Replaces the global allocation functions to count the allocations; the array and nothrow forms
+// call these
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* memory = std::malloc(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+std::uint64_t plugin::gradual_flow::benchmark::allocationCount() noexcept
+{
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+BENCHMARK_MAIN();
@@ -0,0 +1,187 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#include "allocation_counter.h"
+#include "cura/plugins/slots/broadcast/v0/broadcast.grpc.pb.h"
+#include "cura/plugins/slots/gcode_paths/v0/modify.grpc.pb.h"
+#include "layer_generator.h"
+#include "plugin/plugin.h"
+#include "plugin/shared_memory.h"
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/security/server_credentials.h>
+
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace plugin::gradual_flow::benchmark
+{
+
+using generate_t = Generate<cura::plugins::slots::gcode_paths::v0::modify::GCodePathsModifyService::AsyncService,
+                            cura::plugins::slots::gcode_paths::v0::modify::CallResponse,
+                            cura::plugins::slots::gcode_paths::v0::modify::CallRequest>;
+
+/*
+ * Runs the plugin on a background thread, listening on a unix domain socket or on a TCP port of
+ * localhost, with gradual flow disabled so that a modify call only measures the transport. Acts as
+ * the engine, with a shared memory ring for the points of the layers.
+ */
+class LoopbackPlugin
+{
+public:
+    explicit LoopbackPlugin(const bool use_socket)
+        : plugin_{ use_socket ? Plugin<generate_t>{ socket_path, grpc::InsecureServerCredentials() }
+                              : Plugin<generate_t>{ "localhost", "0", grpc::InsecureServerCredentials() } }
+    {
+        plugin_.addHandshakeService(Handshake{ .metadata = plugin_.metadata });
+        auto settings = std::make_shared<Broadcast::settings_t>();
+        plugin_.addBroadcastService(Broadcast{ .settings = settings, .metadata = plugin_.metadata });
+        plugin_.addGenerateService(generate_t{ .settings = settings, .metadata = plugin_.metadata });
+        plugin_.start();
+        thread_ = std::thread{ [this]() { plugin_.run(); } };
+
+        const auto target = use_socket ? fmt::format("unix:{}", socket_path.string()) : fmt::format("localhost:{}", plugin_.port());
+        channel_ = grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
+        broadcastSettings();
+    }
+
+    ~LoopbackPlugin()
+    {
+        plugin_.stop();
+        thread_.join();
+    }
+
+    LoopbackPlugin(const LoopbackPlugin&) = delete;
+    LoopbackPlugin& operator=(const LoopbackPlugin&) = delete;
+
+    cura::plugins::slots::gcode_paths::v0::modify::CallResponse modify(const cura::plugins::slots::gcode_paths::v0::modify::CallRequest& request) const
+    {
+        grpc::ClientContext client_context;
+        client_context.AddMetadata("cura-engine-uuid", uuid);
+        return call(client_context, request);
+    }
+
+    /*
+     * Sends the points of the request through shared memory, like an engine that supports it does,
+     * and falls back to the messages when the ring is full.
+     */
+    cura::plugins::slots::gcode_paths::v0::modify::CallResponse modifyThroughSharedMemory(cura::plugins::slots::gcode_paths::v0::modify::CallRequest request)
+    {
+        // leave room for the modified points, they usually outnumber the original ones
+        const auto block = ring_.allocate(4 * shared_memory::blockSize(request.gcode_paths()));
+        if (! block.has_value())
+        {
+            return modify(request);
+        }
+        shared_memory::writeBlock(ring_.bytes(block.value()), block->sequence, *request.mutable_gcode_paths());
+
+        grpc::ClientContext client_context;
+        client_context.AddMetadata("cura-engine-uuid", uuid);
+        client_context.AddMetadata(std::string{ shared_memory::name_key }, block->name);
+        client_context.AddMetadata(std::string{ shared_memory::offset_key }, std::to_string(block->offset));
+        client_context.AddMetadata(std::string{ shared_memory::size_key }, std::to_string(block->size));
+        client_context.AddMetadata(std::string{ shared_memory::sequence_key }, std::to_string(block->sequence));
+        auto response = call(client_context, request);
+        if (client_context.GetServerTrailingMetadata().contains(grpc::string_ref{ shared_memory::response_key.data(), shared_memory::response_key.size() }))
+        {
+            shared_memory::readBlock(ring_.bytes(block.value()), block->sequence, *response.mutable_gcode_paths());
+        }
+        ring_.release();
+        return response;
+    }
+
+private:
+    static constexpr auto uuid{ "transport-benchmark" };
+    inline static const auto socket_path{ std::filesystem::temp_directory_path() / "curaengine_plugin_gradual_flow_benchmark.sock" };
+    static constexpr std::size_t ring_size{ 256 * 1024 * 1024 }; // bytes
+
+    cura::plugins::slots::gcode_paths::v0::modify::CallResponse
+        call(grpc::ClientContext& client_context, const cura::plugins::slots::gcode_paths::v0::modify::CallRequest& request) const
+    {
+        cura::plugins::slots::gcode_paths::v0::modify::CallResponse response;
+        const auto status = modify_stub_->Call(&client_context, request, &response);
+        if (! status.ok())
+        {
+            throw std::runtime_error(status.error_message());
+        }
+        return response;
+    }
+
+    void broadcastSettings()
+    {
+        const auto settingKey = [this](const std::string_view key)
+        {
+            return Settings::settingKey(key, plugin_.metadata->plugin_name, plugin_.metadata->plugin_version);
+        };
+        cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest request;
+        auto& extruder_settings = *request.add_extruder_settings()->mutable_settings();
+        extruder_settings[settingKey("gradual_flow_enabled")] = "False";
+        extruder_settings[settingKey("max_flow_acceleration")] = "1";
+        extruder_settings[settingKey("layer_0_max_flow_acceleration")] = "1";
+        extruder_settings[settingKey("gradual_flow_discretisation_step_size")] = "0.2";
+        (*request.mutable_global_settings()->mutable_settings())[settingKey("reset_flow_duration")] = "2.0";
+
+        grpc::ClientContext client_context;
+        client_context.AddMetadata("cura-engine-uuid", uuid);
+        google::protobuf::Empty response;
+        const auto status = cura::plugins::slots::broadcast::v0::BroadcastService::NewStub(channel_)->BroadcastSettings(&client_context, request, &response);
+        if (! status.ok())
+        {
+            throw std::runtime_error(status.error_message());
+        }
+        modify_stub_ = cura::plugins::slots::gcode_paths::v0::modify::GCodePathsModifyService::NewStub(channel_);
+    }
+
+    Plugin<generate_t> plugin_;
+    std::thread thread_;
+    std::shared_ptr<grpc::Channel> channel_;
+    std::unique_ptr<cura::plugins::slots::gcode_paths::v0::modify::GCodePathsModifyService::Stub> modify_stub_;
+    shared_memory::Ring ring_{ shared_memory::Region::create(shared_memory::regionName(uuid, std::to_string(std::chrono::steady_clock::now().time_since_epoch().count())), ring_size) };
+};
+
+/*
+ * Compares the round trip latency of a layer over TCP on localhost, over a unix domain socket, and
+ * over a unix domain socket with the points in shared memory. The "paths" counter holds the number
+ * of paths per layer, the "allocations" counter the heap allocations per call, of the engine and
+ * the plugin side together.
+ *
+ * Arguments: transport (0 TCP, 1 unix domain socket, 2 unix domain socket and shared memory),
+ * number of islands in the layer
+ */
+static void BM_LayerRoundTrip(::benchmark::State& state)
+{
+    const auto use_socket = state.range(0) != 0;
+    const auto use_shared_memory = state.range(0) == 2;
+    const auto island_count = static_cast<int>(state.range(1));
+
+    LayerGenerator generator;
+    const auto gcode_paths = generator.islands(island_count, 5000000);
+    cura::plugins::slots::gcode_paths::v0::modify::CallRequest request;
+    request.set_extruder_nr(0);
+    request.set_layer_nr(1);
+    for (const auto& [index, gcode_path] : gcode_paths | ranges::views::enumerate)
+    {
+        request.add_gcode_paths()->CopyFrom(gcode_path.toGrpcMessage(index == 0));
+    }
+
+    LoopbackPlugin loopback_plugin{ use_socket };
+    const auto allocation_count = allocationCount();
+    for (auto _ : state)
+    {
+        const auto response = use_shared_memory ? loopback_plugin.modifyThroughSharedMemory(request) : loopback_plugin.modify(request);
+        ::benchmark::DoNotOptimize(response.gcode_paths_size());
+    }
+    state.counters["paths"] = static_cast<double>(request.gcode_paths_size());
+    state.counters["allocations"] = ::benchmark::Counter(static_cast<double>(allocationCount() - allocation_count), ::benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(BM_LayerRoundTrip)->ArgsProduct({ { 0, 1, 2 }, { 1, 50, 1000 } })->ArgNames({ "transport", "islands" })->Unit(::benchmark::kMicrosecond)->UseRealTime();
+
+} // namespace plugin::gradual_flow::benchmark
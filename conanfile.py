@@ -27,10 +27,14 @@ class CuraEngineGradualFlowPluginConan(ConanFile):
     options = {
         "shared": [True, False],
         "fPIC": [True, False],
+        "enable_benchmarks": [True, False],
+        "enable_fuzzing": [True, False],
     }
     default_options = {
         "shared": False,
         "fPIC": True,
+        "enable_benchmarks": False,
+        "enable_fuzzing": False,
     }
 
     def set_version(self):
@@ -145,6 +149,7 @@ class CuraEngineGradualFlowPluginConan(ConanFile):
         copy(self, "*", os.path.join(self.recipe_folder, "src"), os.path.join(self.export_sources_folder, "src"))
         copy(self, "*", os.path.join(self.recipe_folder, "include"), os.path.join(self.export_sources_folder, "include"))
         copy(self, "*", os.path.join(self.recipe_folder, "tests"), os.path.join(self.export_sources_folder, "tests"))
+        copy(self, "*", os.path.join(self.recipe_folder, "benchmark"), os.path.join(self.export_sources_folder, "benchmark"))
         copy(self, "*", os.path.join(self.recipe_folder, self._cura_plugin_name), os.path.join(self.export_sources_folder, self._cura_plugin_name))
 
     def config_options(self):
@@ -181,6 +186,8 @@ class CuraEngineGradualFlowPluginConan(ConanFile):
         self.test_requires("standardprojectsettings/[>=0.1.0]@ultimaker/stable")
         if not self.conf.get("tools.build:skip_test", False, check_type=bool):
             self.test_requires("catch2/3.4.0")
+        if self.options.enable_benchmarks:
+            self.test_requires("benchmark/1.8.3")
 
     def validate(self):
         # validate the minimum cpp standard supported. For C++ projects only
@@ -206,6 +213,8 @@ class CuraEngineGradualFlowPluginConan(ConanFile):
         # BUILD_SHARED_LIBS and POSITION_INDEPENDENT_CODE are automatically parsed when self.options.shared or self.options.fPIC exist
         tc = CMakeToolchain(self)
         tc.variables["ENABLE_TESTS"] = not self.conf.get("tools.build:skip_test", False, check_type=bool)
+        tc.variables["ENABLE_BENCHMARKS"] = self.options.enable_benchmarks
+        tc.variables["ENABLE_FUZZING"] = self.options.enable_fuzzing
         if is_msvc(self):
             tc.variables["USE_MSVC_RUNTIME_LIBRARY_DLL"] = not is_msvc_static_runtime(self)
         tc.cache_variables["CMAKE_POLICY_DEFAULT_CMP0077"] = "NEW"
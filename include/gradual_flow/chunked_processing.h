@@ -0,0 +1,175 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher
+
+#ifndef CURAENGINE_PLUGIN_GRADUAL_FLOW_CHUNKED_PROCESSING_H
+#define CURAENGINE_PLUGIN_GRADUAL_FLOW_CHUNKED_PROCESSING_H
+
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/worker_pool.h"
+
+#include <range/v3/view/reverse.hpp>
+
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace plugin::gradual_flow
+{
+
+/*
+ * Returns the start indices of the independent chunks of a layer.
+ *
+ * A retract, or a travel longer than the reset flow duration, resets the flow state. The first
+ * extruding path after such a travel then starts at its own target flow, so the forward pass from
+ * that path onwards does not depend on anything before it. This only holds if the path does not
+ * run faster than its target flow, otherwise the carried-over discretized duration is still used.
+ *
+ * @return the index of the first path of every chunk, the first chunk always starts at 0
+ */
+inline std::vector<std::size_t> flowResetChunkStarts(const std::vector<GCodePath>& gcode_paths, const double reset_flow_duration)
+{
+    std::vector<std::size_t> chunk_starts{ 0 };
+    auto flow_reset = false;
+    for (std::size_t index = 0; index < gcode_paths.size(); ++index)
+    {
+        const auto& path = gcode_paths[index];
+        if (path.isTravel())
+        {
+            flow_reset = flow_reset || path.isRetract() || path.totalDuration() > reset_flow_duration;
+            continue;
+        }
+        if (flow_reset && index > 0 && path.flow() <= path.targetFlow())
+        {
+            chunk_starts.emplace_back(index);
+        }
+        flow_reset = false;
+    }
+    return chunk_starts;
+}
+
+/*
+ * Same as `GCodeState::processGcodePaths`, but processes the independent chunks of a layer on the worker pool.
+ *
+ * Every chunk runs its forward pass and then its backward pass on a worker. Only the last chunk knows
+ * the state it enters the backward pass with; the other chunks assume an unbounded incoming flow and
+ * record their state after every path. Afterwards the chunks are visited from last to first and the
+ * backward pass is redone with the actual incoming state, until it reaches the state recorded by
+ * the speculative run; from there on both runs are identical. This is usually only the last few
+ * paths of a chunk. The result, including the final state, is identical to the serial version.
+ *
+ * @param state the state to start with, updated to the state after the backward pass
+ * @param gcode_paths the paths of the layer
+ * @param pool the workers to process the chunks on
+ * @return the discretized paths of the layer
+ */
+inline std::vector<GCodePath> processGcodePathsParallel(GCodeState& state, const std::vector<GCodePath>& gcode_paths, WorkerPool& pool)
+{
+    const auto chunk_starts = flowResetChunkStarts(gcode_paths, state.reset_flow_duration);
+    if (chunk_starts.size() < 2 || pool.threadCount() < 2)
+    {
+        return state.processGcodePaths(gcode_paths);
+    }
+
+    struct Chunk
+    {
+        std::vector<GCodePath> forward_pass_gcode_paths;
+        std::vector<std::vector<GCodePath>> backward_pass_gcode_paths; // per forward pass path, in processing order
+        std::vector<GCodeState> backward_pass_states; // state after the backward pass processed the forward pass path
+        GCodeState exit_state;
+        LayerFlowState forward_end_state; // of the forward pass, only that of the last chunk ends the layer
+    };
+
+    const auto sameBackwardState = [](const GCodeState& lhs, const GCodeState& rhs)
+    {
+        return lhs.current_flow == rhs.current_flow && lhs.discretized_duration_remaining == rhs.discretized_duration_remaining && lhs.flow_state == rhs.flow_state;
+    };
+
+    const auto last_chunk = chunk_starts.size() - 1;
+    std::vector<Chunk> chunks(chunk_starts.size());
+    pool.parallelFor(
+        chunks.size(),
+        [&](const std::size_t chunk_index)
+        {
+            auto& chunk = chunks[chunk_index];
+            const auto begin = chunk_starts[chunk_index];
+            const auto end = chunk_index == last_chunk ? gcode_paths.size() : chunk_starts[chunk_index + 1];
+
+            GCodeState chunk_state = state;
+            if (chunk_index > 0)
+            {
+                chunk_state.discretized_duration_remaining = 0;
+                chunk_state.flow_state = FlowState::UNDEFINED;
+            }
+
+            for (auto index = begin; index < end; ++index)
+            {
+                for (auto& path : chunk_state.processGcodePath<utils::Direction::Forward>(gcode_paths[index]))
+                {
+                    chunk.forward_pass_gcode_paths.emplace_back(std::move(path));
+                }
+            }
+            chunk.forward_end_state = chunk_state.layerFlowState();
+
+            chunk_state.discretized_duration_remaining = 0;
+            if (chunk_index == last_chunk)
+            {
+                chunk_state.current_flow = std::min(chunk_state.current_flow, chunk_state.target_end_flow);
+            }
+            else
+            {
+                chunk_state.current_flow = std::numeric_limits<double>::infinity();
+                chunk_state.flow_state = FlowState::UNDEFINED;
+            }
+
+            const auto path_count = chunk.forward_pass_gcode_paths.size();
+            chunk.backward_pass_gcode_paths.resize(path_count);
+            chunk.backward_pass_states.resize(path_count);
+            for (auto index = path_count; index-- > 0;)
+            {
+                chunk.backward_pass_gcode_paths[index] = chunk_state.processGcodePath<utils::Direction::Backward>(chunk.forward_pass_gcode_paths[index]);
+                chunk.backward_pass_states[index] = chunk_state;
+            }
+            chunk.exit_state = chunk_state;
+        });
+
+    // Redo the start of every speculative backward pass with the state the next chunk actually ended with
+    for (auto chunk_index = last_chunk; chunk_index-- > 0;)
+    {
+        auto& chunk = chunks[chunk_index];
+        auto chunk_state = chunks[chunk_index + 1].exit_state;
+        auto converged = false;
+        for (auto index = chunk.forward_pass_gcode_paths.size(); index-- > 0 && ! converged;)
+        {
+            const auto& path = chunk.forward_pass_gcode_paths[index];
+            chunk.backward_pass_gcode_paths[index] = chunk_state.processGcodePath<utils::Direction::Backward>(path);
+            // only compare after an extruding path; travels keep the flow state of the run they are part of
+            converged = ! path.isTravel() && sameBackwardState(chunk_state, chunk.backward_pass_states[index]);
+        }
+        if (! converged)
+        {
+            chunk.exit_state = chunk_state;
+        }
+    }
+
+    state.current_flow = chunks.front().exit_state.current_flow;
+    state.discretized_duration_remaining = chunks.front().exit_state.discretized_duration_remaining;
+    state.flow_state = chunks.front().exit_state.flow_state;
+
+    std::vector<GCodePath> gcode_paths_out;
+    for (auto& chunk : chunks)
+    {
+        for (auto& discretized_paths : chunk.backward_pass_gcode_paths)
+        {
+            for (auto& path : discretized_paths | ranges::views::reverse)
+            {
+                gcode_paths_out.emplace_back(std::move(path));
+            }
+        }
+    }
+    state.end_state = layerEndFlowState(chunks.back().forward_end_state, state.target_end_flow, gcode_paths_out);
+    return gcode_paths_out;
+}
+
+} // namespace plugin::gradual_flow
+
+#endif // CURAENGINE_PLUGIN_GRADUAL_FLOW_CHUNKED_PROCESSING_H
@@ -101,6 +101,16 @@ concept polygons = ranges::range<T> && polygon<typename T::value_type>;
 template<class T>
 concept poly_range = polygon<T> || polyline<T>;
 
+/*!
+* @brief How the flow changes along a ramp, a policy of GCodeState::processGcodePath.
+* @details The next flow of a ramp from the current flow, the target flow, the flow acceleration of the ramp and the duration of a step.
+* @tparam T Type to check
+*/
+template<class T>
+concept flow_model = requires(double flow) {
+    { T::nextFlow(flow, flow, flow, flow) } -> std::convertible_to<double>;
+};
+
 } // namespace concepts
 } // namespace gradual_flow
 
@@ -0,0 +1,555 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef CURAENGINE_PLUGIN_GRADUAL_FLOW_FIXED_POINT_GCODE_STATE_H
+#define CURAENGINE_PLUGIN_GRADUAL_FLOW_FIXED_POINT_GCODE_STATE_H
+
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/utils.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#if ! defined(__SIZEOF_INT128__) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace plugin::gradual_flow
+{
+
+namespace fixed_point
+{
+
+using Length = std::int64_t; // um / 2^8
+using Duration = std::int64_t; // ns
+using Flow = std::int64_t; // um^3/s
+using Acceleration = std::int64_t; // um^3/s^2
+using Speed = std::int64_t; // um/s / 2^24
+using Area = std::int64_t; // extrusion volume per um, um^3/um / 2^24
+
+constexpr int length_bits{ 8 };
+constexpr int speed_bits{ 24 };
+constexpr int area_bits{ 24 };
+constexpr std::int64_t ns_per_s{ 1'000'000'000 };
+
+enum class Rounding
+{
+    NEAREST,
+    DOWN
+};
+
+/*
+ * Returns a * b / c, with a 128 bit intermediate product; saturates at the largest int64 value, also
+ * for a division by 0.
+ *
+ * @param a, b, c non-negative values
+ */
+inline std::int64_t mulDiv(const std::int64_t a, const std::int64_t b, const std::int64_t c, const Rounding rounding = Rounding::NEAREST)
+{
+    assert(a >= 0 && b >= 0 && c >= 0);
+    constexpr auto max = static_cast<std::uint64_t>(std::numeric_limits<std::int64_t>::max());
+    if (c == 0)
+    {
+        return a == 0 || b == 0 ? 0 : std::numeric_limits<std::int64_t>::max();
+    }
+#if defined(__SIZEOF_INT128__)
+    const auto half = rounding == Rounding::NEAREST ? static_cast<std::uint64_t>(c) / 2 : 0;
+    const auto quotient = (static_cast<unsigned __int128>(a) * static_cast<std::uint64_t>(b) + half) / static_cast<std::uint64_t>(c);
+    return quotient > max ? std::numeric_limits<std::int64_t>::max() : static_cast<std::int64_t>(quotient);
+#else
+    std::uint64_t high;
+    auto low = _umul128(static_cast<std::uint64_t>(a), static_cast<std::uint64_t>(b), &high);
+    const auto half = rounding == Rounding::NEAREST ? static_cast<std::uint64_t>(c) / 2 : 0;
+    low += half;
+    high += low < half ? 1 : 0;
+    if (high >= static_cast<std::uint64_t>(c))
+    {
+        return std::numeric_limits<std::int64_t>::max();
+    }
+    std::uint64_t remainder;
+    const auto quotient = _udiv128(high, low, static_cast<std::uint64_t>(c), &remainder);
+    return quotient > max ? std::numeric_limits<std::int64_t>::max() : static_cast<std::int64_t>(quotient);
+#endif
+}
+
+/*
+ * Returns the floor of the square root; the floating point estimate is corrected, so the result is
+ * exact on every platform.
+ */
+inline std::uint64_t isqrt(const std::uint64_t value)
+{
+    constexpr std::uint64_t max_root{ 0xffffffffULL }; // the square of a larger root does not fit
+    auto root = std::min(max_root, static_cast<std::uint64_t>(std::sqrt(static_cast<double>(value))));
+    while (root > 0 && root * root > value)
+    {
+        root--;
+    }
+    while (root < max_root && (root + 1) * (root + 1) <= value)
+    {
+        root++;
+    }
+    return root;
+}
+
+/*
+ * Returns the length of a segment, coordinates are in um. Segments up to about 16 m long are exact
+ * to 1/256 um, longer ones to 1 um; the length saturates at coordinates more than about 2 km apart.
+ */
+inline Length segmentLength(const ClipperLib::IntPoint& from, const ClipperLib::IntPoint& to)
+{
+    constexpr std::uint64_t max_delta{ std::uint64_t{ 1 } << 31 }; // um, the sum of the squares fits
+    constexpr auto max_exact_square = std::numeric_limits<std::uint64_t>::max() >> (2 * length_bits);
+    const auto dx = std::min(max_delta, static_cast<std::uint64_t>(std::abs(to.X - from.X)));
+    const auto dy = std::min(max_delta, static_cast<std::uint64_t>(std::abs(to.Y - from.Y)));
+    const auto square = dx * dx + dy * dy;
+    if (square > max_exact_square)
+    {
+        return static_cast<Length>(isqrt(square) << length_bits);
+    }
+    return static_cast<Length>(isqrt(square << (2 * length_bits)));
+}
+
+inline Duration toDuration(const double seconds)
+{
+    return std::llround(std::max(0., seconds) * static_cast<double>(ns_per_s));
+}
+
+/*
+ * Returns a value rounded to an integer; an unlimited value, like an unlimited target end flow,
+ * saturates.
+ */
+inline std::int64_t toInteger(const double value)
+{
+    constexpr auto max = static_cast<double>(std::numeric_limits<std::int64_t>::max() / 2);
+    return std::llround(std::clamp(value, 0., max));
+}
+
+inline Speed toSpeed(const double speed) // um/s
+{
+    return std::llround(std::max(0., speed) * static_cast<double>(1 << speed_bits));
+}
+
+/*
+ * Returns the speed at which a path with the given extrusion volume per um has a flow.
+ */
+inline Speed speedOf(const Flow flow, const Area extrusion_volume_per_um)
+{
+    return mulDiv(flow, std::int64_t{ 1 } << (speed_bits + area_bits), extrusion_volume_per_um);
+}
+
+inline Duration durationOf(const Length length, const Speed speed)
+{
+    return mulDiv(length, ns_per_s << (speed_bits - length_bits), speed);
+}
+
+/*
+ * Returns the length covered in a duration, rounded down.
+ */
+inline Length lengthOf(const Duration duration, const Speed speed)
+{
+    return mulDiv(duration, speed, ns_per_s << (speed_bits - length_bits), Rounding::DOWN);
+}
+
+/*
+ * Returns `from + (to - from) * numerator / denominator`, rounded to the nearest um.
+ */
+inline ClipperLib::cInt interpolate(const ClipperLib::cInt from, const ClipperLib::cInt to, const Length numerator, const Length denominator)
+{
+    const auto delta = mulDiv(std::abs(to - from), numerator, denominator);
+    return to >= from ? from + delta : from - delta;
+}
+
+} // namespace fixed_point
+
+/*
+ * Applies the gradual flow passes like GCodeState::processGcodePaths, in integer arithmetic.
+ *
+ * Lengths are in 1/256 um, durations in ns, flows in um^3/s and speeds in 2^-24 um/s. Only the
+ * settings, the start state and the paths are converted from floating point, once; every operation
+ * after that is exact or explicitly rounded, so the same layer gives bit-identical paths with every
+ * compiler, optimization level and platform. The results can then be cached and compared exactly.
+ *
+ * The lengths along a path are measured on the original segments, a partition point is only rounded
+ * to whole um for the piece it ends. GCodeState truncates the partition points and measures the rest
+ * of the path on them, so its pieces fall slightly short and drift along a ramp; the speeds of the
+ * two agree to about 1e-7, but the pieces and the time of a layer can differ, see the tests for the
+ * measured differences.
+ */
+class FixedPointGCodeState
+{
+public:
+    /*
+     * @param state the settings, and the state to start the layer with, as passed to GCodeState::processGcodePaths
+     */
+    explicit FixedPointGCodeState(const GCodeState& state)
+        : current_flow_{ fixed_point::toInteger(state.current_flow) }
+        , flow_acceleration_{ fixed_point::toInteger(state.flow_acceleration) }
+        , flow_deceleration_{ fixed_point::toInteger(state.flow_deceleration) }
+        , discretized_duration_{ fixed_point::toDuration(state.discretized_duration) }
+        , discretized_duration_remaining_{ fixed_point::toDuration(state.discretized_duration_remaining) }
+        , target_end_flow_{ fixed_point::toInteger(state.target_end_flow) }
+        , reset_flow_duration_{ fixed_point::toDuration(state.reset_flow_duration) }
+        , flow_state_{ state.flow_state }
+        , flow_step_tolerance_{ fixed_point::toInteger(state.flow_step_tolerance) }
+    {
+        if (state.feature_policies != nullptr)
+        {
+            for (std::size_t feature = 0; feature < policies_.size(); ++feature)
+            {
+                const auto& feature_policy = (*state.feature_policies)[feature];
+                policies_[feature] = Policy{ .exempt = feature_policy.exempt, .flow_acceleration = fixed_point::toInteger(feature_policy.flow_acceleration) };
+            }
+        }
+    }
+
+    std::vector<GCodePath> processGcodePaths(const std::vector<GCodePath>& gcode_paths)
+    {
+        std::vector<Path> forward_pass_paths;
+        forward_pass_paths.reserve(gcode_paths.size());
+        for (const auto& gcode_path : gcode_paths)
+        {
+            processPath(Path::of(gcode_path), utils::Direction::Forward, forward_pass_paths);
+        }
+
+        discretized_duration_remaining_ = 0;
+        current_flow_ = std::min(current_flow_, target_end_flow_);
+
+        std::vector<Path> backward_pass_paths;
+        backward_pass_paths.reserve(forward_pass_paths.size());
+        for (auto& path : forward_pass_paths | ranges::views::reverse)
+        {
+            processPath(std::move(path), utils::Direction::Backward, backward_pass_paths);
+        }
+
+        std::vector<GCodePath> gcode_paths_out;
+        gcode_paths_out.reserve(backward_pass_paths.size());
+        for (auto& path : backward_pass_paths | ranges::views::reverse)
+        {
+            gcode_paths_out.emplace_back(std::move(path).toGCodePath());
+        }
+        return gcode_paths_out;
+    }
+
+private:
+    struct Policy
+    {
+        bool exempt{ false };
+        fixed_point::Acceleration flow_acceleration{ 0 }; // 0 uses the limit of the layer
+    };
+
+    /*
+     * A path, or a piece of one; an unchanged path refers to the path it was made from instead of
+     * copying its points.
+     */
+    struct Path
+    {
+        const GCodePath* source{ nullptr };
+        const cura::plugins::v0::GCodePath* original_gcode_path_data{ nullptr };
+        geometry::polyline<> points;
+        fixed_point::Flow flow{ 0 };
+        fixed_point::Flow target_flow{ 0 };
+        fixed_point::Speed speed{ 0 };
+        fixed_point::Area extrusion_volume_per_um{ 0 };
+        bool travel{ false };
+
+        static Path of(const GCodePath& gcode_path)
+        {
+            const auto extrusion_volume_per_um = std::llround(std::max(0., gcode_path.extrusionVolumePerMm()) * static_cast<double>(1 << fixed_point::area_bits));
+            return Path{
+                .source = &gcode_path,
+                .original_gcode_path_data = gcode_path.original_gcode_path_data,
+                .flow = fixed_point::toInteger(gcode_path.flow()),
+                .target_flow = fixed_point::toInteger(gcode_path.targetFlow()),
+                .speed = fixed_point::toSpeed(gcode_path.speed),
+                .extrusion_volume_per_um = std::max<fixed_point::Area>(1, extrusion_volume_per_um),
+                .travel = gcode_path.isTravel(),
+            };
+        }
+
+        /*
+         * @return a piece of this path with other points, at a flow
+         */
+        Path piece(geometry::polyline<>&& piece_points, const fixed_point::Flow piece_flow, const fixed_point::Speed piece_speed) const
+        {
+            return Path{
+                .original_gcode_path_data = original_gcode_path_data,
+                .points = std::move(piece_points),
+                .flow = piece_flow,
+                .target_flow = target_flow,
+                .speed = piece_speed,
+                .extrusion_volume_per_um = extrusion_volume_per_um,
+                .travel = travel,
+            };
+        }
+
+        const geometry::polyline<>& polyline() const
+        {
+            return source != nullptr ? source->points : points;
+        }
+
+        fixed_point::Length length() const
+        {
+            const auto& path_points = polyline();
+            fixed_point::Length path_length = 0;
+            for (std::size_t index = 1; index < path_points.size(); ++index)
+            {
+                path_length += fixed_point::segmentLength(path_points[index - 1], path_points[index]);
+            }
+            return path_length;
+        }
+
+        GCodePath toGCodePath() &&
+        {
+            if (source != nullptr)
+            {
+                return *source;
+            }
+            return GCodePath{ .original_gcode_path_data = original_gcode_path_data,
+                              .points = std::move(points),
+                              .speed = static_cast<double>(speed) / static_cast<double>(1 << fixed_point::speed_bits) };
+        }
+    };
+
+    /*
+     * Splits pieces off the beginning or the end of a path, see PathSplitter; the lengths are measured
+     * on the original segments of the path.
+     */
+    class Splitter
+    {
+    public:
+        Splitter(Path& path, const utils::Direction direction)
+            : path_{ path }
+            , points_{ path.polyline() }
+            , forward_{ direction == utils::Direction::Forward }
+        {
+            if (points_.size() > 1)
+            {
+                start_ = point(0);
+                segment_length_ = fixed_point::segmentLength(point(0), point(1));
+            }
+        }
+
+        /*
+         * Splits the next piece off the path.
+         *
+         * @return a tuple of the piece, whether a remaining path is left and the duration that is left
+         * when the piece is the whole remaining path
+         */
+        std::tuple<Path, bool, fixed_point::Duration> split(const fixed_point::Duration duration, const fixed_point::Flow flow, const fixed_point::Speed speed)
+        {
+            auto budget = fixed_point::lengthOf(duration, speed);
+            fixed_point::Length covered = 0;
+            geometry::polyline<> piece_points{ start_ };
+            for (; segment_ + 1 < points_.size(); nextSegment())
+            {
+                const auto segment_left = segment_length_ - offset_;
+                if (budget < segment_left)
+                {
+                    offset_ += budget;
+                    const auto& from = point(segment_);
+                    const auto& to = point(segment_ + 1);
+                    start_ = ClipperLib::IntPoint(fixed_point::interpolate(from.X, to.X, offset_, segment_length_), fixed_point::interpolate(from.Y, to.Y, offset_, segment_length_));
+                    piece_points.emplace_back(start_);
+                    split_ = true;
+                    return std::make_tuple(finish(std::move(piece_points), flow, speed), true, fixed_point::Duration{ 0 });
+                }
+                budget -= segment_left;
+                covered += segment_left;
+                piece_points.emplace_back(point(segment_ + 1));
+            }
+
+            const auto remaining_duration = std::max<fixed_point::Duration>(0, duration - fixed_point::durationOf(covered, speed));
+            return std::make_tuple(finish(std::move(piece_points), flow, speed), false, remaining_duration);
+        }
+
+        /*
+         * @return the remaining path, the path itself if nothing was split off yet
+         */
+        Path remaining() &&
+        {
+            if (! split_)
+            {
+                return std::move(path_);
+            }
+            geometry::polyline<> remaining_points{ start_ };
+            for (auto index = segment_ + 1; index < points_.size(); ++index)
+            {
+                remaining_points.emplace_back(point(index));
+            }
+            return finish(std::move(remaining_points), path_.flow, path_.speed);
+        }
+
+        /*
+         * @return the length of the remaining path
+         */
+        fixed_point::Length remainingLength() const
+        {
+            if (segment_ + 1 >= points_.size())
+            {
+                return 0;
+            }
+            auto remaining_length = segment_length_ - offset_;
+            for (auto index = segment_ + 1; index + 1 < points_.size(); ++index)
+            {
+                remaining_length += fixed_point::segmentLength(point(index), point(index + 1));
+            }
+            return remaining_length;
+        }
+
+    private:
+        const ClipperLib::IntPoint& point(const std::size_t index) const
+        {
+            return forward_ ? points_[index] : points_[points_.size() - 1 - index];
+        }
+
+        void nextSegment()
+        {
+            segment_++;
+            offset_ = 0;
+            segment_length_ = segment_ + 1 < points_.size() ? fixed_point::segmentLength(point(segment_), point(segment_ + 1)) : 0;
+        }
+
+        /*
+         * @return a piece with points in the order they are split off, in print order
+         */
+        Path finish(geometry::polyline<>&& piece_points, const fixed_point::Flow flow, const fixed_point::Speed speed) const
+        {
+            if (! forward_)
+            {
+                std::reverse(piece_points.begin(), piece_points.end());
+            }
+            return path_.piece(std::move(piece_points), flow, speed);
+        }
+
+        Path& path_;
+        const geometry::polyline<>& points_;
+        bool forward_{ true };
+        std::size_t segment_{ 0 }; // the segment from point(segment_) to point(segment_ + 1)
+        fixed_point::Length segment_length_{ 0 };
+        fixed_point::Length offset_{ 0 }; // along the segment, to start_
+        ClipperLib::IntPoint start_{};
+        bool split_{ false };
+    };
+
+    const Policy* policy(const Path& path) const
+    {
+        const auto feature = static_cast<std::size_t>(path.original_gcode_path_data->feature());
+        return feature < policies_.size() ? &policies_[feature] : nullptr;
+    }
+
+    fixed_point::Duration stepDuration(const fixed_point::Acceleration acceleration) const
+    {
+        if (flow_step_tolerance_ <= 0 || acceleration <= 0)
+        {
+            return discretized_duration_;
+        }
+        return std::max(fixed_point::toDuration(GCodeState::min_discretized_duration), fixed_point::mulDiv(flow_step_tolerance_, fixed_point::ns_per_s, acceleration));
+    }
+
+    /*
+     * Discretizes a path like GCodeState::processGcodePath, appending the pieces in the order they
+     * are split off.
+     */
+    void processPath(Path&& path, const utils::Direction direction, std::vector<Path>& discretized_paths)
+    {
+        if (path.travel)
+        {
+            if (path.original_gcode_path_data->retract() || fixed_point::durationOf(path.length(), path.speed) > reset_flow_duration_)
+            {
+                flow_state_ = FlowState::UNDEFINED;
+            }
+            discretized_paths.emplace_back(std::move(path));
+            return;
+        }
+
+        if (flow_state_ == FlowState::UNDEFINED && direction == utils::Direction::Forward)
+        {
+            current_flow_ = path.target_flow;
+        }
+
+        const auto target_flow = path.flow;
+        const auto* path_policy = policy(path);
+        if (target_flow <= current_flow_ || (path_policy != nullptr && path_policy->exempt))
+        {
+            current_flow_ = target_flow;
+            discretized_duration_remaining_ = 0;
+            flow_state_ = FlowState::STABLE;
+            discretized_paths.emplace_back(std::move(path));
+            return;
+        }
+
+        Splitter remaining_path{ path, direction };
+
+        if (discretized_duration_remaining_ > 0)
+        {
+            const auto segment_speed = fixed_point::speedOf(current_flow_, path.extrusion_volume_per_um);
+            auto [partitioned_path, has_remaining_path, remaining_partition_duration] = remaining_path.split(discretized_duration_remaining_, current_flow_, segment_speed);
+            discretized_duration_remaining_ = std::max<fixed_point::Duration>(0, discretized_duration_remaining_ - remaining_partition_duration);
+            discretized_paths.emplace_back(std::move(partitioned_path));
+            if (! has_remaining_path)
+            {
+                flow_state_ = FlowState::TRANSITION;
+                return;
+            }
+        }
+
+        auto flow_acceleration = direction == utils::Direction::Forward ? flow_acceleration_ : flow_deceleration_;
+        if (path_policy != nullptr && path_policy->flow_acceleration > 0)
+        {
+            flow_acceleration = path_policy->flow_acceleration;
+        }
+        const auto step_duration = stepDuration(flow_acceleration);
+        // rounded down, so a step never changes the flow by more than the acceleration allows
+        const auto flow_delta = fixed_point::mulDiv(flow_acceleration, step_duration, fixed_point::ns_per_s, fixed_point::Rounding::DOWN);
+
+        while (current_flow_ < target_flow)
+        {
+            current_flow_ = std::min(target_flow, current_flow_ + flow_delta);
+            const auto segment_speed = fixed_point::speedOf(current_flow_, path.extrusion_volume_per_um);
+
+            if (current_flow_ == target_flow)
+            {
+                const auto last_path_duration = fixed_point::durationOf(remaining_path.remainingLength(), segment_speed);
+                discretized_duration_remaining_ = std::max<fixed_point::Duration>(0, discretized_duration_remaining_ - last_path_duration);
+                flow_state_ = discretized_duration_remaining_ > 0 ? FlowState::TRANSITION : FlowState::STABLE;
+                discretized_paths.emplace_back(std::move(remaining_path).remaining());
+                return;
+            }
+
+            auto [partitioned_path, has_remaining_path, remaining_partition_duration] = remaining_path.split(step_duration, current_flow_, segment_speed);
+            discretized_paths.emplace_back(std::move(partitioned_path));
+
+            if (! has_remaining_path)
+            {
+                flow_state_ = FlowState::TRANSITION;
+                discretized_duration_remaining_ = remaining_partition_duration;
+                return;
+            }
+        }
+        discretized_paths.emplace_back(std::move(remaining_path).remaining());
+        flow_state_ = discretized_duration_remaining_ > 0 ? FlowState::TRANSITION : FlowState::STABLE;
+    }
+
+    fixed_point::Flow current_flow_{ 0 };
+    fixed_point::Acceleration flow_acceleration_{ 0 };
+    fixed_point::Acceleration flow_deceleration_{ 0 };
+    fixed_point::Duration discretized_duration_{ 0 };
+    fixed_point::Duration discretized_duration_remaining_{ 0 };
+    fixed_point::Flow target_end_flow_{ 0 };
+    fixed_point::Duration reset_flow_duration_{ 0 };
+    FlowState flow_state_{ FlowState::UNDEFINED };
+    fixed_point::Flow flow_step_tolerance_{ 0 };
+    std::array<Policy, cura::plugins::v0::PrintFeature_ARRAYSIZE> policies_{};
+};
+
+} // namespace plugin::gradual_flow
+
+#endif // CURAENGINE_PLUGIN_GRADUAL_FLOW_FIXED_POINT_GCODE_STATE_H
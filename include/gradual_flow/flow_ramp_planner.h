@@ -0,0 +1,263 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef CURAENGINE_PLUGIN_GRADUAL_FLOW_FLOW_RAMP_PLANNER_H
+#define CURAENGINE_PLUGIN_GRADUAL_FLOW_FLOW_RAMP_PLANNER_H
+
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/worker_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <utility>
+#include <vector>
+
+namespace plugin::gradual_flow
+{
+
+/*
+ * Returns the total duration of a sequence of paths, travels included.
+ *
+ * @return the duration in seconds
+ */
+inline double printDuration(const std::vector<GCodePath>& gcode_paths) // s
+{
+    double duration = 0.;
+    for (const auto& path : gcode_paths)
+    {
+        duration += path.totalDuration();
+    }
+    return duration;
+}
+
+/*
+ * Plans the flow of a layer for the shortest print time under the flow acceleration limits, like the
+ * velocity pass of a motion planner.
+ *
+ * The stepped ramps of GCodeState raise the flow from the flow a path happens to start with and only
+ * account for the time spent extruding. The planner instead computes, per run of paths between two
+ * flow resets, the fastest flow profile for which the flow never changes faster than the flow
+ * acceleration/deceleration; the time spent on (short) travels counts as ramp time as well. Within a
+ * path with a constant extrusion volume per mm the profile is a trapezoid in time: a ramp up from the
+ * entry flow, the target flow, and a ramp down to the exit flow. Ramps are discretized in steps like
+ * the stepped ramps; every step runs at the flow the ideal ramp reaches at the end of that step.
+ */
+struct FlowRampPlanner
+{
+    double flow_acceleration{ 0.0 }; // um^3/s^2
+    double flow_deceleration{ 0.0 }; // um^3/s^2
+    double acceleration_step_duration{ 0.0 }; // s
+    double deceleration_step_duration{ 0.0 }; // s
+    double reset_flow_duration{ 0.0 }; // s
+
+    static constexpr double min_piece_length{ 1.0 }; // um
+    static constexpr double unlimited_flow{ std::numeric_limits<double>::infinity() };
+
+    /*
+     * Plans the flow of the paths of a layer.
+     *
+     * @param gcode_paths the paths of the layer
+     * @param start_flow the flow the layer starts with, `unlimited_flow` if it starts without a flow history
+     * @param end_flow the highest flow the layer can end with
+     * @param pool the workers to discretize the paths on
+     * @param end_state set to the flow the layer ends with, if given, see layerEndFlowState; the
+     * ramps are continuous, so nothing of a step is carried over
+     * @return the discretized paths of the layer
+     */
+    std::vector<GCodePath> plan(
+        const std::vector<GCodePath>& gcode_paths,
+        const double start_flow,
+        const double end_flow,
+        WorkerPool& pool,
+        LayerFlowState* end_state = nullptr) const
+    {
+        // the flow at the start and at the end of every extruding path
+        std::vector<std::pair<double, double>> boundary_flows(gcode_paths.size());
+
+        auto flow_limit = start_flow;
+        auto forward_end_state = start_flow == unlimited_flow ? LayerFlowState{} : LayerFlowState{ .flow = start_flow, .flow_state = FlowState::STABLE };
+        for (const auto& [index, path] : gcode_paths | ranges::views::enumerate)
+        {
+            if (path.isTravel())
+            {
+                flow_limit = resetsFlow(path) ? unlimited_flow : flow_limit + flow_acceleration * path.totalDuration();
+                forward_end_state = resetsFlow(path) ? LayerFlowState{} : forward_end_state;
+                continue;
+            }
+            const auto entry_flow = std::min(flow_limit, path.flow());
+            const auto exit_flow = std::min(path.flow(), rampedFlow(entry_flow, flow_acceleration, path.extrusionVolumePerMm(), path.total_length));
+            boundary_flows[index] = { entry_flow, exit_flow };
+            flow_limit = exit_flow;
+            forward_end_state = LayerFlowState{ .flow = exit_flow, .flow_state = FlowState::STABLE };
+        }
+
+        flow_limit = end_flow;
+        for (auto index = gcode_paths.size(); index-- > 0;)
+        {
+            const auto& path = gcode_paths[index];
+            if (path.isTravel())
+            {
+                flow_limit = resetsFlow(path) ? unlimited_flow : flow_limit + flow_deceleration * path.totalDuration();
+                continue;
+            }
+            auto& [entry_flow, exit_flow] = boundary_flows[index];
+            exit_flow = std::min(exit_flow, flow_limit);
+            entry_flow = std::min(entry_flow, rampedFlow(exit_flow, flow_deceleration, path.extrusionVolumePerMm(), path.total_length));
+            flow_limit = entry_flow;
+        }
+
+        // with the flow at every boundary known, the paths can be discretized independently
+        std::vector<std::vector<GCodePath>> discretized_paths(gcode_paths.size());
+        pool.parallelFor(
+            gcode_paths.size(),
+            [&](const std::size_t index)
+            {
+                const auto& path = gcode_paths[index];
+                discretized_paths[index] = path.isTravel() ? std::vector<GCodePath>{ path } : discretize(path, boundary_flows[index].first, boundary_flows[index].second);
+            });
+
+        std::vector<GCodePath> gcode_paths_out;
+        for (auto& paths : discretized_paths)
+        {
+            std::move(paths.begin(), paths.end(), std::back_inserter(gcode_paths_out));
+        }
+        if (end_state != nullptr)
+        {
+            *end_state = layerEndFlowState(forward_end_state, end_flow, gcode_paths_out);
+        }
+        return gcode_paths_out;
+    }
+
+    bool resetsFlow(const GCodePath& path) const
+    {
+        return path.isRetract() || path.totalDuration() > reset_flow_duration;
+    }
+
+    /*
+     * Returns the flow reached after ramping over a distance. With a constant extrusion volume per mm
+     * the flow changes like the speed of a uniformly accelerating body: Q^2 = Q0^2 + 2 * a * e * s.
+     *
+     * @param flow the flow at the start of the ramp in um^3/s
+     * @param acceleration the flow acceleration in um^3/s^2
+     * @param extrusion_volume_per_mm the extrusion volume per mm in um^3/um
+     * @param distance the length of the ramp in um
+     * @return the flow at the end of the ramp in um^3/s
+     */
+    static double rampedFlow(const double flow, const double acceleration, const double extrusion_volume_per_mm, const double distance)
+    {
+        return std::sqrt(flow * flow + 2. * acceleration * extrusion_volume_per_mm * distance);
+    }
+
+    /*
+     * Splits a path into a ramp up from `entry_flow`, a part at the highest reachable flow and a ramp
+     * down to `exit_flow`.
+     */
+    std::vector<GCodePath> discretize(const GCodePath& path, const double entry_flow, const double exit_flow) const
+    {
+        const auto target_flow = path.flow();
+        const auto extrusion_volume_per_mm = path.extrusionVolumePerMm();
+        if (entry_flow >= target_flow && exit_flow >= target_flow)
+        {
+            return { path };
+        }
+
+        // where the ramp up meets the ramp down, or the target flow when the path is long enough
+        auto peak_flow = target_flow;
+        if (flow_acceleration + flow_deceleration > 0.)
+        {
+            const auto peak_distance = std::clamp(
+                (exit_flow * exit_flow - entry_flow * entry_flow + 2. * flow_deceleration * extrusion_volume_per_mm * path.total_length)
+                    / (2. * extrusion_volume_per_mm * (flow_acceleration + flow_deceleration)),
+                0.,
+                path.total_length);
+            peak_flow = std::min(target_flow, rampedFlow(entry_flow, flow_acceleration, extrusion_volume_per_mm, peak_distance));
+        }
+        peak_flow = std::max({ peak_flow, entry_flow, exit_flow });
+
+        // pieces of the path as length and flow, in print order
+        std::vector<std::pair<double, double>> pieces = rampPieces(entry_flow, peak_flow, flow_acceleration, acceleration_step_duration, extrusion_volume_per_mm);
+        auto ramp_down_pieces = rampPieces(exit_flow, peak_flow, flow_deceleration, deceleration_step_duration, extrusion_volume_per_mm);
+        double ramp_length = 0.;
+        for (const auto& [length, flow] : pieces)
+        {
+            ramp_length += length;
+        }
+        for (const auto& [length, flow] : ramp_down_pieces)
+        {
+            ramp_length += length;
+        }
+        pieces.emplace_back(std::max(0., path.total_length - ramp_length), peak_flow);
+        pieces.insert(pieces.end(), ramp_down_pieces.rbegin(), ramp_down_pieces.rend());
+
+        std::vector<GCodePath> discretized_paths;
+        PathSplitter<utils::Direction::Forward> remaining_path{ path };
+        auto carried_length = 0.;
+        for (const auto& [piece_index, piece] : pieces | ranges::views::enumerate)
+        {
+            const auto& [length, flow] = piece;
+            const auto segment_speed = flow / extrusion_volume_per_mm; // um^3/s / um^3/um = um/s
+            if (piece_index + 1 == pieces.size())
+            {
+                // construct a new path rather than setting the speed, the flow is derived from the speed on construction
+                auto last_path = std::move(remaining_path).remaining();
+                discretized_paths.emplace_back(GCodePath{
+                    .original_gcode_path_data = last_path.original_gcode_path_data,
+                    .points = std::move(last_path.points),
+                    .speed = segment_speed,
+                });
+                break;
+            }
+
+            // pieces too short to split off are printed as part of the next piece
+            carried_length += length;
+            if (carried_length < min_piece_length)
+            {
+                continue;
+            }
+            auto [partitioned_gcode_path, has_remaining_path, remaining_partition_duration] = remaining_path.split(carried_length / segment_speed, segment_speed);
+            carried_length = 0.;
+            discretized_paths.emplace_back(std::move(partitioned_gcode_path));
+            if (! has_remaining_path)
+            {
+                break;
+            }
+        }
+        return discretized_paths;
+    }
+
+    /*
+     * Returns the steps of a ramp from `start_flow` to `end_flow`, starting at `start_flow`.
+     *
+     * @return the length in um and the flow in um^3/s of every step
+     */
+    static std::vector<std::pair<double, double>>
+        rampPieces(const double start_flow, const double end_flow, const double acceleration, const double step_duration, const double extrusion_volume_per_mm)
+    {
+        std::vector<std::pair<double, double>> pieces;
+        if (end_flow <= start_flow || acceleration <= 0. || step_duration <= 0.)
+        {
+            return pieces;
+        }
+
+        const auto ramp_duration = (end_flow - start_flow) / acceleration;
+        const auto rampDistance = [&](const double duration)
+        {
+            return (start_flow * duration + .5 * acceleration * duration * duration) / extrusion_volume_per_mm;
+        };
+        auto previous_distance = 0.;
+        for (auto step = 1; previous_distance < rampDistance(ramp_duration); ++step)
+        {
+            const auto duration = std::min(step * step_duration, ramp_duration);
+            const auto distance = rampDistance(duration);
+            pieces.emplace_back(distance - previous_distance, start_flow + acceleration * duration);
+            previous_distance = distance;
+        }
+        return pieces;
+    }
+};
+
+} // namespace plugin::gradual_flow
+
+#endif // CURAENGINE_PLUGIN_GRADUAL_FLOW_FLOW_RAMP_PLANNER_H
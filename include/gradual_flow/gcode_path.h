@@ -17,7 +17,13 @@
 #include <range/v3/view/take.hpp>
 #include <spdlog/spdlog.h>
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <iterator>
 #include <optional>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 namespace plugin::gradual_flow
@@ -30,6 +36,22 @@ enum class FlowState
     UNDEFINED
 };
 
+/*
+ * Appends the points as SVG path data, in mm, to a buffer.
+ *
+ * @param buffer the buffer to append to
+ * @param points the points of the path, in um
+ */
+inline void appendSvgPathData(fmt::memory_buffer& buffer, const geometry::polyline<>& points)
+{
+    auto identifier = 'M';
+    for (const auto& point : points)
+    {
+        fmt::format_to(std::back_inserter(buffer), "{}{} {} ", identifier, static_cast<double>(point.X) * 1e-3, static_cast<double>(point.Y) * 1e-3);
+        identifier = 'L';
+    }
+}
+
 struct GCodePath
 {
     const cura::plugins::v0::GCodePath* original_gcode_path_data;
@@ -102,15 +124,9 @@ struct GCodePath
      */
     std::string toSvgPathData() const
     {
-        std::string path_data;
-        auto is_first_point = true;
-        for (auto point : points)
-        {
-            const auto identifier = is_first_point ? "M" : "L";
-            path_data += fmt::format("{}{} {} ", identifier, point.X * 1e-3, point.Y * 1e-3);
-            is_first_point = false;
-        }
-        return path_data;
+        fmt::memory_buffer buffer;
+        appendSvgPathData(buffer, points);
+        return fmt::to_string(buffer);
     };
 
     /*
@@ -120,16 +136,20 @@ struct GCodePath
      */
     std::string toSvgPath()
     {
-        const auto path_data = toSvgPathData();
-
+        fmt::memory_buffer buffer;
         if (isTravel())
         {
-            return fmt::format("<path d=\"{}\" fill=\"none\" stroke=\"black\" stroke-width=\"0.05\" />", path_data);
+            fmt::format_to(std::back_inserter(buffer), "<path d=\"");
+            appendSvgPathData(buffer, points);
+            fmt::format_to(std::back_inserter(buffer), "\" fill=\"none\" stroke=\"black\" stroke-width=\"0.05\" />");
+            return fmt::to_string(buffer);
         }
 
         const auto [r, g, b] = gradual_flow::utils::hsvToRgb(flow() * .00000003, 100., 100.);
-        const auto color = fmt::format("rgb({},{},{})", r, g, b);
-        return fmt::format("<path d=\"{}\" fill=\"none\" stroke=\"{}\" stroke-width=\"0.1\" />", path_data, color);
+        fmt::format_to(std::back_inserter(buffer), "<path d=\"");
+        appendSvgPathData(buffer, points);
+        fmt::format_to(std::back_inserter(buffer), "\" fill=\"none\" stroke=\"rgb({},{},{})\" stroke-width=\"0.1\" />", r, g, b);
+        return fmt::to_string(buffer);
     }
 
     /*
@@ -159,46 +179,99 @@ struct GCodePath
         return total_length / speed;
     }
 
+    cura::plugins::v0::GCodePath toGrpcMessage(const bool include_first_point) const
+    {
+        cura::plugins::v0::GCodePath message;
+        toGrpcMessage(message, include_first_point);
+        return message;
+    }
+
     /*
-     * Splits either the beginning or the end of the path into a new path.
-     *
-     * @param partition_duration duration of the partitioned paths in s
-     * @param partition_speed speed of the partitioned paths in um/s
-     * @param direction
-     * @return a tuple of the partitioned path and the remaining path, the
-     * remaining path can possibly be empty if the duration of the
-     * partitioned path is equal or longer than the duration of the original
-     * path
+     * Writes the path into a message, e.g. one added to a response in place.
      */
-    std::tuple<GCodePath, std::optional<GCodePath>, double> partition(const double partition_duration, const double partition_speed, const utils::Direction direction) const
+    void toGrpcMessage(cura::plugins::v0::GCodePath& message, const bool include_first_point) const
     {
-        const auto total_path_duration = total_length / partition_speed;
-        if (partition_duration >= total_path_duration)
+        toGrpcMessage(message, include_first_point, *original_gcode_path_data);
+    }
+
+    /*
+     * Writes the path into a message, with all fields but the points and the speed copied from
+     * `fields`; the original path data, or the message of an earlier piece of the same original path.
+     * The latter is much cheaper for a piece of a long path, copying the original path data copies
+     * all of its points.
+     */
+    void toGrpcMessage(cura::plugins::v0::GCodePath& message, const bool include_first_point, const cura::plugins::v0::GCodePath& fields) const
+    {
+        message.CopyFrom(fields);
+
+        // the cleared points of the copy are reused by add_path
+        message.mutable_path()->clear_path();
+        for (auto& point : points | ranges::views::drop(include_first_point ? 0 : 1))
         {
-            const auto remaining_partition_duration = partition_duration - total_path_duration;
-            const GCodePath gcode_path{ .original_gcode_path_data = original_gcode_path_data, .points = points, .speed = partition_speed };
-            return std::make_tuple(gcode_path, std::nullopt, remaining_partition_duration);
+            const auto& point_message = message.mutable_path()->add_path();
+            point_message->set_x(point.X);
+            point_message->set_y(point.Y);
         }
 
-        auto current_partition_duration = 0.0;
-        auto partition_index = direction == utils::Direction::Forward ? 0 : points.size() - 1;
-        auto iteration_direction = direction == utils::Direction::Forward ? 1 : -1;
-        auto prev_point = points[partition_index];
+        message.mutable_speed_derivatives()->set_velocity(speed * 1e-3);
+    }
+};
 
-        while (true)
+/*
+ * Splits pieces off the beginning or the end of a path, the remaining path is kept in place.
+ *
+ * Only the points of a piece are copied when it is split off, so splitting a path into many pieces
+ * takes time linear in its number of points. Pieces are split off the back of the points, the
+ * points of a path that is split from its beginning are kept in reverse.
+ *
+ * @tparam direction the direction of the pass; the forward pass splits from the beginning of the path
+ */
+template<utils::Direction direction>
+class PathSplitter
+{
+public:
+    explicit PathSplitter(GCodePath path)
+        : path_{ std::move(path) }
+    {
+        if constexpr (direction == utils::Direction::Forward)
         {
-            const auto next_point = points[partition_index + iteration_direction];
-            const auto segment_length = std::hypot(next_point.X - prev_point.X, next_point.Y - prev_point.Y);
-            const auto segment_duration = segment_length / partition_speed;
+            std::reverse(path_.points.begin(), path_.points.end());
+        }
+    }
 
-            if (current_partition_duration + segment_duration < partition_duration)
-            {
-                prev_point = next_point;
-                current_partition_duration += segment_duration;
-                partition_index += iteration_direction;
-            }
-            else
+    /*
+     * Splits the next piece off the path.
+     *
+     * @param partition_duration duration of the piece in s
+     * @param partition_speed speed of the piece in um/s
+     * @return a tuple of the piece, whether a remaining path is left and the duration that is left
+     * when the piece is the whole remaining path
+     */
+    std::tuple<GCodePath, bool, double> split(const double partition_duration, const double partition_speed)
+    {
+        auto& points = path_.points;
+        // once pieces were split off, the length of the remaining path is only an estimate; it is
+        // computed exactly when the piece may be the whole remaining path
+        if (split_ && partition_duration >= path_.total_length / partition_speed * (1. - length_estimate_tolerance))
+        {
+            path_.total_length = length();
+        }
+        const auto total_path_duration = path_.total_length / partition_speed;
+        if (partition_duration < total_path_duration)
+        {
+            auto current_partition_duration = 0.0;
+            for (auto partition_index = points.size() - 1; partition_index > 0; --partition_index)
             {
+                const auto prev_point = points[partition_index];
+                const auto next_point = points[partition_index - 1];
+                const auto segment_length = std::hypot(next_point.X - prev_point.X, next_point.Y - prev_point.Y);
+                const auto segment_duration = segment_length / partition_speed;
+                if (current_partition_duration + segment_duration < partition_duration)
+                {
+                    current_partition_duration += segment_duration;
+                    continue;
+                }
+
                 const auto duration_left = partition_duration - current_partition_duration;
                 auto segment_ratio = duration_left / segment_duration;
                 assert(segment_ratio >= -1e-6 && segment_ratio <= 1. + 1e-6);
@@ -210,94 +283,180 @@ struct GCodePath
                  *                       partition point
                  *                            v
                  *   0---------1---------2----x------3---------4
-                 *                       ^           ^
-                 *    partition index when           partition_index when
-                 *          going forwards           going backwards
+                 *                                   ^
+                 *                                   partition_index
                  *
-                 * When we partition the path in a "left" and "right" path we
-                 * expect we end up with the same path for the same partition
-                 * if we go forwards or backwards. This is why
-                 *         partition_point_index = partition_index + 1
-                 * when going _forwards_, while going _backwards_ it is equal
-                 * to
-                 *           partition_point_index = partition_index
-                 *
-                 * Given this new index every point for which
-                 *                 0 >= i > partition_point_index
-                 * holds belongs to the _left_ path while every point for which
-                 *        partition_point_index >= i > points.size()
-                 * belongs to the right path.
+                 * The points from partition_index on, and the partition point, make up the piece.
+                 * The points before partition_index, and the partition point, remain. Both paths
+                 * are the same for the same partition point when the points are kept in reverse,
+                 * so splitting from the beginning and from the end give the same geometry.
                  */
-                const auto partition_point_index = direction == utils::Direction::Forward ? partition_index + 1 : partition_index;
-
-                // points left of the partition_index
-                geometry::polyline<> left_points;
-                for (unsigned int i = 0; i < partition_point_index; ++i)
+                geometry::polyline<> piece_points;
+                piece_points.reserve(points.size() - partition_index + 1);
+                if constexpr (direction == utils::Direction::Forward)
                 {
-                    left_points.emplace_back(points[i]);
+                    piece_points.insert(piece_points.end(), points.rbegin(), std::next(points.rbegin(), static_cast<std::ptrdiff_t>(points.size() - partition_index)));
+                    piece_points.emplace_back(partition_point);
                 }
-                left_points.emplace_back(partition_point);
-
-                // points right of the partition_index
-                geometry::polyline<> right_points;
-                right_points.emplace_back(partition_point);
-                for (unsigned int i = partition_point_index; i < points.size(); ++i)
+                else
                 {
-                    right_points.emplace_back(points[i]);
+                    piece_points.emplace_back(partition_point);
+                    piece_points.insert(piece_points.end(), std::next(points.begin(), static_cast<std::ptrdiff_t>(partition_index)), points.end());
                 }
-
-                switch (direction)
-                {
-                case utils::Direction::Forward:
-                {
-                    const GCodePath partition_gcode_path{
-                        .original_gcode_path_data = original_gcode_path_data,
-                        .points = left_points,
-                        .speed = partition_speed,
-                    };
-                    const GCodePath remaining_gcode_path{
-                        .original_gcode_path_data = original_gcode_path_data,
-                        .points = right_points,
-                        .speed = speed,
-                    };
-                    return std::make_tuple(partition_gcode_path, remaining_gcode_path, .0);
+                GCodePath piece{
+                    .original_gcode_path_data = path_.original_gcode_path_data,
+                    .points = std::move(piece_points),
+                    .speed = partition_speed,
                 };
-                case utils::Direction::Backward:
-                {
-                    const GCodePath partition_gcode_path{
-                        .original_gcode_path_data = original_gcode_path_data,
-                        .points = right_points,
-                        .speed = partition_speed,
-                    };
-                    const GCodePath remaining_gcode_path{
-                        .original_gcode_path_data = original_gcode_path_data,
-                        .points = left_points,
-                        .speed = speed,
-                    };
-                    return std::make_tuple(partition_gcode_path, remaining_gcode_path, .0);
-                }
-                }
+
+                points.resize(partition_index);
+                points.emplace_back(partition_point);
+                path_.total_length = std::max(0., path_.total_length - piece.total_length);
+                split_ = true;
+                return std::make_tuple(std::move(piece), true, .0);
             }
         }
+
+        const auto remaining_partition_duration = std::max(0., partition_duration - total_path_duration);
+        auto path = std::move(*this).remaining();
+        GCodePath piece{ .original_gcode_path_data = path.original_gcode_path_data, .points = std::move(path.points), .speed = partition_speed };
+        return std::make_tuple(std::move(piece), false, remaining_partition_duration);
     }
 
-    cura::plugins::v0::GCodePath toGrpcMessage(const bool include_first_point) const
+    /*
+     * @return the remaining path, the path itself if nothing was split off yet
+     */
+    GCodePath remaining() &&
     {
-        cura::plugins::v0::GCodePath message;
+        if constexpr (direction == utils::Direction::Forward)
+        {
+            std::reverse(path_.points.begin(), path_.points.end());
+        }
+        if (! split_)
+        {
+            return std::move(path_);
+        }
+        // the length is computed anew from the points, it only was an estimate while splitting
+        return GCodePath{ .original_gcode_path_data = path_.original_gcode_path_data, .points = std::move(path_.points), .speed = path_.speed };
+    }
 
-        message.CopyFrom(*original_gcode_path_data);
+private:
+    static constexpr double length_estimate_tolerance{ 1e-9 }; // relative
 
-        message.mutable_path()->clear_path();
-        for (auto& point : points | ranges::views::drop(include_first_point ? 0 : 1))
+    /*
+     * @return the length of the remaining path in um, summed in print order like GCodePath::totalLength()
+     */
+    double length() const
+    {
+        const auto& points = path_.points;
+        double path_length = 0;
+        for (std::size_t index = 1; index < points.size(); ++index)
         {
-            const auto& point_message = message.mutable_path()->add_path();
-            point_message->set_x(point.X);
-            point_message->set_y(point.Y);
+            if constexpr (direction == utils::Direction::Forward)
+            {
+                const auto& point = points[points.size() - 1 - index];
+                const auto& last_point = points[points.size() - index];
+                path_length += std::hypot(point.X - last_point.X, point.Y - last_point.Y);
+            }
+            else
+            {
+                const auto& point = points[index];
+                const auto& last_point = points[index - 1];
+                path_length += std::hypot(point.X - last_point.X, point.Y - last_point.Y);
+            }
         }
+        return path_length;
+    }
 
-        message.mutable_speed_derivatives()->set_velocity(speed * 1e-3);
+    GCodePath path_;
+    bool split_{ false };
+};
 
-        return message;
+/*
+ * Adds the messages of paths to the paths of a response.
+ *
+ * The message of a piece copies the other fields from the message of the previous piece of the same
+ * original path, instead of from the original path with all of its points; a long path split into
+ * many pieces would otherwise take time quadratic in its number of points.
+ *
+ * @param include_first_point whether the first path keeps its first point, the first point of the
+ * other paths is the last point of the previous path
+ */
+inline void addGrpcMessages(google::protobuf::RepeatedPtrField<cura::plugins::v0::GCodePath>& messages, const std::vector<GCodePath>& gcode_paths, const bool include_first_point)
+{
+    messages.Reserve(messages.size() + static_cast<int>(gcode_paths.size()));
+    const GCodePath* previous_path{ nullptr };
+    for (const auto& gcode_path : gcode_paths)
+    {
+        auto& message = *messages.Add();
+        const auto is_next_piece = previous_path != nullptr && previous_path->original_gcode_path_data == gcode_path.original_gcode_path_data;
+        gcode_path.toGrpcMessage(
+            message,
+            previous_path == nullptr && include_first_point,
+            is_next_piece ? messages.Get(messages.size() - 2) : *gcode_path.original_gcode_path_data);
+        previous_path = &gcode_path;
+    }
+}
+
+/*
+ * How the gradual flow treats the paths of a print feature.
+ */
+struct FeaturePolicy
+{
+    bool exempt{ false }; // the paths keep their speed, the paths around them continue from their flow
+    double flow_acceleration{ 0.0 }; // um^3/s^2, of the ramps through the paths in both directions, 0 uses the limit of the layer
+
+    bool operator==(const FeaturePolicy&) const = default;
+};
+
+using FeaturePolicies = std::array<FeaturePolicy, cura::plugins::v0::PrintFeature_ARRAYSIZE>;
+
+/*
+ * The flow at the end of a layer, from which the forward pass of the next layer can continue.
+ */
+struct LayerFlowState
+{
+    double flow{ 0.0 }; // um^3/s
+    double discretized_duration_remaining{ 0.0 }; // s
+    FlowState flow_state{ FlowState::UNDEFINED };
+
+    bool operator==(const LayerFlowState&) const = default;
+};
+
+/*
+ * Returns the flow state a layer hands to the next layer, once the backward pass processed it.
+ *
+ * The backward pass leaves the end of the layer at the state the forward pass ends in, unless the
+ * target end flow is below its flow; the layer then ends with a deceleration step at the flow of its
+ * last extruding path, from which the next layer starts a new step.
+ *
+ * @param forward_end_state the state the forward pass ends in
+ * @param target_end_flow the flow the backward pass starts from, in um^3/s
+ * @param discretized_paths the paths of the layer, or of its end, after the backward pass
+ * @return the flow state to start the next layer with
+ */
+inline LayerFlowState layerEndFlowState(const LayerFlowState& forward_end_state, const double target_end_flow, const std::vector<GCodePath>& discretized_paths)
+{
+    if (forward_end_state.flow_state == FlowState::UNDEFINED || forward_end_state.flow <= target_end_flow)
+    {
+        return forward_end_state;
+    }
+    const auto last_extruding_path = std::find_if(discretized_paths.rbegin(), discretized_paths.rend(), [](const GCodePath& path) { return ! path.isTravel(); });
+    if (last_extruding_path == discretized_paths.rend())
+    {
+        return forward_end_state;
+    }
+    return LayerFlowState{ .flow = last_extruding_path->flow(), .flow_state = FlowState::STABLE };
+}
+
+/*
+ * Ramps the flow up by the flow acceleration times the step duration per step, until the target flow.
+ */
+struct LinearFlowModel
+{
+    static constexpr double nextFlow(const double current_flow, const double target_flow, const double flow_acceleration, const double step_duration)
+    {
+        return std::min(target_flow, current_flow + flow_acceleration * step_duration);
     }
 };
 
@@ -311,21 +470,180 @@ struct GCodeState
     double target_end_flow{ 0.0 }; // um^3/s
     double reset_flow_duration{ 0.0 }; // s
     FlowState flow_state{ FlowState::UNDEFINED };
+    double flow_step_tolerance{ 0.0 }; // um^3/s, when set the step duration adapts to the flow acceleration
+    const FeaturePolicies* feature_policies{ nullptr }; // per print feature, without them all features are treated the same
+    LayerFlowState end_state{}; // set by processGcodePaths, the next layer continues from it, see layerEndFlowState
 
-    std::vector<GCodePath> processGcodePaths(const std::vector<GCodePath>& gcode_paths)
+    static constexpr double min_discretized_duration{ 0.01 }; // s, shortest step of an adaptive ramp, the same as the shortest fixed step
+
+    /*
+     * Returns the current flow state, as a layer that ends in it hands it to the next layer. A reset
+     * flow carries nothing over.
+     */
+    LayerFlowState layerFlowState() const
     {
-        // reset the discretized_duration_remaining
-        discretized_duration_remaining = 0;
+        if (flow_state == FlowState::UNDEFINED)
+        {
+            return LayerFlowState{};
+        }
+        return LayerFlowState{ .flow = current_flow, .discretized_duration_remaining = discretized_duration_remaining, .flow_state = flow_state };
+    }
+
+    /*
+     * Returns the duration of a single discretization step.
+     *
+     * With a fixed step duration every ramp gets steps of `discretized_duration`. In adaptive mode the
+     * step duration is chosen such that the flow increases by at most `flow_step_tolerance` per step,
+     * which is the largest difference between the stepped flow and the ideal linear ramp. Gentle
+     * ramps then get longer steps, and thus fewer segments, than steep ones. Steps never last shorter
+     * than `min_discretized_duration`; a ramp steeper than `flow_step_tolerance /
+     * min_discretized_duration` therefore changes the flow by more than the tolerance per step, by
+     * its flow acceleration times that duration.
+     *
+     * The step duration is chosen per ramp, not per step: all steps of a ramp last the same, except
+     * for the last one, which ends at the target flow. The flow of a linear ramp changes at the same
+     * rate everywhere, so varying the step along the ramp would not lower the number of steps for
+     * the same tolerance.
+     *
+     * @param direction the direction of the pass, the forward pass accelerates and the backward pass decelerates
+     * @return the duration of a step in s
+     */
+    double stepDuration(const utils::Direction direction) const
+    {
+        return accelerationStepDuration(direction == utils::Direction::Forward ? flow_acceleration : flow_deceleration);
+    }
+
+    /*
+     * Returns the duration of a discretization step of a ramp with the given flow acceleration, at
+     * least `min_discretized_duration` in adaptive mode, see stepDuration.
+     */
+    double accelerationStepDuration(const double acceleration) const
+    {
+        if (flow_step_tolerance <= 0. || acceleration <= 0.)
+        {
+            return discretized_duration;
+        }
+        return std::max(min_discretized_duration, flow_step_tolerance / acceleration);
+    }
+
+    /*
+     * Returns the policy of the feature of a path, if there are policies.
+     */
+    const FeaturePolicy* featurePolicy(const GCodePath& path) const
+    {
+        const auto feature = static_cast<std::size_t>(path.original_gcode_path_data->feature());
+        if (feature_policies == nullptr || feature >= feature_policies->size())
+        {
+            return nullptr;
+        }
+        return &(*feature_policies)[feature];
+    }
+
+    bool isExempt(const GCodePath& path) const
+    {
+        const auto* policy = featurePolicy(path);
+        return policy != nullptr && policy->exempt;
+    }
+
+    /*
+     * Returns the flow acceleration of a ramp through a path, the deceleration for the backward pass.
+     */
+    double pathFlowAcceleration(const GCodePath& path, const utils::Direction direction) const
+    {
+        const auto* policy = featurePolicy(path);
+        if (policy != nullptr && policy->flow_acceleration > 0.)
+        {
+            return policy->flow_acceleration;
+        }
+        return direction == utils::Direction::Forward ? flow_acceleration : flow_deceleration;
+    }
+
+    template<utils::Direction direction>
+    double pathFlowAcceleration(const GCodePath& path) const
+    {
+        const auto* policy = featurePolicy(path);
+        if (policy != nullptr && policy->flow_acceleration > 0.)
+        {
+            return policy->flow_acceleration;
+        }
+        if constexpr (direction == utils::Direction::Forward)
+        {
+            return flow_acceleration;
+        }
+        else
+        {
+            return flow_deceleration;
+        }
+    }
+
+    /*
+     * Returns the lowest flow acceleration of a ramp through any path, the deceleration for the
+     * backward pass.
+     */
+    double minFlowAcceleration(const utils::Direction direction) const
+    {
+        auto acceleration = direction == utils::Direction::Forward ? flow_acceleration : flow_deceleration;
+        if (feature_policies != nullptr)
+        {
+            for (const auto& policy : *feature_policies)
+            {
+                if (! policy.exempt && policy.flow_acceleration > 0.)
+                {
+                    acceleration = std::min(acceleration, policy.flow_acceleration);
+                }
+            }
+        }
+        return acceleration;
+    }
 
+    /*
+     * Returns the longest step duration, and the largest flow change of a step, of a ramp through
+     * any path.
+     *
+     * @return a pair of the step duration in s and the flow change in um^3/s
+     */
+    std::pair<double, double> maxStep(const utils::Direction direction) const
+    {
+        const auto acceleration = direction == utils::Direction::Forward ? flow_acceleration : flow_deceleration;
+        auto step_duration = stepDuration(direction);
+        auto step_flow = acceleration * step_duration;
+        if (feature_policies != nullptr)
+        {
+            for (const auto& policy : *feature_policies)
+            {
+                if (! policy.exempt && policy.flow_acceleration > 0.)
+                {
+                    const auto policy_step_duration = accelerationStepDuration(policy.flow_acceleration);
+                    step_duration = std::max(step_duration, policy_step_duration);
+                    step_flow = std::max(step_flow, policy.flow_acceleration * policy_step_duration);
+                }
+            }
+        }
+        return { step_duration, step_flow };
+    }
+
+    /*
+     * Applies the forward and the backward pass to the paths of a layer.
+     *
+     * The state the layer ends in after both passes is kept in `end_state`, for the next layer.
+     *
+     * @tparam FlowModel how the flow changes along a ramp
+     */
+    template<concepts::flow_model FlowModel = LinearFlowModel>
+    std::vector<GCodePath> processGcodePaths(const std::vector<GCodePath>& gcode_paths)
+    {
+        // the forward pass continues with the discretized_duration_remaining the state starts with, this
+        // is non-zero when the previous layer ended halfway through a transition
         std::vector<gradual_flow::GCodePath> forward_pass_gcode_paths;
         for (auto& gcode_path : gcode_paths)
         {
-            auto discretized_paths = processGcodePath(gcode_path, gradual_flow::utils::Direction::Forward);
+            auto discretized_paths = processGcodePath<utils::Direction::Forward, FlowModel>(gcode_path);
             for (auto& path : discretized_paths)
             {
-                forward_pass_gcode_paths.emplace_back(path);
+                forward_pass_gcode_paths.emplace_back(std::move(path));
             }
         }
+        const auto forward_end_state = layerFlowState();
 
         // reset the discretized_duration_remaining
         discretized_duration_remaining = 0;
@@ -339,24 +657,32 @@ struct GCodeState
         std::list<gradual_flow::GCodePath> backward_pass_gcode_paths;
         for (auto& gcode_path : forward_pass_gcode_paths | ranges::views::reverse)
         {
-            auto discretized_paths = processGcodePath(gcode_path, gradual_flow::utils::Direction::Backward);
+            auto discretized_paths = processGcodePath<utils::Direction::Backward, FlowModel>(gcode_path);
             for (auto& path : discretized_paths)
             {
-                backward_pass_gcode_paths.emplace_front(path);
+                backward_pass_gcode_paths.emplace_front(std::move(path));
             }
         }
 
-        return std::vector<gradual_flow::GCodePath>(backward_pass_gcode_paths.begin(), backward_pass_gcode_paths.end());
+        std::vector<gradual_flow::GCodePath> gcode_paths_out(std::make_move_iterator(backward_pass_gcode_paths.begin()), std::make_move_iterator(backward_pass_gcode_paths.end()));
+        end_state = layerEndFlowState(forward_end_state, target_end_flow, gcode_paths_out);
+        return gcode_paths_out;
     }
 
     /*
      * Discretizes a GCodePath into multiple GCodePaths with a gradual increase in flow.
      *
+     * Every pass is a separate instantiation, so the loops over the steps do not switch between the
+     * directions at runtime.
+     *
+     * @tparam direction the direction of the pass, the forward pass accelerates and the backward pass decelerates
+     * @tparam FlowModel how the flow changes along a ramp
      * @param path the path to discretize
      *
      * @return a vector of discretized paths with a gradual increase in flow
      */
-    std::vector<GCodePath> processGcodePath(const GCodePath& path, const utils::Direction direction)
+    template<utils::Direction direction, concepts::flow_model FlowModel = LinearFlowModel>
+    std::vector<GCodePath> processGcodePath(const GCodePath& path)
     {
         if (path.isTravel())
         {
@@ -368,13 +694,17 @@ struct GCodeState
         }
 
         // After a long travel move we want to reset the flow to the target end flow
-        if (flow_state == FlowState::UNDEFINED && direction == utils::Direction::Forward)
+        if constexpr (direction == utils::Direction::Forward)
         {
-            current_flow = path.targetFlow();
+            if (flow_state == FlowState::UNDEFINED)
+            {
+                current_flow = path.targetFlow();
+            }
         }
 
         auto target_flow = path.flow();
-        if (target_flow <= current_flow)
+        // an exempt path keeps its flow, which then is the flow the next ramp starts from
+        if (target_flow <= current_flow || isExempt(path))
         {
             current_flow = target_flow;
             discretized_duration_remaining = 0;
@@ -386,68 +716,62 @@ struct GCodeState
 
         std::vector<GCodePath> discretized_paths;
 
-        GCodePath remaining_path = path;
+        PathSplitter<direction> remaining_path{ path };
 
         if (discretized_duration_remaining > 0.)
         {
             const auto discretized_segment_speed = current_flow / extrusion_volume_per_mm; // um^3/s / um^3/um = um/s
-            const auto [partitioned_gcode_path, new_remaining_path, remaining_partition_duration]
-                = path.partition(discretized_duration_remaining, discretized_segment_speed, direction);
+            auto [partitioned_gcode_path, has_remaining_path, remaining_partition_duration] = remaining_path.split(discretized_duration_remaining, discretized_segment_speed);
             discretized_duration_remaining = std::max(.0, discretized_duration_remaining - remaining_partition_duration);
-            if (new_remaining_path.has_value())
-            {
-                remaining_path = new_remaining_path.value();
-                discretized_paths.emplace_back(partitioned_gcode_path);
-            }
-            else
+            if (! has_remaining_path)
             {
                 flow_state = FlowState::TRANSITION;
-                return { partitioned_gcode_path };
+                return { std::move(partitioned_gcode_path) };
             }
+            discretized_paths.emplace_back(std::move(partitioned_gcode_path));
         }
 
+        const auto path_flow_acceleration = pathFlowAcceleration<direction>(path);
+        const auto step_duration = accelerationStepDuration(path_flow_acceleration);
+
         // while we have not reached the target flow, iteratively discretize the path
-        // such that the new path has a duration of discretized_duration and with each
-        // iteration an increased flow of flow_acceleration
+        // such that the new path has a duration of step_duration and with each
+        // iteration the flow of the flow model
         while (current_flow < target_flow)
         {
-            const auto flow_delta = (direction == utils::Forward ? flow_acceleration : flow_deceleration) * discretized_duration;
-            current_flow = std::min(target_flow, current_flow + flow_delta);
+            current_flow = FlowModel::nextFlow(current_flow, target_flow, path_flow_acceleration, step_duration);
 
             const auto segment_speed = current_flow / extrusion_volume_per_mm; // um^3/s / um^3/um = um/s
 
             if (current_flow == target_flow)
             {
-                remaining_path.speed = segment_speed;
-                discretized_duration_remaining = std::max(discretized_duration_remaining - remaining_path.totalDuration(), .0);
+                auto last_path = std::move(remaining_path).remaining();
+                last_path.speed = segment_speed;
+                discretized_duration_remaining = std::max(discretized_duration_remaining - last_path.totalDuration(), .0);
                 flow_state = discretized_duration_remaining > 0. ? FlowState::TRANSITION : FlowState::STABLE;
-                discretized_paths.emplace_back(remaining_path);
+                discretized_paths.emplace_back(std::move(last_path));
                 return discretized_paths;
             }
 
-            const auto [partitioned_gcode_path, new_remaining_path, remaining_partition_duration] = remaining_path.partition(discretized_duration, segment_speed, direction);
+            auto [partitioned_gcode_path, has_remaining_path, remaining_partition_duration] = remaining_path.split(step_duration, segment_speed);
 
             // when we have remaining paths, we should have no remaining duration as the
             // remaining duration should then be consumed by the remaining paths
-            assert(! new_remaining_path.has_value() || remaining_partition_duration == 0);
+            assert(! has_remaining_path || remaining_partition_duration == 0);
             // having no remaining paths implies that there is a duration remaining that should be consumed
-            // by the next path
-            assert(new_remaining_path.has_value() || remaining_partition_duration > 0);
+            // by the next path, or none at all when the path ends exactly at the end of the step
+            assert(has_remaining_path || remaining_partition_duration >= 0);
 
-            discretized_paths.emplace_back(partitioned_gcode_path);
+            discretized_paths.emplace_back(std::move(partitioned_gcode_path));
 
-            if (new_remaining_path.has_value())
-            {
-                remaining_path = new_remaining_path.value();
-            }
-            else
+            if (! has_remaining_path)
             {
                 flow_state = FlowState::TRANSITION;
                 discretized_duration_remaining = remaining_partition_duration;
                 return discretized_paths;
             }
         }
-        discretized_paths.emplace_back(remaining_path);
+        discretized_paths.emplace_back(std::move(remaining_path).remaining());
 
         flow_state = discretized_duration_remaining > 0. ? FlowState::TRANSITION : FlowState::STABLE;
 
@@ -455,6 +779,38 @@ struct GCodeState
     }
 };
 
+/*
+ * Merges consecutive paths that are pieces of the same original path and have the same speed.
+ *
+ * Carried-over discretized durations and the backward pass can split an original path into pieces
+ * that end up with the same speed. Every piece would otherwise become a separate message with a full
+ * copy of the original path data, and a separate line in the resulting gcode.
+ *
+ * @param gcode_paths the discretized paths
+ * @return the paths with all mergeable pieces joined into a single multi-point path
+ */
+inline std::vector<GCodePath> coalesceGcodePaths(std::vector<GCodePath>&& gcode_paths)
+{
+    std::vector<GCodePath> coalesced_paths;
+    coalesced_paths.reserve(gcode_paths.size());
+    for (auto& path : gcode_paths)
+    {
+        if (! coalesced_paths.empty())
+        {
+            auto& previous_path = coalesced_paths.back();
+            if (previous_path.original_gcode_path_data == path.original_gcode_path_data && previous_path.speed == path.speed && ! path.points.empty()
+                && previous_path.points.back() == path.points.front())
+            {
+                previous_path.points.insert(previous_path.points.end(), std::next(path.points.begin()), path.points.end());
+                previous_path.total_length += path.total_length;
+                continue;
+            }
+        }
+        coalesced_paths.emplace_back(std::move(path));
+    }
+    return coalesced_paths;
+}
+
 } // namespace plugin::gradual_flow
 
 #endif // CURAENGINE_PLUGIN_GRADUAL_FLOW_GCODE_PATH_H
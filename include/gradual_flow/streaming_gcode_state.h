@@ -0,0 +1,228 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef CURAENGINE_PLUGIN_GRADUAL_FLOW_STREAMING_GCODE_STATE_H
+#define CURAENGINE_PLUGIN_GRADUAL_FLOW_STREAMING_GCODE_STATE_H
+
+#include "gradual_flow/gcode_path.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace plugin::gradual_flow
+{
+
+/*
+ * Processes the paths of a layer one at a time, with the same result as GCodeState::processGcodePaths.
+ *
+ * The forward pass only depends on earlier paths, so every path is passed forward as soon as it is
+ * pushed. The backward pass can only lower the flow of a path by a deceleration ramp that starts at a
+ * later path, and such a ramp lasts at most `max flow / flow_deceleration`, with the lowest
+ * deceleration of any print feature. The forward passed paths
+ * are kept in a window until enough extrusion time follows them that no later path can reach them;
+ * the backward pass is then applied to them and they are emitted. The window holds about two of
+ * these ramp durations of paths, regardless of the size of the layer.
+ */
+class StreamingGCodeState
+{
+public:
+    /*
+     * @param state the state to start the layer with, as passed to processGcodePaths
+     */
+    explicit StreamingGCodeState(const GCodeState& state)
+        : forward_state_{ state }
+    {
+    }
+
+    /*
+     * Passes a path of the layer forward.
+     *
+     * @param path the next path of the layer
+     * @return the paths that are final, in print order; possibly none
+     */
+    std::vector<GCodePath> push(const GCodePath& path)
+    {
+        for (auto& discretized_path : forward_state_.processGcodePath<utils::Direction::Forward>(path))
+        {
+            if (! discretized_path.isTravel())
+            {
+                window_duration_ += discretized_path.totalDuration();
+                max_flow_ = std::max(max_flow_, discretized_path.flow());
+            }
+            window_.emplace_back(std::move(discretized_path));
+        }
+
+        if (window_duration_ < 2. * rampDuration())
+        {
+            return {};
+        }
+        const auto merge_index = findMergeIndex();
+        if (! merge_index.has_value())
+        {
+            // the window is dominated by a ramp, try again once it has doubled
+            window_duration_ = 0.;
+            return {};
+        }
+
+        GCodeState backward_state = forward_state_;
+        backward_state.current_flow = window_[*merge_index].flow();
+        backward_state.discretized_duration_remaining = 0.;
+        backward_state.flow_state = FlowState::STABLE;
+        auto finalized_paths = backwardPass(backward_state, *merge_index + 1);
+        window_.erase(window_.begin(), std::next(window_.begin(), static_cast<std::ptrdiff_t>(*merge_index + 1)));
+        updateWindowStatistics();
+        return finalized_paths;
+    }
+
+    /*
+     * Ends the layer and applies the backward pass to the remaining paths.
+     *
+     * @return the remaining paths, in print order
+     */
+    std::vector<GCodePath> finish()
+    {
+        GCodeState backward_state = forward_state_;
+        backward_state.discretized_duration_remaining = 0.;
+        backward_state.current_flow = std::min(backward_state.current_flow, backward_state.target_end_flow);
+        auto finalized_paths = backwardPass(backward_state, window_.size());
+        window_.clear();
+        updateWindowStatistics();
+        // the end of the layer is never final before the layer is, so it is among these paths
+        end_state_ = layerEndFlowState(forward_state_.layerFlowState(), forward_state_.target_end_flow, finalized_paths);
+        return finalized_paths;
+    }
+
+    /*
+     * @return the state the layer ended in, once it is finished; the next layer continues from it, see
+     * GCodeState::end_state
+     */
+    LayerFlowState endState() const
+    {
+        return end_state_;
+    }
+
+    /*
+     * @return the number of forward passed paths that are not final yet
+     */
+    std::size_t windowSize() const
+    {
+        return window_.size();
+    }
+
+private:
+    /*
+     * The longest a deceleration ramp through the window can last, with some margin for the
+     * discretization steps.
+     */
+    double rampDuration() const
+    {
+        const auto step_duration = forward_state_.maxStep(utils::Direction::Backward).first;
+        const auto flow_deceleration = forward_state_.minFlowAcceleration(utils::Direction::Backward);
+        if (flow_deceleration <= 0.)
+        {
+            return std::numeric_limits<double>::infinity();
+        }
+        return max_flow_ / flow_deceleration + 2. * step_duration;
+    }
+
+    /*
+     * Finds the last path in the window that the backward pass can not change anymore, whatever
+     * paths follow.
+     *
+     * The backward pass leaves a path untouched, and continues from its flow, once it arrives at
+     * that path with at least its flow, and always continues from the flow of an exempt path.
+     * Whatever follows the window, the backward pass arrives at the end of the window with a flow of
+     * at least 0 and from there on increases the flow by at least the flow deceleration of the path
+     * it ramps through per second, except that
+     *  - it stops at the flow of the path it ramps through;
+     *  - it steps on a grid that can lag the ideal ramp by one step, of the largest flow change of
+     *    any feature, at the end of the window, and again when it continues on a path with a higher
+     *    flow than the one it stopped at;
+     *  - it can carry up to a step of duration, of the longest step of any feature, into every
+     *    path, which it spends at the flow it arrives with. A run of paths that are each shorter than the carried duration holds the
+     *    flow, so a path only advances the ramp by the part of its duration beyond one step.
+     * Following these rules from the end of the window gives a lower bound on the flow the
+     * backward pass arrives at every path with.
+     *
+     * @return the index in the window, if any
+     */
+    std::optional<std::size_t> findMergeIndex() const
+    {
+        const auto [step_duration, step_flow] = forward_state_.maxStep(utils::Direction::Backward);
+        auto ramp_flow_bound = -step_flow; // um^3/s, lower bound of the ramp, including the lag
+        auto flow_bound = 0.; // um^3/s, lower bound of the flow of the backward pass
+        std::optional<double> later_flow;
+        for (auto index = window_.size(); index-- > 0;)
+        {
+            const auto& path = window_[index];
+            if (path.isTravel())
+            {
+                continue;
+            }
+            if (flow_bound >= path.flow() || forward_state_.isExempt(path))
+            {
+                return index;
+            }
+            if (later_flow.has_value() && path.flow() > *later_flow)
+            {
+                ramp_flow_bound -= step_flow;
+            }
+            // the backward pass slows paths down, so it spends at least the forward duration on them
+            const auto ramp_duration = std::max(0., path.totalDuration() - step_duration);
+            ramp_flow_bound = std::min(path.flow(), ramp_flow_bound + forward_state_.pathFlowAcceleration(path, utils::Direction::Backward) * ramp_duration);
+            flow_bound = std::max(flow_bound, ramp_flow_bound);
+            later_flow = path.flow();
+        }
+        return std::nullopt;
+    }
+
+    /*
+     * Applies the backward pass to the first `count` paths of the window.
+     */
+    std::vector<GCodePath> backwardPass(GCodeState& state, const std::size_t count) const
+    {
+        std::vector<std::vector<GCodePath>> discretized_paths(count);
+        for (auto index = count; index-- > 0;)
+        {
+            discretized_paths[index] = state.processGcodePath<utils::Direction::Backward>(window_[index]);
+        }
+
+        std::vector<GCodePath> gcode_paths;
+        for (auto& paths : discretized_paths)
+        {
+            std::move(paths.rbegin(), paths.rend(), std::back_inserter(gcode_paths));
+        }
+        return gcode_paths;
+    }
+
+    void updateWindowStatistics()
+    {
+        window_duration_ = 0.;
+        max_flow_ = 0.;
+        for (const auto& path : window_)
+        {
+            if (! path.isTravel())
+            {
+                window_duration_ += path.totalDuration();
+                max_flow_ = std::max(max_flow_, path.flow());
+            }
+        }
+    }
+
+    GCodeState forward_state_;
+    std::deque<GCodePath> window_;
+    // s, extrusion time the next attempt to emit paths waits for: that of the whole window after paths
+    // were emitted, and only that pushed since then after an attempt found no path to emit
+    double window_duration_{ 0.0 };
+    double max_flow_{ 0.0 }; // um^3/s, highest flow in the window
+    LayerFlowState end_state_{}; // set by finish
+};
+
+} // namespace plugin::gradual_flow
+
+#endif // CURAENGINE_PLUGIN_GRADUAL_FLOW_STREAMING_GCODE_STATE_H
@@ -0,0 +1,140 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher
+
+#ifndef CURAENGINE_PLUGIN_GRADUAL_FLOW_WORKER_POOL_H
+#define CURAENGINE_PLUGIN_GRADUAL_FLOW_WORKER_POOL_H
+
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace plugin::gradual_flow
+{
+
+/*
+ * A fixed size pool of worker threads used to process independent parts of a layer concurrently.
+ */
+class WorkerPool
+{
+public:
+    /*
+     * @param thread_count number of worker threads, 0 uses the number of hardware threads
+     */
+    explicit WorkerPool(std::size_t thread_count = 0)
+        : thread_count_{ thread_count == 0 ? std::max<std::size_t>(1, std::thread::hardware_concurrency()) : thread_count }
+        , pool_{ thread_count_ }
+    {
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    ~WorkerPool()
+    {
+        pool_.join();
+    }
+
+    std::size_t threadCount() const
+    {
+        return thread_count_;
+    }
+
+    /*
+     * Calls `fn(index)` for every index in [0, count) and returns once all calls are done.
+     *
+     * Indices are handed out one at a time from a shared counter, so idle workers keep picking up
+     * the next pending item instead of waiting on a fixed partition. The calling thread takes part
+     * in the work as well; this way nested calls from a worker thread can never deadlock on a
+     * saturated pool. The first exception thrown by `fn` is rethrown in the calling thread.
+     */
+    template<class Fn>
+    void parallelFor(const std::size_t count, Fn&& fn)
+    {
+        if (count == 0)
+        {
+            return;
+        }
+        if (count == 1)
+        {
+            fn(std::size_t{ 0 });
+            return;
+        }
+
+        struct Work
+        {
+            std::atomic<std::size_t> next{ 0 };
+            std::size_t count{ 0 };
+            std::size_t done{ 0 };
+            std::exception_ptr exception;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+
+        auto work = std::make_shared<Work>();
+        work->count = count;
+        auto* fn_ptr = &fn;
+
+        // Only dereference `fn_ptr` for claimed indices; those keep the caller waiting, so a helper that
+        // starts after all work is done never touches the (by then destroyed) callable.
+        const auto drain = [work, fn_ptr]()
+        {
+            for (auto index = work->next.fetch_add(1); index < work->count; index = work->next.fetch_add(1))
+            {
+                std::exception_ptr exception;
+                try
+                {
+                    (*fn_ptr)(index);
+                }
+                catch (...)
+                {
+                    exception = std::current_exception();
+                }
+
+                std::lock_guard lock{ work->mutex };
+                if (exception && ! work->exception)
+                {
+                    work->exception = exception;
+                }
+                if (++work->done == work->count)
+                {
+                    work->finished.notify_all();
+                }
+            }
+        };
+
+        const auto helper_count = std::min(thread_count_, count - 1);
+        for (std::size_t i = 0; i < helper_count; ++i)
+        {
+            boost::asio::post(pool_, drain);
+        }
+        drain();
+
+        std::unique_lock lock{ work->mutex };
+        work->finished.wait(
+            lock,
+            [&work]()
+            {
+                return work->done == work->count;
+            });
+        if (work->exception)
+        {
+            std::rethrow_exception(work->exception);
+        }
+    }
+
+private:
+    std::size_t thread_count_;
+    boost::asio::thread_pool pool_;
+};
+
+} // namespace plugin::gradual_flow
+
+#endif // CURAENGINE_PLUGIN_GRADUAL_FLOW_WORKER_POOL_H
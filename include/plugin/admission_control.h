@@ -0,0 +1,90 @@
+#ifndef PLUGIN_ADMISSION_CONTROL_H
+#define PLUGIN_ADMISSION_CONTROL_H
+
+#include <chrono>
+#include <cstddef>
+#include <mutex>
+
+namespace plugin
+{
+
+/*
+ * Decides whether a layer can be processed before the deadline the engine set for the call, based
+ * on the number of paths in the layer and the recent processing time per path.
+ *
+ * A layer that can no longer be processed in time is answered with its original paths, so a spike
+ * in load slows down gradual flow instead of the slice. Only the layers that are processed are
+ * admitted and recorded; a layer answered from the response cache takes next to no time, and would
+ * make the next processed layer look cheaper than it is.
+ *
+ * The calls waiting for the plugin are not bounded: a process serves one call at a time and the other
+ * calls wait in gRPC, out of sight of the plugin, until it asks for the next call. The time they wait
+ * there counts against their deadline, which is checked once their turn comes.
+ */
+class AdmissionControl
+{
+public:
+    using clock_t = std::chrono::system_clock; // the clock of grpc::ServerContext::deadline()
+
+    /*
+     * The processing time per path assumed until a layer was processed, in ns. It is on the slow side
+     * of an uncached layer, so the first calls under a tight deadline are degraded rather than late.
+     */
+    static constexpr double initial_path_cost{ 20000.0 };
+
+    /*
+     * @param path_count the number of paths in the layer
+     * @return the expected time to process the layer
+     */
+    std::chrono::nanoseconds estimate(const std::size_t path_count) const
+    {
+        std::lock_guard lock{ mutex_ };
+        return std::chrono::nanoseconds{ static_cast<std::chrono::nanoseconds::rep>(path_cost_ * static_cast<double>(path_count) * headroom) };
+    }
+
+    /*
+     * @param path_count the number of paths in the layer
+     * @param deadline the deadline of the call, clock_t::time_point::max() when the call has none
+     * @param now the current time
+     * @return whether the layer is expected to be processed before the deadline
+     */
+    bool admit(const std::size_t path_count, const clock_t::time_point deadline, const clock_t::time_point now = clock_t::now()) const
+    {
+        if (deadline == clock_t::time_point::max())
+        {
+            return true;
+        }
+        return now < deadline && estimate(path_count) < deadline - now;
+    }
+
+    /*
+     * Updates the processing time per path with a processed layer; recent layers weigh most. The first
+     * layer replaces the initial cost.
+     *
+     * @param path_count the number of paths in the layer
+     * @param duration the time it took to process the layer
+     */
+    void record(const std::size_t path_count, const std::chrono::nanoseconds duration)
+    {
+        if (path_count == 0)
+        {
+            return;
+        }
+        const auto path_cost = static_cast<double>(duration.count()) / static_cast<double>(path_count);
+        std::lock_guard lock{ mutex_ };
+        path_cost_ = recorded_ ? path_cost_ + smoothing * (path_cost - path_cost_) : path_cost;
+        recorded_ = true;
+    }
+
+private:
+    static constexpr double smoothing{ 0.2 }; // weight of the latest layer in the processing time per path
+    static constexpr double headroom{ 1.25 }; // leaves time to send the response back before the deadline
+
+    mutable std::mutex mutex_;
+    double path_cost_{ initial_path_cost }; // ns
+    bool recorded_{ false };
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_ADMISSION_CONTROL_H
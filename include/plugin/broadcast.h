@@ -3,7 +3,11 @@
 
 #include "cura/plugins/slots/broadcast/v0/broadcast.grpc.pb.h"
 #include "cura/plugins/v0/slot_id.pb.h"
+#include "plugin/completion_tokens.h"
+#include "plugin/layer_flow_states.h"
 #include "plugin/metadata.h"
+#include "plugin/metrics.h"
+#include "plugin/sessions.h"
 #include "plugin/settings.h"
 
 #include <agrpc/asio_grpc.hpp>
@@ -18,7 +22,6 @@
 #endif
 #include <functional>
 #include <memory>
-#include <unordered_map>
 
 namespace plugin
 {
@@ -26,11 +29,13 @@ namespace plugin
 struct Broadcast
 {
     using service_t = std::shared_ptr<cura::plugins::slots::broadcast::v0::BroadcastService::AsyncService>;
-    using settings_t = std::unordered_map<std::string, Settings>;
+    using settings_t = Sessions;
     using shared_settings_t = std::shared_ptr<settings_t>;
     service_t broadcast_service{ std::make_shared<cura::plugins::slots::broadcast::v0::BroadcastService::AsyncService>() };
     shared_settings_t settings{ std::make_shared<settings_t>() };
     std::shared_ptr<Metadata> metadata{ std::make_shared<Metadata>() };
+    std::shared_ptr<Metrics> metrics{ std::make_shared<Metrics>() };
+    std::shared_ptr<LayerFlowStates> layer_flow_states{ std::make_shared<LayerFlowStates>() };
 
     boost::asio::awaitable<void> run()
     {
@@ -45,13 +50,17 @@ struct Broadcast
                 server_context,
                 request,
                 writer,
-                boost::asio::use_awaitable);
+                recycling_awaitable);
             spdlog::info("Received broadcast settings request");
+            metrics->report();
 
             grpc::Status status = grpc::Status::OK;
             try
             {
-                settings->insert_or_assign(getUuid(server_context), Settings{ request, metadata });
+                const auto uuid = getUuid(server_context);
+                settings->insert_or_assign(uuid, Settings{ request, metadata });
+                // new settings start a new slice, the flow of previously processed layers no longer applies
+                layer_flow_states->erase(uuid);
             }
             catch (const std::exception& e)
             {
@@ -60,12 +69,12 @@ struct Broadcast
             }
             if (! status.ok())
             {
-                co_await agrpc::finish_with_error(writer, status, boost::asio::use_awaitable);
+                co_await agrpc::finish_with_error(writer, status, recycling_awaitable);
                 continue;
             }
 
             const google::protobuf::Empty response{};
-            co_await agrpc::finish(writer, response, grpc::Status::OK, boost::asio::use_awaitable);
+            co_await agrpc::finish(writer, response, grpc::Status::OK, recycling_awaitable);
         }
     }
 };
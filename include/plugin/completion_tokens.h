@@ -0,0 +1,23 @@
+#ifndef PLUGIN_COMPLETION_TOKENS_H
+#define PLUGIN_COMPLETION_TOKENS_H
+
+#include <boost/asio/bind_allocator.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/recycling_allocator.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+namespace plugin
+{
+
+/*
+ * Completion tokens for the asynchronous operations of the services. Each operation allocates its
+ * state through the allocator associated with its completion handler; the recycling allocator keeps
+ * the memory of finished operations in a per-thread cache, so the next call reuses it instead of
+ * allocating from the heap. The coroutine frames themselves are recycled by asio already.
+ */
+inline const auto recycling_awaitable = boost::asio::bind_allocator(boost::asio::recycling_allocator<void>{}, boost::asio::use_awaitable);
+inline const auto recycling_detached = boost::asio::bind_allocator(boost::asio::recycling_allocator<void>{}, boost::asio::detached);
+
+} // namespace plugin
+
+#endif // PLUGIN_COMPLETION_TOKENS_H
@@ -0,0 +1,378 @@
+#ifndef PLUGIN_FLOW_TIMELINE_H
+#define PLUGIN_FLOW_TIMELINE_H
+
+#include "gradual_flow/gcode_path.h"
+#include "plugin/mapped_file.h"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#if ! defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+namespace plugin
+{
+
+/*
+ * The flow over time of processed layers, in a binary columnar file.
+ *
+ * The file is a sequence of blocks, one per layer and extruder, that are appended as the layers are
+ * processed. A block starts with a FlowTimelineHeader, followed by a column of every row of the
+ * layer: the start time (double, s), the flow (float, mm³/s), the speed (float, mm/s), the index of
+ * the path of the request (uint32) and the flow state (uint8). A row is a path the plugin returned.
+ * The block is padded to a multiple of 8 bytes, so every column of a mapped file is aligned.
+ */
+struct FlowTimelineHeader
+{
+    static constexpr std::uint32_t file_magic = 0x314c5446; // "FTL1"
+
+    std::uint32_t magic{ file_magic };
+    std::uint32_t row_count{ 0 };
+    std::int64_t layer_nr{ 0 };
+    std::int64_t extruder_nr{ 0 };
+    double duration{ 0.0 }; // s, of all rows of the layer
+};
+
+static_assert(sizeof(FlowTimelineHeader) == 32);
+
+/*
+ * Returns the size of a block with the header and the columns of `row_count` rows.
+ */
+constexpr std::size_t flowTimelineBlockSize(const std::size_t row_count)
+{
+    const auto size = sizeof(FlowTimelineHeader) + row_count * (sizeof(double) + 2 * sizeof(float) + sizeof(std::uint32_t) + sizeof(std::uint8_t));
+    return (size + 7) / 8 * 8;
+}
+
+/*
+ * The rows of a layer, gathered in columns as its paths are returned.
+ */
+struct FlowTimelineRows
+{
+    std::vector<double> time; // s, at the start of the row
+    std::vector<float> flow; // mm³/s
+    std::vector<float> speed; // mm/s
+    std::vector<std::uint32_t> path_index;
+    std::vector<std::uint8_t> flow_state; // gradual_flow::FlowState
+    double duration{ 0.0 }; // s, of all rows
+
+    /*
+     * Adds a returned path as a row.
+     *
+     * A row is stable when the path has its target flow, in transition while the flow is limited and
+     * undefined for travels, which have no flow.
+     *
+     * @param path the path with the gradual flow applied
+     * @param index the index of the path of the request the path belongs to
+     */
+    void add(const gradual_flow::GCodePath& path, const std::uint32_t index)
+    {
+        auto state = gradual_flow::FlowState::STABLE;
+        if (path.isTravel())
+        {
+            state = gradual_flow::FlowState::UNDEFINED;
+        }
+        else if (path.flow() < path.targetFlow() * (1. - 1e-9))
+        {
+            state = gradual_flow::FlowState::TRANSITION;
+        }
+
+        time.emplace_back(duration);
+        flow.emplace_back(static_cast<float>(path.isTravel() ? 0.0 : path.flow() * 1e-9));
+        speed.emplace_back(static_cast<float>(path.speed * 1e-3));
+        path_index.emplace_back(index);
+        flow_state.emplace_back(static_cast<std::uint8_t>(state));
+        duration += path.totalDuration();
+    }
+
+    /*
+     * Adds the returned paths of a layer as rows.
+     *
+     * @param input_paths the paths of the request, to find the index of the path a row belongs to
+     * @param output_paths the paths of the layer with the gradual flow applied
+     */
+    void add(const std::vector<gradual_flow::GCodePath>& input_paths, const std::vector<gradual_flow::GCodePath>& output_paths)
+    {
+        std::uint32_t index = 0;
+        for (const auto& path : output_paths)
+        {
+            // the pieces of a path follow each other, in the order of the paths of the request
+            while (index + 1 < input_paths.size() && input_paths[index].original_gcode_path_data != path.original_gcode_path_data)
+            {
+                index++;
+            }
+            add(path, index);
+        }
+    }
+
+    void clear()
+    {
+        time.clear();
+        flow.clear();
+        speed.clear();
+        path_index.clear();
+        flow_state.clear();
+        duration = 0.0;
+    }
+
+    std::size_t size() const
+    {
+        return time.size();
+    }
+
+    /*
+     * @return the memory the rows take, in bytes
+     */
+    std::size_t bytes() const
+    {
+        return time.capacity() * sizeof(double) + flow.capacity() * sizeof(float) + speed.capacity() * sizeof(float) + path_index.capacity() * sizeof(std::uint32_t)
+             + flow_state.capacity() * sizeof(std::uint8_t);
+    }
+};
+
+/*
+ * Appends the flow over time of processed layers to a timeline file.
+ *
+ * Every layer is appended with a single write to a file opened for appending, so the blocks of
+ * layers of different threads, and of different worker processes sharing the file, never
+ * interleave. A layer is in the file as soon as it is recorded.
+ */
+class FlowTimeline
+{
+public:
+    /*
+     * @param path the file to append the layers to, an empty path disables the timeline
+     */
+    explicit FlowTimeline(const std::filesystem::path& path = {})
+    {
+        if (path.empty())
+        {
+            return;
+        }
+#if ! defined(_WIN32)
+        fd_ = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd_ < 0)
+        {
+            throw std::runtime_error(fmt::format("Failed to open {}", path.string()));
+        }
+#else
+        throw std::runtime_error("The flow timeline is not supported on this platform");
+#endif
+    }
+
+    FlowTimeline(const FlowTimeline&) = delete;
+    FlowTimeline& operator=(const FlowTimeline&) = delete;
+
+    ~FlowTimeline()
+    {
+#if ! defined(_WIN32)
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    bool enabled() const
+    {
+        return fd_ >= 0;
+    }
+
+    /*
+     * Appends the rows of a processed layer.
+     *
+     * @param layer_nr the number of the layer
+     * @param extruder_nr the extruder that prints the paths
+     * @param input_paths the paths of the request, to find the index of the path a row belongs to
+     * @param output_paths the paths of the layer with the gradual flow applied
+     */
+    void record(const std::int64_t layer_nr, const std::int64_t extruder_nr, const std::vector<gradual_flow::GCodePath>& input_paths, const std::vector<gradual_flow::GCodePath>& output_paths)
+    {
+        if (! enabled())
+        {
+            return;
+        }
+
+        thread_local FlowTimelineRows rows;
+        rows.clear();
+        rows.add(input_paths, output_paths);
+        record(layer_nr, extruder_nr, rows);
+    }
+
+    /*
+     * Appends the rows of a processed layer.
+     *
+     * @param layer_nr the number of the layer
+     * @param extruder_nr the extruder that prints the paths
+     * @param rows the rows of the layer
+     */
+    void record(const std::int64_t layer_nr, const std::int64_t extruder_nr, const FlowTimelineRows& rows)
+    {
+        if (! enabled())
+        {
+            return;
+        }
+
+        const FlowTimelineHeader header{
+            .row_count = static_cast<std::uint32_t>(rows.size()),
+            .layer_nr = layer_nr,
+            .extruder_nr = extruder_nr,
+            .duration = rows.duration,
+        };
+        // the block is assembled first, it has to go to the file in a single write
+        thread_local std::vector<char> block;
+        block.assign(flowTimelineBlockSize(header.row_count), 0);
+        auto* cursor = block.data();
+        append(cursor, std::span{ &header, 1 });
+        append(cursor, std::span{ rows.time });
+        append(cursor, std::span{ rows.flow });
+        append(cursor, std::span{ rows.speed });
+        append(cursor, std::span{ rows.path_index });
+        append(cursor, std::span{ rows.flow_state });
+
+#if ! defined(_WIN32)
+        const auto written = ::write(fd_, block.data(), block.size());
+        if (written != static_cast<::ssize_t>(block.size()))
+        {
+            // the timeline is only diagnostic, the layer itself is fine
+            spdlog::warn("Failed to write layer {} to the flow timeline", layer_nr);
+        }
+#endif
+    }
+
+private:
+    template<class T>
+    static void append(char*& cursor, const std::span<T> values)
+    {
+        std::memcpy(cursor, values.data(), values.size_bytes());
+        cursor += values.size_bytes();
+    }
+
+    int fd_{ -1 };
+};
+
+/*
+ * The rows of a layer in a timeline file, referring to the mapped file.
+ */
+struct FlowTimelineLayer
+{
+    std::int64_t layer_nr{ 0 };
+    std::int64_t extruder_nr{ 0 };
+    double duration{ 0.0 }; // s
+    std::span<const double> time; // s, at the start of the row
+    std::span<const float> flow; // mm³/s
+    std::span<const float> speed; // mm/s
+    std::span<const std::uint32_t> path_index;
+    std::span<const std::uint8_t> flow_state; // gradual_flow::FlowState
+};
+
+/*
+ * Reads a timeline file by mapping it into memory; the columns are not copied.
+ */
+class FlowTimelineReader
+{
+public:
+    explicit FlowTimelineReader(const std::filesystem::path& path)
+        : file_{ path }
+    {
+        const auto contents = file_.contents();
+        std::size_t offset = 0;
+        while (offset + sizeof(FlowTimelineHeader) <= contents.size())
+        {
+            FlowTimelineHeader header;
+            std::memcpy(&header, contents.data() + offset, sizeof(header));
+            if (header.magic != FlowTimelineHeader::file_magic)
+            {
+                throw std::runtime_error(fmt::format("{} is not a flow timeline, or is corrupt at byte {}", path.string(), offset));
+            }
+            const auto block_size = flowTimelineBlockSize(header.row_count);
+            if (offset + block_size > contents.size())
+            {
+                // the plugin stopped while writing the last layer
+                break;
+            }
+
+            const auto* column = contents.data() + offset + sizeof(header);
+            layers_.emplace_back(FlowTimelineLayer{
+                .layer_nr = header.layer_nr,
+                .extruder_nr = header.extruder_nr,
+                .duration = header.duration,
+                .time = nextColumn<double>(column, header.row_count),
+                .flow = nextColumn<float>(column, header.row_count),
+                .speed = nextColumn<float>(column, header.row_count),
+                .path_index = nextColumn<std::uint32_t>(column, header.row_count),
+                .flow_state = nextColumn<std::uint8_t>(column, header.row_count),
+            });
+            offset += block_size;
+        }
+        if (offset != contents.size())
+        {
+            spdlog::warn("Ignoring the incomplete last layer of {}", path.string());
+        }
+    }
+
+    const std::vector<FlowTimelineLayer>& layers() const
+    {
+        return layers_;
+    }
+
+private:
+    template<class T>
+    static std::span<const T> nextColumn(const char*& column, const std::size_t row_count)
+    {
+        const std::span<const T> values{ reinterpret_cast<const T*>(column), row_count };
+        column += values.size_bytes();
+        return values;
+    }
+
+    MappedFile file_;
+    std::vector<FlowTimelineLayer> layers_;
+};
+
+/*
+ * The figures of a layer that matter for tuning the flow acceleration.
+ */
+struct FlowTimelineSummary
+{
+    std::int64_t layer_nr{ 0 };
+    std::int64_t extruder_nr{ 0 };
+    double duration{ 0.0 }; // s
+    double peak_flow{ 0.0 }; // mm³/s
+    std::size_t ramp_count{ 0 }; // runs of consecutive rows in transition
+    double transition_duration{ 0.0 }; // s
+};
+
+inline FlowTimelineSummary summarize(const FlowTimelineLayer& layer)
+{
+    FlowTimelineSummary summary{ .layer_nr = layer.layer_nr, .extruder_nr = layer.extruder_nr, .duration = layer.duration };
+    auto in_transition = false;
+    for (std::size_t row = 0; row < layer.time.size(); ++row)
+    {
+        summary.peak_flow = std::max(summary.peak_flow, static_cast<double>(layer.flow[row]));
+        const auto transition = layer.flow_state[row] == static_cast<std::uint8_t>(gradual_flow::FlowState::TRANSITION);
+        if (transition)
+        {
+            const auto end_time = row + 1 < layer.time.size() ? layer.time[row + 1] : layer.duration;
+            summary.transition_duration += end_time - layer.time[row];
+            summary.ramp_count += in_transition ? 0 : 1;
+        }
+        in_transition = transition;
+    }
+    return summary;
+}
+
+} // namespace plugin
+
+#endif // PLUGIN_FLOW_TIMELINE_H
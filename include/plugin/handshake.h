@@ -3,6 +3,7 @@
 
 #include "cura/plugins/slots/handshake/v0/handshake.grpc.pb.h"
 #include "cura/plugins/v0/slot_id.pb.h"
+#include "plugin/completion_tokens.h"
 #include "plugin/metadata.h"
 #include "plugin/settings.h"
 
@@ -44,7 +45,7 @@ struct Handshake
                 server_context,
                 request,
                 writer,
-                boost::asio::use_awaitable);
+                recycling_awaitable);
 
             spdlog::info("Received handshake request");
             spdlog::info(
@@ -58,7 +59,7 @@ struct Handshake
             if (! exists)
             {
                 grpc::Status status = grpc::Status(grpc::StatusCode::INTERNAL, "Plugin could not be validated, handshake failed!");
-                co_await agrpc::finish_with_error(writer, status, boost::asio::use_awaitable);
+                co_await agrpc::finish_with_error(writer, status, recycling_awaitable);
                 continue;
             }
 
@@ -71,7 +72,7 @@ struct Handshake
                 response.mutable_broadcast_subscriptions()->Add(slot_id);
             }
 
-            co_await agrpc::finish(writer, response, grpc::Status::OK, boost::asio::use_awaitable);
+            co_await agrpc::finish(writer, response, grpc::Status::OK, recycling_awaitable);
         }
     }
 };
@@ -0,0 +1,71 @@
+#ifndef PLUGIN_LAYER_FLOW_STATES_H
+#define PLUGIN_LAYER_FLOW_STATES_H
+
+#include "gradual_flow/gcode_path.h"
+
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+
+namespace plugin
+{
+
+/*
+ * Keeps the flow state at the end of the last processed layer per engine session and extruder, so the
+ * next layer can continue from the actual flow instead of a guess.
+ */
+class LayerFlowStates
+{
+public:
+    /*
+     * Returns the flow state to start a layer with, if the directly preceding layer of the same
+     * extruder was processed. Layers can be requested out of order; any other stored layer is ignored.
+     */
+    std::optional<gradual_flow::LayerFlowState> find(const std::string& session, const std::int64_t extruder_nr, const std::int64_t layer_nr) const
+    {
+        std::lock_guard lock{ mutex_ };
+        const auto it = states_.find({ session, extruder_nr });
+        if (it == states_.end() || it->second.layer_nr != layer_nr - 1)
+        {
+            return std::nullopt;
+        }
+        return it->second.flow_state;
+    }
+
+    void store(const std::string& session, const std::int64_t extruder_nr, const std::int64_t layer_nr, const gradual_flow::LayerFlowState& flow_state)
+    {
+        std::lock_guard lock{ mutex_ };
+        auto [it, inserted] = states_.try_emplace({ session, extruder_nr }, Entry{ .layer_nr = layer_nr, .flow_state = flow_state });
+        // never replace the state of a later layer with that of an earlier one
+        if (! inserted && it->second.layer_nr <= layer_nr)
+        {
+            it->second = Entry{ .layer_nr = layer_nr, .flow_state = flow_state };
+        }
+    }
+
+    void erase(const std::string& session)
+    {
+        std::lock_guard lock{ mutex_ };
+        const auto begin = states_.lower_bound({ session, std::numeric_limits<std::int64_t>::min() });
+        const auto end = states_.upper_bound({ session, std::numeric_limits<std::int64_t>::max() });
+        states_.erase(begin, end);
+    }
+
+private:
+    struct Entry
+    {
+        std::int64_t layer_nr{ 0 };
+        gradual_flow::LayerFlowState flow_state;
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::pair<std::string, std::int64_t>, Entry> states_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_LAYER_FLOW_STATES_H
@@ -0,0 +1,88 @@
+#ifndef PLUGIN_MAPPED_FILE_H
+#define PLUGIN_MAPPED_FILE_H
+
+#include <fmt/format.h>
+
+#if ! defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <filesystem>
+#include <stdexcept>
+#include <string_view>
+
+namespace plugin
+{
+
+/*
+ * A file mapped read-only into memory.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::filesystem::path& path)
+    {
+#if ! defined(_WIN32)
+        const auto fd = ::open(path.c_str(), O_RDONLY);
+        struct stat status
+        {
+        };
+        if (fd < 0 || ::fstat(fd, &status) != 0)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            throw std::runtime_error(fmt::format("Failed to open {}", path.string()));
+        }
+        size_ = static_cast<std::size_t>(status.st_size);
+        if (size_ > 0)
+        {
+            data_ = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        ::close(fd);
+        if (data_ == MAP_FAILED)
+        {
+            data_ = nullptr;
+            throw std::runtime_error(fmt::format("Failed to map {}", path.string()));
+        }
+        if (data_ != nullptr)
+        {
+            // the files are read from the start to the end, a part at a time
+            ::madvise(data_, size_, MADV_SEQUENTIAL);
+        }
+#else
+        throw std::runtime_error("Memory mapped files are not supported on this platform");
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#if ! defined(_WIN32)
+        if (data_ != nullptr)
+        {
+            ::munmap(data_, size_);
+        }
+#endif
+    }
+
+    std::string_view contents() const
+    {
+        return { static_cast<const char*>(data_), size_ };
+    }
+
+private:
+    void* data_{ nullptr };
+    std::size_t size_{ 0 }; // bytes
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_MAPPED_FILE_H
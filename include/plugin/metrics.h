@@ -0,0 +1,58 @@
+#ifndef PLUGIN_METRICS_H
+#define PLUGIN_METRICS_H
+
+#include <spdlog/spdlog.h>
+
+#include <atomic>
+#include <cstdint>
+
+namespace plugin
+{
+
+struct Metrics
+{
+    std::atomic<std::uint64_t> cache_hits{ 0 };
+    std::atomic<std::uint64_t> cache_misses{ 0 };
+    std::atomic<std::uint64_t> cache_evictions{ 0 };
+    std::atomic<std::uint64_t> cache_bytes{ 0 };
+    std::atomic<std::uint64_t> planned_layers{ 0 };
+    std::atomic<std::uint64_t> compared_planned_layers{ 0 }; // also processed with stepped ramps, see Generate::compare_planner
+    std::atomic<std::int64_t> planner_time_saved{ 0 }; // us, of the compared layers, compared to stepped ramps
+    std::atomic<std::uint64_t> degraded_layers{ 0 }; // returned unmodified to meet the deadline
+    std::atomic<std::uint64_t> unknown_session_layers{ 0 }; // returned unmodified, the settings of the session are not known to this process
+    std::atomic<std::uint64_t> active_sessions{ 0 };
+    std::atomic<std::uint64_t> session_bytes{ 0 };
+    std::atomic<std::uint64_t> evicted_sessions{ 0 };
+    std::atomic<std::int64_t> original_extrusion_time{ 0 }; // us, of the processed layers at their target speeds
+    std::atomic<std::int64_t> added_extrusion_time{ 0 }; // us, by the gradual flow
+    std::atomic<std::uint64_t> split_paths{ 0 }; // paths added by splitting paths into ramp pieces
+    std::atomic<std::uint64_t> written_svg_layers{ 0 };
+    std::atomic<std::uint64_t> dropped_svg_layers{ 0 }; // the queue of the SVG dump was full
+
+    void report() const
+    {
+        spdlog::info(
+            "Metrics: response cache <hits: {}, misses: {}, evictions: {}, bytes: {}>, ramp planner <layers: {}, time saved: {:.3f} s in {} compared layers>, degraded layers: {}, unknown session layers: {}, sessions <active: {}, bytes: {}, evicted: {}>, print time <extrusion: {:.3f} s, added: {:.3f} s, split paths: {}>, svg dump <written: {}, dropped: {}>",
+            cache_hits.load(),
+            cache_misses.load(),
+            cache_evictions.load(),
+            cache_bytes.load(),
+            planned_layers.load(),
+            static_cast<double>(planner_time_saved.load()) * 1e-6,
+            compared_planned_layers.load(),
+            degraded_layers.load(),
+            unknown_session_layers.load(),
+            active_sessions.load(),
+            session_bytes.load(),
+            evicted_sessions.load(),
+            static_cast<double>(original_extrusion_time.load()) * 1e-6,
+            static_cast<double>(added_extrusion_time.load()) * 1e-6,
+            split_paths.load(),
+            written_svg_layers.load(),
+            dropped_svg_layers.load());
+    }
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_METRICS_H
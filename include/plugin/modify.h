@@ -1,10 +1,22 @@
 #ifndef PLUGIN_MODIFY_H
 #define PLUGIN_MODIFY_H
 
+#include "gradual_flow/chunked_processing.h"
+#include "gradual_flow/flow_ramp_planner.h"
 #include "gradual_flow/gcode_path.h"
+#include "gradual_flow/worker_pool.h"
+#include "plugin/admission_control.h"
 #include "plugin/broadcast.h"
+#include "plugin/completion_tokens.h"
+#include "plugin/flow_timeline.h"
+#include "plugin/layer_flow_states.h"
 #include "plugin/metadata.h"
+#include "plugin/metrics.h"
+#include "plugin/print_time_impact.h"
+#include "plugin/response_cache.h"
 #include "plugin/settings.h"
+#include "plugin/shared_memory.h"
+#include "plugin/svg_dump.h"
 
 #include <boost/asio/awaitable.hpp>
 #include <range/v3/view/drop.hpp>
@@ -16,14 +28,17 @@
 #include <experimental/coroutine>
 #define USE_EXPERIMENTAL_COROUTINE
 #endif
+#include <array>
+#include <chrono>
 #include <filesystem>
 #include <fstream>
+#include <initializer_list>
 #include <memory>
+#include <optional>
+#include <string>
 
 namespace plugin::gradual_flow
 {
-static int svg_counter = 0;
-
 template<class T, class Rsp, class Req>
 struct Generate
 {
@@ -31,6 +46,16 @@ struct Generate
     service_t generate_service{ std::make_shared<T>() };
     Broadcast::shared_settings_t settings{ std::make_shared<Broadcast::settings_t>() };
     std::shared_ptr<Metadata> metadata{ std::make_shared<Metadata>() };
+    std::shared_ptr<WorkerPool> worker_pool{ std::make_shared<WorkerPool>() };
+    std::shared_ptr<ResponseCache<Rsp>> response_cache{ std::make_shared<ResponseCache<Rsp>>() };
+    std::shared_ptr<LayerFlowStates> layer_flow_states{ std::make_shared<LayerFlowStates>() };
+    std::shared_ptr<Metrics> metrics{ std::make_shared<Metrics>() };
+    std::shared_ptr<shared_memory::Channel> shared_memory_channel{ std::make_shared<shared_memory::Channel>() };
+    std::shared_ptr<AdmissionControl> admission_control{ std::make_shared<AdmissionControl>() };
+    std::shared_ptr<SvgDump> svg_dump{ std::make_shared<SvgDump>() };
+    std::shared_ptr<FlowTimeline> flow_timeline{ std::make_shared<FlowTimeline>() };
+    std::shared_ptr<PrintTimeImpacts> print_time_impacts{ std::make_shared<PrintTimeImpacts>() };
+    bool compare_planner{ false }; // also apply the stepped ramps to planned layers, to report the time the planner saves
 
     boost::asio::awaitable<void> run()
     {
@@ -40,90 +65,26 @@ struct Generate
 
             cura::plugins::slots::gcode_paths::v0::modify::CallRequest request;
             grpc::ServerAsyncResponseWriter<Rsp> writer{ &server_context };
-            co_await agrpc::request(&T::RequestCall, *generate_service, server_context, request, writer, boost::asio::use_awaitable);
+            co_await agrpc::request(&T::RequestCall, *generate_service, server_context, request, writer, recycling_awaitable);
 
             Rsp response;
             auto client_metadata = getUuid(server_context);
-            const auto& extruder_nr = request.extruder_nr();
 
             grpc::Status status = grpc::Status::OK;
             try
             {
-                auto extruder_settings = settings.get()->at(client_metadata);
-
-                if (! extruder_settings.gradual_flow_enabled[extruder_nr])
+                // the engine can pass the points of the layer through shared memory, see plugin/shared_memory.h
+                const auto shared_memory_block = shared_memory::Channel::requestBlock(server_context);
+                if (shared_memory_block.has_value())
                 {
-                    // If gradual flow is disabled, just return the original gcode paths
-                    response.mutable_gcode_paths()->CopyFrom(request.gcode_paths());
+                    shared_memory_channel->read(client_metadata, shared_memory_block.value(), *request.mutable_gcode_paths());
                 }
-                else
-                {
 
-                    // Parse the gcode paths from the request
-                    std::vector<GCodePath> gcode_paths;
-
-                    // Process first path
-                    for (const auto& path : request.gcode_paths() | ranges::views::take(1))
-                    {
-                        geometry::polyline<> points;
-                        for (const auto& point : path.path().path())
-                        {
-                            points.emplace_back(ClipperLib::IntPoint{ point.x(), point.y() });
-                        }
-                        gcode_paths.emplace_back(GCodePath{ .original_gcode_path_data = &path, .points = points });
-                    }
-
-                    /* Process remaining paths
-                     * We need to add the last point of the previous path to the current path
-                     * since the paths in Cura are a connected line string and a new path begins
-                     * where the previous path ends (see figure below).
-                     *    {                Path A            } {          Path B        } { ...etc
-                     *    a.1-----------a.2------a.3---------a.4------b.1--------b.2--- c.1-------
-                     * For our purposes it is easier that each path is a separate line string, and
-                     * no knowledge of the previous path is needed.
-                     */
-                    for (const auto& path : request.gcode_paths() | ranges::views::drop(1))
-                    {
-                        geometry::polyline<> points { ranges::back(ranges::back(gcode_paths).points) };
-                        for (const auto& point : path.path().path())
-                        {
-                            points.emplace_back(ClipperLib::IntPoint{ point.x(), point.y() });
-                        }
-                        gcode_paths.emplace_back(GCodePath{.original_gcode_path_data = &path, .points = points});
-                    }
-
-                    constexpr auto non_zero_flow_view = ranges::views::transform([](const auto& path){ return path.flow(); }) | ranges::views::drop_while([](const auto flow){ return flow == 0.0; });
-                    auto gcode_paths_non_zero_flow_view = gcode_paths | non_zero_flow_view;
-
-                    const auto flow_limit
-                        = request.layer_nr() == 0 ? extruder_settings.layer_0_max_flow_acceleration[extruder_nr] : extruder_settings.max_flow_acceleration[extruder_nr];
-
-                    auto target_flow = ranges::empty(gcode_paths_non_zero_flow_view) ? 0.0 : ranges::front(gcode_paths_non_zero_flow_view);
-
-                    GCodeState state{
-                        .current_flow = target_flow,
-                        .flow_acceleration = flow_limit,
-                        .flow_deceleration = flow_limit,
-                        .discretized_duration = extruder_settings.gradual_flow_discretisation_step_size[extruder_nr],
-                        // take the first path's target flow as the target flow, this might
-                        // not be correct, but it is safe to assume the target flow for the
-                        // next layer is the same as the target flow of the current layer
-                        .target_end_flow = target_flow,
-                        .reset_flow_duration = extruder_settings.reset_flow_duration,
-                    };
-
-                    const auto limited_flow_acceleration_paths = state.processGcodePaths(gcode_paths);
-                    // Copy newly generated paths to response
-
-                    for (const auto& [index, gcode_path] : limited_flow_acceleration_paths | ranges::views::enumerate)
-                    {
-                        // since the first point is added from the previous path in the request-parsing,
-                        // we should remove it here again. Note that the first point is added for every path
-                        // except the first one, so we should only remove it if it is not the first path
-                        const auto include_first_point = index == 0;
-                        auto gcode_path_message = gcode_path.toGrpcMessage(include_first_point);
-                        response.add_gcode_paths()->CopyFrom(gcode_path_message);
-                    }
+                response = call(client_metadata, request, server_context.deadline());
+
+                if (shared_memory_block.has_value() && shared_memory_channel->write(client_metadata, shared_memory_block.value(), *response.mutable_gcode_paths()))
+                {
+                    server_context.AddTrailingMetadata(std::string{ shared_memory::response_key }, std::to_string(shared_memory_block->sequence));
                 }
             }
             catch (const std::exception& e)
@@ -134,11 +95,365 @@ struct Generate
 
             if (! status.ok())
             {
-                co_await agrpc::finish_with_error(writer, status, boost::asio::use_awaitable);
+                co_await agrpc::finish_with_error(writer, status, recycling_awaitable);
                 continue;
             }
-            co_await agrpc::finish(writer, response, status, boost::asio::use_awaitable);
+            co_await agrpc::finish(writer, response, status, recycling_awaitable);
+        }
+    }
+
+    /*
+     * Modifies the layer of a call.
+     *
+     * With several worker processes the call can reach a process that did not receive the
+     * settings broadcast of the session, see plugin/workers.h. The layer is then returned
+     * unmodified rather than failing the slice.
+     *
+     * @param session the cura-engine-uuid of the client
+     * @param request the layer, with its points restored from shared memory
+     * @param deadline the deadline of the call
+     * @return the response to the call
+     */
+    Rsp call(const std::string& session, const Req& request, const AdmissionControl::clock_t::time_point deadline) const
+    {
+        const auto& extruder_nr = request.extruder_nr();
+        Rsp response;
+        const auto extruder_settings = sessionSettings(session, request.layer_nr());
+        if (! extruder_settings.has_value() || ! extruder_settings->gradual_flow_enabled[extruder_nr])
+        {
+            // If gradual flow is disabled, just return the original gcode paths
+            response.mutable_gcode_paths()->CopyFrom(request.gcode_paths());
+            return response;
+        }
+
+        // continue from where the previous layer of this extruder ended, if it was processed already
+        const auto start_flow_state = layer_flow_states->find(session, extruder_nr, request.layer_nr());
+        // a layer from the cache is answered right away, only the layers that are processed are admitted and recorded
+        auto cache_key = response_cache->enabled() ? std::optional{ cacheKey(request, *extruder_settings, start_flow_state) } : std::nullopt;
+        auto layer_response = cache_key.has_value() ? cachedResponse(request, *cache_key) : nullptr;
+        if (layer_response == nullptr)
+        {
+            if (! admission_control->admit(static_cast<std::size_t>(request.gcode_paths_size()), deadline))
+            {
+                // the engine would rather have the layer on time than with gradual flow
+                metrics->degraded_layers++;
+                spdlog::warn("Layer {}: returning the original paths, the layer cannot be processed before the deadline", request.layer_nr());
+                response.mutable_gcode_paths()->CopyFrom(request.gcode_paths());
+                return response;
+            }
+            const auto start_time = std::chrono::steady_clock::now();
+            layer_response = std::make_shared<const LayerResponse<Rsp>>(modifyGcodePaths(request, *extruder_settings, start_flow_state));
+            admission_control->record(static_cast<std::size_t>(request.gcode_paths_size()), std::chrono::steady_clock::now() - start_time);
+            if (cache_key.has_value())
+            {
+                response_cache->insert(std::move(*cache_key), layer_response);
+            }
+        }
+        layer_flow_states->store(session, extruder_nr, request.layer_nr(), layer_response->end_flow_state);
+        recordPrintTimeImpact(session, request.layer_nr(), layer_response->print_time_impact);
+        return layer_response->response;
+    }
+
+    /*
+     * @param session the cura-engine-uuid of the client
+     * @param layer_nr the layer of the call, for the warning
+     * @return the settings of the session, or nothing when they were not broadcast to this process
+     */
+    std::optional<Settings> sessionSettings(const std::string& session, const std::int64_t layer_nr) const
+    {
+        auto extruder_settings = settings->find(session);
+        if (! extruder_settings.has_value())
+        {
+            metrics->unknown_session_layers++;
+            spdlog::warn("Layer {}: returning the original paths, no settings were broadcast to this process for session {}, or the session expired", layer_nr, session);
+        }
+        return extruder_settings;
+    }
+
+    /*
+     * Adds how much a modified layer takes longer to the session and the metrics.
+     */
+    void recordPrintTimeImpact(const std::string& session, const std::int64_t layer_nr, const PrintTimeImpact& impact) const
+    {
+        print_time_impacts->add(session, impact);
+        metrics->original_extrusion_time += static_cast<std::int64_t>(std::round(impact.original_duration * 1e6));
+        metrics->added_extrusion_time += static_cast<std::int64_t>(std::round(impact.addedDuration() * 1e6));
+        metrics->split_paths += impact.splitPaths();
+        spdlog::trace(
+            "Layer {}: gradual flow adds {:.3f} s ({:.2f}%) to {:.3f} s of extrusion, splitting off {} paths",
+            layer_nr,
+            impact.addedDuration(),
+            impact.addedFraction() * 100.,
+            impact.original_duration,
+            impact.splitPaths());
+    }
+
+    static double flowLimit(const Req& request, const Settings& extruder_settings)
+    {
+        const auto extruder_nr = request.extruder_nr();
+        return request.layer_nr() == 0 ? extruder_settings.layer_0_max_flow_acceleration[extruder_nr] : extruder_settings.max_flow_acceleration[extruder_nr];
+    }
+
+    static double flowStepTolerance(const Req& request, const Settings& extruder_settings)
+    {
+        const auto extruder_nr = request.extruder_nr();
+        return extruder_settings.gradual_flow_adaptive_discretisation[extruder_nr] ? extruder_settings.gradual_flow_discretisation_tolerance[extruder_nr] : 0.0;
+    }
+
+    /*
+     * Returns the policies of the print features of a layer, if the settings treat any feature
+     * differently from the others.
+     *
+     * Only the stepped ramps have policies, and on the initial layer every feature that is not exempt
+     * ramps with the initial layer flow acceleration.
+     */
+    static std::optional<FeaturePolicies> featurePolicies(const Req& request, const Settings& extruder_settings)
+    {
+        using cura::plugins::v0::PrintFeature;
+        struct FeatureSettings
+        {
+            std::vector<bool> Settings::*exempt;
+            std::vector<double> Settings::*max_flow_acceleration;
+            std::initializer_list<PrintFeature> features;
+        };
+        static const std::array feature_settings{
+            FeatureSettings{ &Settings::gradual_flow_inner_wall_exempt, &Settings::gradual_flow_inner_wall_max_flow_acceleration, { PrintFeature::INNERWALL } },
+            FeatureSettings{ &Settings::gradual_flow_skin_exempt, &Settings::gradual_flow_skin_max_flow_acceleration, { PrintFeature::SKIN } },
+            FeatureSettings{ &Settings::gradual_flow_infill_exempt, &Settings::gradual_flow_infill_max_flow_acceleration, { PrintFeature::INFILL } },
+            FeatureSettings{ &Settings::gradual_flow_support_exempt,
+                             &Settings::gradual_flow_support_max_flow_acceleration,
+                             { PrintFeature::SUPPORT, PrintFeature::SUPPORTINFILL, PrintFeature::SUPPORTINTERFACE } },
+        };
+
+        const auto extruder_nr = static_cast<std::size_t>(request.extruder_nr());
+        if (extruder_settings.gradual_flow_time_optimal_ramps[extruder_nr])
+        {
+            return std::nullopt;
+        }
+        const auto flow_limit = flowLimit(request, extruder_settings);
+        FeaturePolicies feature_policies{};
+        auto has_policy = false;
+        for (const auto& settings : feature_settings)
+        {
+            FeaturePolicy policy{ .exempt = (extruder_settings.*settings.exempt)[extruder_nr] };
+            const auto max_flow_acceleration = (extruder_settings.*settings.max_flow_acceleration)[extruder_nr];
+            if (! policy.exempt && request.layer_nr() != 0 && max_flow_acceleration > 0.0 && max_flow_acceleration != flow_limit)
+            {
+                policy.flow_acceleration = max_flow_acceleration;
+            }
+            for (const auto feature : settings.features)
+            {
+                feature_policies[static_cast<std::size_t>(feature)] = policy;
+            }
+            has_policy = has_policy || policy != FeaturePolicy{};
+        }
+        if (! has_policy)
+        {
+            return std::nullopt;
+        }
+        return feature_policies;
+    }
+
+    /*
+     * Identical layers (e.g. a plate of copies, or prismatic parts) result in identical requests which
+     * are processed in exactly the same way; these are answered from the cache.
+     *
+     * @return the key of the response to a layer in the response cache
+     */
+    static ResponseCacheKey cacheKey(const Req& request, const Settings& extruder_settings, const std::optional<LayerFlowState>& start_flow_state)
+    {
+        const auto& extruder_nr = request.extruder_nr();
+        auto gcode_paths = serializeMessages(request.gcode_paths());
+        return ResponseCacheKey{
+            .gcode_paths_hash = hashBytes(gcode_paths),
+            .gcode_paths = std::move(gcode_paths),
+            .extruder_nr = extruder_nr,
+            .initial_layer = request.layer_nr() == 0,
+            .flow_acceleration = flowLimit(request, extruder_settings),
+            .discretized_duration = extruder_settings.gradual_flow_discretisation_step_size[extruder_nr],
+            .reset_flow_duration = extruder_settings.reset_flow_duration,
+            .flow_step_tolerance = flowStepTolerance(request, extruder_settings),
+            .time_optimal_ramps = extruder_settings.gradual_flow_time_optimal_ramps[extruder_nr],
+            .start_flow_state = start_flow_state,
+            .feature_policies = featurePolicies(request, extruder_settings),
+        };
+    }
+
+    /*
+     * @return the response to an identical layer that was processed already, if it is still cached
+     */
+    std::shared_ptr<const LayerResponse<Rsp>> cachedResponse(const Req& request, const ResponseCacheKey& cache_key) const
+    {
+        auto cached_response = response_cache->find(cache_key);
+        if (cached_response == nullptr)
+        {
+            return nullptr;
+        }
+        if (flow_timeline->enabled())
+        {
+            flow_timeline->record(request.layer_nr(), request.extruder_nr(), cached_response->timeline_rows);
+        }
+        if (svg_dump->enabled())
+        {
+            // the paths of the cached layer are parsed again from the messages
+            svg_dump->dump(request.layer_nr(), request.extruder_nr(), gcodePaths(request), gcodePaths(cached_response->response));
+        }
+        return cached_response;
+    }
+
+    /*
+     * Returns the state to process the paths of a layer with.
+     *
+     * @param target_flow the flow of the first extruding path of the layer
+     * @param start_flow_state the flow state the previous layer ended with, if known
+     * @param feature_policies the policies of the print features, see featurePolicies, or nullptr;
+     * they have to outlive the state
+     */
+    static GCodeState gcodeState(
+        const Req& request,
+        const Settings& extruder_settings,
+        const double target_flow,
+        const std::optional<LayerFlowState>& start_flow_state,
+        const FeaturePolicies* feature_policies = nullptr)
+    {
+        const auto& extruder_nr = request.extruder_nr();
+        const auto flow_limit = flowLimit(request, extruder_settings);
+
+        GCodeState state{
+            .current_flow = target_flow,
+            .flow_acceleration = flow_limit,
+            .flow_deceleration = flow_limit,
+            .discretized_duration = extruder_settings.gradual_flow_discretisation_step_size[extruder_nr],
+            // take the first path's target flow as the target flow, this might
+            // not be correct, but it is safe to assume the target flow for the
+            // next layer is the same as the target flow of the current layer
+            .target_end_flow = target_flow,
+            .reset_flow_duration = extruder_settings.reset_flow_duration,
+            .flow_step_tolerance = flowStepTolerance(request, extruder_settings),
+            .feature_policies = feature_policies,
+        };
+        if (start_flow_state.has_value())
+        {
+            state.current_flow = start_flow_state->flow;
+            state.discretized_duration_remaining = start_flow_state->discretized_duration_remaining;
+            state.flow_state = start_flow_state->flow_state;
+        }
+        return state;
+    }
+
+    /*
+     * Parses the paths of a request, or of a response; the parsed paths refer to its messages.
+     *
+     * We need to add the last point of the previous path to the current path
+     * since the paths in Cura are a connected line string and a new path begins
+     * where the previous path ends (see figure below).
+     *    {                Path A            } {          Path B        } { ...etc
+     *    a.1-----------a.2------a.3---------a.4------b.1--------b.2--- c.1-------
+     * For our purposes it is easier that each path is a separate line string, and
+     * no knowledge of the previous path is needed.
+     */
+    template<class Message>
+    static std::vector<GCodePath> gcodePaths(const Message& request)
+    {
+        std::vector<GCodePath> gcode_paths;
+        gcode_paths.reserve(static_cast<std::size_t>(request.gcode_paths_size()));
+        for (const auto& path : request.gcode_paths())
+        {
+            geometry::polyline<> points;
+            points.reserve(static_cast<std::size_t>(path.path().path_size()) + 1);
+            if (! gcode_paths.empty() && ! ranges::back(gcode_paths).points.empty())
+            {
+                points.emplace_back(ranges::back(ranges::back(gcode_paths).points));
+            }
+            for (const auto& point : path.path().path())
+            {
+                points.emplace_back(ClipperLib::IntPoint{ point.x(), point.y() });
+            }
+            gcode_paths.emplace_back(GCodePath{ .original_gcode_path_data = &path, .points = std::move(points) });
+        }
+        return gcode_paths;
+    }
+
+    /*
+     * Adds the messages of the modified paths of a layer to its response.
+     */
+    static void addGcodePaths(Rsp& response, const std::vector<GCodePath>& gcode_paths)
+    {
+        // since the first point is added from the previous path in the request-parsing,
+        // we should remove it here again. Note that the first point is added for every path
+        // except the first one, so we should only remove it if it is not the first path
+        addGrpcMessages(*response.mutable_gcode_paths(), gcode_paths, true);
+    }
+
+    LayerResponse<Rsp> modifyGcodePaths(const Req& request, const Settings& extruder_settings, const std::optional<LayerFlowState>& start_flow_state) const
+    {
+        const auto feature_policies = featurePolicies(request, extruder_settings);
+        return modifyGcodePaths(request, extruder_settings, start_flow_state, feature_policies.has_value() ? &*feature_policies : nullptr);
+    }
+
+    /*
+     * @param feature_policies the policies of the print features of the layer, see featurePolicies, or nullptr
+     */
+    LayerResponse<Rsp> modifyGcodePaths(
+        const Req& request,
+        const Settings& extruder_settings,
+        const std::optional<LayerFlowState>& start_flow_state,
+        const FeaturePolicies* feature_policies) const
+    {
+        LayerResponse<Rsp> layer_response;
+        auto& response = layer_response.response;
+        const auto& extruder_nr = request.extruder_nr();
+
+        // Parse the gcode paths from the request
+        const auto gcode_paths = gcodePaths(request);
+
+        constexpr auto non_zero_flow_view = ranges::views::transform([](const auto& path){ return path.flow(); }) | ranges::views::drop_while([](const auto flow){ return flow == 0.0; });
+        auto gcode_paths_non_zero_flow_view = gcode_paths | non_zero_flow_view;
+
+        auto target_flow = ranges::empty(gcode_paths_non_zero_flow_view) ? 0.0 : ranges::front(gcode_paths_non_zero_flow_view);
+        auto state = gcodeState(request, extruder_settings, target_flow, start_flow_state, feature_policies);
+
+        const auto start_flow = state.flow_state == FlowState::UNDEFINED ? FlowRampPlanner::unlimited_flow : state.current_flow;
+        std::vector<GCodePath> limited_flow_acceleration_paths;
+        if (extruder_settings.gradual_flow_time_optimal_ramps[extruder_nr])
+        {
+            const FlowRampPlanner planner{
+                .flow_acceleration = state.flow_acceleration,
+                .flow_deceleration = state.flow_deceleration,
+                .acceleration_step_duration = state.stepDuration(utils::Direction::Forward),
+                .deceleration_step_duration = state.stepDuration(utils::Direction::Backward),
+                .reset_flow_duration = state.reset_flow_duration,
+            };
+            limited_flow_acceleration_paths = coalesceGcodePaths(planner.plan(gcode_paths, start_flow, state.target_end_flow, *worker_pool, &layer_response.end_flow_state));
+            metrics->planned_layers++;
+            if (compare_planner)
+            {
+                // report how much faster the planned layer prints than it would with the stepped ramps
+                const auto stepped_paths = processGcodePathsParallel(state, gcode_paths, *worker_pool);
+                const auto time_saved = printDuration(stepped_paths) - printDuration(limited_flow_acceleration_paths);
+                metrics->compared_planned_layers++;
+                metrics->planner_time_saved += static_cast<std::int64_t>(std::round(time_saved * 1e6));
+                spdlog::trace("Layer {}: ramp planner saves {:.3f} s compared to stepped ramps", request.layer_nr(), time_saved);
+            }
+        }
+        else
+        {
+            limited_flow_acceleration_paths = coalesceGcodePaths(processGcodePathsParallel(state, gcode_paths, *worker_pool));
+            layer_response.end_flow_state = state.end_state;
+        }
+        layer_response.print_time_impact = printTimeImpact(gcode_paths, limited_flow_acceleration_paths);
+        if (flow_timeline->enabled())
+        {
+            layer_response.timeline_rows.add(gcode_paths, limited_flow_acceleration_paths);
+            flow_timeline->record(request.layer_nr(), extruder_nr, layer_response.timeline_rows);
+        }
+        if (svg_dump->enabled())
+        {
+            svg_dump->dump(request.layer_nr(), extruder_nr, gcode_paths, limited_flow_acceleration_paths);
         }
+        // Copy newly generated paths to response
+        addGcodePaths(response, limited_flow_acceleration_paths);
+        return layer_response;
     }
 };
 
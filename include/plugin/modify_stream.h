@@ -0,0 +1,451 @@
+#ifndef PLUGIN_MODIFY_STREAM_H
+#define PLUGIN_MODIFY_STREAM_H
+
+#include "cura/plugins/slots/gcode_paths/v0/modify.grpc.pb.h"
+#include "cura/plugins/slots/gcode_paths/v0/modify.pb.h"
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/streaming_gcode_state.h"
+#include "plugin/completion_tokens.h"
+#include "plugin/flow_timeline.h"
+#include "plugin/metadata.h"
+#include "plugin/modify.h"
+#include "plugin/print_time_impact.h"
+#include "plugin/settings.h"
+#include "plugin/svg_dump.h"
+
+#include <agrpc/asio_grpc.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <grpcpp/impl/codegen/async_stream.h>
+#include <grpcpp/impl/codegen/rpc_method.h>
+#include <grpcpp/impl/codegen/rpc_service_method.h>
+#include <grpcpp/impl/codegen/service_type.h>
+#include <range/v3/view/drop.hpp>
+#include <range/v3/view/take.hpp>
+#include <spdlog/spdlog.h>
+
+#if __has_include(<coroutine>)
+#include <coroutine>
+#elif __has_include(<experimental/coroutine>)
+#include <experimental/coroutine>
+#define USE_EXPERIMENTAL_COROUTINE
+#endif
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace plugin::gradual_flow
+{
+
+/*
+ * A streaming variant of the modify slot for layers that do not fit in a single message. It is
+ * defined by the plugin, not by CuraEngine, and is equivalent to the service generated from
+ *
+ *   service GCodePathsModifyStreamService {
+ *       rpc Call(stream cura.plugins.slots.gcode_paths.v0.modify.CallRequest) returns (stream cura.plugins.slots.gcode_paths.v0.modify.CallResponse) {}
+ *   }
+ *
+ * A call modifies a single layer. The client sends the paths of the layer in order, split over any
+ * number of requests that all carry the extruder and layer number, and then closes its side of the
+ * stream. The plugin sends back the modified paths, split over any number of responses; together
+ * they are identical to the response of the unary modify slot. Clients generate their stub from the
+ * service definition above.
+ */
+struct GCodePathsModifyStreamService
+{
+    using request_t = cura::plugins::slots::gcode_paths::v0::modify::CallRequest;
+    using response_t = cura::plugins::slots::gcode_paths::v0::modify::CallResponse;
+
+    static constexpr const char* call_method{ "/gradual_flow.v0.GCodePathsModifyStreamService/Call" };
+
+    class AsyncService : public grpc::Service
+    {
+    public:
+        AsyncService()
+        {
+            AddMethod(new grpc::internal::RpcServiceMethod(call_method, grpc::internal::RpcMethod::BIDI_STREAMING, nullptr));
+            MarkMethodAsync(0);
+        }
+
+        void RequestCall(
+            grpc::ServerContext* context,
+            grpc::ServerAsyncReaderWriter<response_t, request_t>* stream,
+            grpc::CompletionQueue* new_call_cq,
+            grpc::ServerCompletionQueue* notification_cq,
+            void* tag)
+        {
+            RequestAsyncBidiStreaming(0, context, stream, new_call_cq, notification_cq, tag);
+        }
+    };
+};
+
+/*
+ * Modifies a layer that arrives in chunks with the stepped ramps, with the same result as
+ * Generate::modifyGcodePaths. The paths go through a StreamingGCodeState, so every chunk is answered
+ * with the paths that are final so far, while the rest of the layer is still to come.
+ */
+template<class G>
+class LayerStream
+{
+public:
+    using request_t = GCodePathsModifyStreamService::request_t;
+    using response_t = GCodePathsModifyStreamService::response_t;
+
+    /*
+     * What to keep of the layer to diagnose it, as the unary slot does.
+     */
+    struct Diagnostics
+    {
+        bool flow_timeline{ false }; // gather the rows of the flow timeline
+        bool svg_dump{ false }; // copy the input and output paths for the SVG dump
+    };
+
+    /*
+     * @param extruder_settings the settings of the client the layer is from
+     * @param start_flow_state the flow state the previous layer ended with, if known
+     * @param diagnostics what to keep of the layer to diagnose it
+     */
+    LayerStream(const Settings& extruder_settings, const std::optional<LayerFlowState>& start_flow_state, const Diagnostics diagnostics = {})
+        : extruder_settings_{ extruder_settings }
+        , start_flow_state_{ start_flow_state }
+    {
+        if (diagnostics.flow_timeline)
+        {
+            timeline_rows_.emplace();
+        }
+        if (diagnostics.svg_dump)
+        {
+            svg_layer_.emplace();
+        }
+    }
+
+    /*
+     * @param request the next chunk of the layer, every chunk carries the extruder and layer number
+     * @return the modified paths that are final, possibly none
+     */
+    response_t push(request_t&& request)
+    {
+        // the parsed paths refer to the request they are parsed from, so the requests are kept until those paths are sent
+        const auto& chunk = requests_.emplace_back(std::move(request));
+        std::vector<GCodePath> finalized_paths;
+        for (const auto& path : chunk.gcode_paths())
+        {
+            // add the last point of the previous path, see Generate::modifyGcodePaths
+            geometry::polyline<> points;
+            points.reserve(static_cast<std::size_t>(path.path().path_size()) + 1);
+            if (previous_point_.has_value())
+            {
+                points.emplace_back(*previous_point_);
+            }
+            for (const auto& point : path.path().path())
+            {
+                points.emplace_back(ClipperLib::IntPoint{ point.x(), point.y() });
+            }
+            previous_point_ = ranges::back(points);
+            GCodePath gcode_path{ .original_gcode_path_data = &path, .points = std::move(points) };
+            print_time_impact_.addOriginal(gcode_path);
+            if (svg_layer_.has_value())
+            {
+                svg_layer_->input_paths.emplace_back(SvgDump::snapshot(gcode_path));
+            }
+
+            if (streaming_state_.has_value())
+            {
+                std::ranges::move(streaming_state_->push(gcode_path), std::back_inserter(finalized_paths));
+                continue;
+            }
+            // the first extruding path sets the target flow of the layer
+            const auto is_extruding = gcode_path.flow() != 0.0;
+            pending_paths_.emplace_back(std::move(gcode_path));
+            if (is_extruding)
+            {
+                finalized_paths = startStreaming();
+            }
+        }
+        return toResponse(std::move(finalized_paths), false);
+    }
+
+    /*
+     * Ends the layer.
+     *
+     * @return the remaining modified paths
+     */
+    response_t finish()
+    {
+        auto finalized_paths = streaming_state_.has_value() ? std::vector<GCodePath>{} : startStreaming();
+        std::ranges::move(streaming_state_->finish(), std::back_inserter(finalized_paths));
+        return toResponse(std::move(finalized_paths), true);
+    }
+
+    /*
+     * @return the number of received requests that are kept, for the paths that are not sent yet
+     */
+    std::size_t requestCount() const
+    {
+        return requests_.size();
+    }
+
+    /*
+     * @return the flow state the next layer continues from, once the layer is finished
+     */
+    LayerFlowState endFlowState() const
+    {
+        return streaming_state_->endState();
+    }
+
+    /*
+     * @return the rows of the flow timeline of the layer, once the layer is finished; none when
+     * the timeline is not recorded
+     */
+    const FlowTimelineRows& timelineRows() const
+    {
+        static const FlowTimelineRows no_rows;
+        return timeline_rows_.has_value() ? *timeline_rows_ : no_rows;
+    }
+
+    /*
+     * @return the paths of the layer for the SVG dump, once the layer is finished; none when they are
+     * not kept
+     */
+    std::optional<SvgDump::Layer> takeSvgLayer()
+    {
+        return std::exchange(svg_layer_, std::nullopt);
+    }
+
+    /*
+     * @return how much the layer takes longer, once the layer is finished
+     */
+    const PrintTimeImpact& printTimeImpact() const
+    {
+        return print_time_impact_;
+    }
+
+private:
+    std::vector<GCodePath> startStreaming()
+    {
+        const auto first_extruding_path = ranges::find_if(pending_paths_, [](const auto& path){ return path.flow() != 0.0; });
+        const auto target_flow = first_extruding_path == ranges::end(pending_paths_) ? 0.0 : first_extruding_path->flow();
+        feature_policies_ = G::featurePolicies(requests_.front(), extruder_settings_);
+        const auto state = G::gcodeState(requests_.front(), extruder_settings_, target_flow, start_flow_state_, feature_policies_.has_value() ? &*feature_policies_ : nullptr);
+        streaming_state_.emplace(state);
+
+        std::vector<GCodePath> finalized_paths;
+        for (const auto& path : pending_paths_)
+        {
+            std::ranges::move(streaming_state_->push(path), std::back_inserter(finalized_paths));
+        }
+        pending_paths_.clear();
+        return finalized_paths;
+    }
+
+    response_t toResponse(std::vector<GCodePath>&& finalized_paths, const bool is_last)
+    {
+        // the last path is held back until the next chunk, it can still be coalesced with the paths that follow
+        if (last_path_.has_value())
+        {
+            finalized_paths.insert(finalized_paths.begin(), std::move(*last_path_));
+            last_path_.reset();
+        }
+        auto coalesced_paths = coalesceGcodePaths(std::move(finalized_paths));
+        if (! is_last && ! coalesced_paths.empty())
+        {
+            last_path_ = std::move(coalesced_paths.back());
+            coalesced_paths.pop_back();
+        }
+
+        // only the first path of the layer keeps its first point, see Generate::modifyGcodePaths
+        response_t response;
+        addGrpcMessages(*response.mutable_gcode_paths(), coalesced_paths, path_count_ == 0);
+        for (const auto& gcode_path : coalesced_paths)
+        {
+            path_count_++;
+            print_time_impact_.addModified(gcode_path);
+            const auto path_index = pathIndex(gcode_path.original_gcode_path_data);
+            if (timeline_rows_.has_value())
+            {
+                timeline_rows_->add(gcode_path, path_index);
+            }
+            if (svg_layer_.has_value())
+            {
+                svg_layer_->output_paths.emplace_back(SvgDump::snapshot(gcode_path));
+            }
+        }
+
+        // the held back path refers to the oldest request that is still needed
+        if (last_path_.has_value())
+        {
+            pathIndex(last_path_->original_gcode_path_data);
+        }
+        return response;
+    }
+
+    /*
+     * Returns the index in the layer of the path of a request that a returned path belongs to, and
+     * drops the requests before it. The paths are returned in order, so no later path refers to
+     * those requests, and the search continues where the previous one ended.
+     */
+    std::uint32_t pathIndex(const cura::plugins::v0::GCodePath* original_gcode_path_data)
+    {
+        while (true)
+        {
+            const auto& gcode_paths = requests_.front().gcode_paths();
+            while (front_path_index_ < gcode_paths.size() && &gcode_paths[front_path_index_] != original_gcode_path_data)
+            {
+                front_path_index_++;
+            }
+            if (front_path_index_ < gcode_paths.size() || requests_.size() == 1)
+            {
+                return static_cast<std::uint32_t>(released_path_count_ + front_path_index_);
+            }
+            released_path_count_ += static_cast<std::size_t>(gcode_paths.size());
+            requests_.pop_front();
+            front_path_index_ = 0;
+        }
+    }
+
+    Settings extruder_settings_;
+    std::optional<LayerFlowState> start_flow_state_;
+    std::optional<FeaturePolicies> feature_policies_; // the streaming state refers to them
+    std::deque<request_t> requests_; // from the one with the oldest path that is not sent yet
+    int front_path_index_{ 0 }; // in the first request, of the last path that was returned, or before it
+    std::size_t released_path_count_{ 0 }; // in the dropped requests
+    std::optional<ClipperLib::IntPoint> previous_point_;
+    std::vector<GCodePath> pending_paths_; // parsed paths up to the first extruding path
+    std::optional<StreamingGCodeState> streaming_state_;
+    std::optional<GCodePath> last_path_;
+    std::size_t path_count_{ 0 };
+    PrintTimeImpact print_time_impact_{ .layers = 1 };
+    std::optional<FlowTimelineRows> timeline_rows_;
+    std::optional<SvgDump::Layer> svg_layer_;
+};
+
+/*
+ * Serves the streaming modify slot with the settings, workers and flow states of the unary slot.
+ *
+ * The time optimal ramp planner needs the whole layer, so with it the layer is collected and
+ * modified like a unary request. Streamed layers are not cached.
+ */
+template<class G>
+struct GenerateStream
+{
+    using service_t = std::shared_ptr<GCodePathsModifyStreamService::AsyncService>;
+    using request_t = GCodePathsModifyStreamService::request_t;
+    using response_t = GCodePathsModifyStreamService::response_t;
+    using stream_t = grpc::ServerAsyncReaderWriter<response_t, request_t>;
+    service_t generate_stream_service{ std::make_shared<GCodePathsModifyStreamService::AsyncService>() };
+    G generate;
+
+    boost::asio::awaitable<void> run()
+    {
+        while (true)
+        {
+            grpc::ServerContext server_context;
+            stream_t stream{ &server_context };
+            co_await agrpc::request(&GCodePathsModifyStreamService::AsyncService::RequestCall, *generate_stream_service, server_context, stream, recycling_awaitable);
+
+            grpc::Status status = grpc::Status::OK;
+            try
+            {
+                co_await modifyGcodePathsStream(server_context, stream);
+            }
+            catch (const std::exception& e)
+            {
+                spdlog::error("Error: {}", e.what());
+                status = grpc::Status(grpc::StatusCode::INTERNAL, static_cast<std::string>(e.what()));
+            }
+            co_await agrpc::finish(stream, status, recycling_awaitable);
+        }
+    }
+
+    boost::asio::awaitable<void> modifyGcodePathsStream(grpc::ServerContext& server_context, stream_t& stream)
+    {
+        const auto client_metadata = getUuid(server_context);
+
+        request_t request;
+        if (! co_await agrpc::read(stream, request, recycling_awaitable))
+        {
+            co_return;
+        }
+        const auto extruder_nr = request.extruder_nr();
+        const auto layer_nr = request.layer_nr();
+        const auto session_settings = generate.sessionSettings(client_metadata, layer_nr);
+
+        if (! session_settings.has_value() || ! session_settings->gradual_flow_enabled[extruder_nr])
+        {
+            // If gradual flow is disabled, just return the original gcode paths
+            do
+            {
+                response_t response;
+                response.mutable_gcode_paths()->Swap(request.mutable_gcode_paths());
+                co_await agrpc::write(stream, response, recycling_awaitable);
+            } while (co_await agrpc::read(stream, request, recycling_awaitable));
+            co_return;
+        }
+        const auto& extruder_settings = *session_settings;
+
+        const auto start_flow_state = generate.layer_flow_states->find(client_metadata, extruder_nr, layer_nr);
+
+        if (extruder_settings.gradual_flow_time_optimal_ramps[extruder_nr])
+        {
+            request_t layer_request = request;
+            auto chunk_size = std::max(request.gcode_paths_size(), 1);
+            while (co_await agrpc::read(stream, request, recycling_awaitable))
+            {
+                chunk_size = std::max(chunk_size, request.gcode_paths_size());
+                layer_request.mutable_gcode_paths()->MergeFrom(request.gcode_paths());
+            }
+            auto layer_response = generate.modifyGcodePaths(layer_request, extruder_settings, start_flow_state);
+            generate.layer_flow_states->store(client_metadata, extruder_nr, layer_nr, layer_response.end_flow_state);
+            generate.recordPrintTimeImpact(client_metadata, layer_nr, layer_response.print_time_impact);
+
+            // answer in chunks as large as the ones received, the whole layer might not fit in a single message
+            const auto& gcode_paths = layer_response.response.gcode_paths();
+            for (int begin = 0; begin < gcode_paths.size(); begin += chunk_size)
+            {
+                response_t response;
+                for (const auto& path : gcode_paths | ranges::views::drop(begin) | ranges::views::take(chunk_size))
+                {
+                    response.add_gcode_paths()->CopyFrom(path);
+                }
+                co_await agrpc::write(stream, response, recycling_awaitable);
+            }
+            co_return;
+        }
+
+        LayerStream<G> layer_stream{ extruder_settings, start_flow_state, { .flow_timeline = generate.flow_timeline->enabled(), .svg_dump = generate.svg_dump->enabled() } };
+        do
+        {
+            auto response = layer_stream.push(std::move(request));
+            if (response.gcode_paths_size() > 0)
+            {
+                co_await agrpc::write(stream, response, recycling_awaitable);
+            }
+            request = request_t{};
+        } while (co_await agrpc::read(stream, request, recycling_awaitable));
+
+        auto response = layer_stream.finish();
+        if (response.gcode_paths_size() > 0)
+        {
+            co_await agrpc::write(stream, response, recycling_awaitable);
+        }
+        generate.layer_flow_states->store(client_metadata, extruder_nr, layer_nr, layer_stream.endFlowState());
+        generate.recordPrintTimeImpact(client_metadata, layer_nr, layer_stream.printTimeImpact());
+        generate.flow_timeline->record(layer_nr, extruder_nr, layer_stream.timelineRows());
+        if (auto svg_layer = layer_stream.takeSvgLayer())
+        {
+            svg_layer->layer_nr = layer_nr;
+            svg_layer->extruder_nr = extruder_nr;
+            generate.svg_dump->dump(std::move(*svg_layer));
+        }
+    }
+};
+
+} // namespace plugin::gradual_flow
+
+#endif // PLUGIN_MODIFY_STREAM_H
@@ -0,0 +1,637 @@
+#ifndef PLUGIN_OFFLINE_H
+#define PLUGIN_OFFLINE_H
+
+#include "cura/plugins/v0/gcodepath.pb.h"
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/worker_pool.h"
+#include "plugin/mapped_file.h"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <numbers>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace plugin
+{
+
+/*
+ * Applies the gradual flow to an existing G-code file, without CuraEngine.
+ *
+ * The file is memory mapped and split into layers at the `;LAYER:` comments. Every G0/G1 move in
+ * the XY plane becomes a GCodePath, an extruding one when it moves the extruder forward, and the
+ * layers are processed by GCodeState like the layers of a modify call. The flow of a path is its
+ * extruded volume per um, from the E values and the filament diameter. Moves that keep their speed
+ * are copied unchanged; the others are split into pieces with their own feedrate and the E values
+ * interpolated along the move. All other lines are copied unchanged.
+ *
+ * Layers are processed in parallel, so every layer starts without the flow state of the previous
+ * layer, as if it was the first layer requested in a session. Relative positioning (G91) is not
+ * supported.
+ */
+namespace offline
+{
+
+/*
+ * The settings of the plugin, in the units the plugin uses, that apply to every layer of the file.
+ */
+struct Options
+{
+    double flow_acceleration{ 1e9 }; // um^3/s^2
+    double layer_0_flow_acceleration{ 1e9 }; // um^3/s^2
+    double discretized_duration{ 0.2 }; // s
+    double flow_step_tolerance{ 0.0 }; // um^3/s, when set the step duration adapts to the flow acceleration
+    double reset_flow_duration{ 2.0 }; // s
+    double filament_diameter{ 1750.0 }; // um
+};
+
+/*
+ * A layer of the file, from its `;LAYER:` comment up to the next one.
+ */
+struct Layer
+{
+    std::string_view text;
+    std::optional<std::int64_t> layer_nr; // none for the start G-code before the first layer
+};
+
+/*
+ * The state of the printer that the moves of a layer depend on.
+ */
+struct Position
+{
+    double x{ 0.0 }; // mm
+    double y{ 0.0 }; // mm
+    double e{ 0.0 }; // mm, only kept up to date with absolute extrusion
+    double feedrate{ 0.0 }; // mm/min
+    bool relative_extrusion{ false };
+};
+
+/*
+ * The command and the parameters of a line of G-code; comments are skipped.
+ */
+struct Line
+{
+    char letter{ 0 }; // 'G', 'M' or 'T', 0 without a command
+    int code{ -1 };
+    std::optional<double> x;
+    std::optional<double> y;
+    std::optional<double> z;
+    std::optional<double> e;
+    std::optional<double> f;
+
+    bool isMove() const
+    {
+        return letter == 'G' && (code == 0 || code == 1);
+    }
+
+    bool isArc() const
+    {
+        return letter == 'G' && (code == 2 || code == 3);
+    }
+};
+
+inline Line parseLine(std::string_view text)
+{
+    text = text.substr(0, text.find(';'));
+    Line line;
+    const auto* cursor = text.data();
+    const auto* end = text.data() + text.size();
+    while (cursor != end)
+    {
+        const auto letter = static_cast<char>(std::toupper(static_cast<unsigned char>(*cursor++)));
+        if (letter < 'A' || letter > 'Z')
+        {
+            continue;
+        }
+        double value{ 0.0 };
+        const auto [next, error] = std::from_chars(cursor, end, value);
+        if (error != std::errc{})
+        {
+            continue;
+        }
+        cursor = next;
+        switch (letter)
+        {
+        case 'G':
+        case 'M':
+        case 'T':
+            if (line.letter == 0)
+            {
+                line.letter = letter;
+                line.code = static_cast<int>(value);
+            }
+            break;
+        case 'X':
+            line.x = value;
+            break;
+        case 'Y':
+            line.y = value;
+            break;
+        case 'Z':
+            line.z = value;
+            break;
+        case 'E':
+            line.e = value;
+            break;
+        case 'F':
+            line.f = value;
+            break;
+        default:
+            break;
+        }
+    }
+    return line;
+}
+
+/*
+ * Splits the file into layers at the `;LAYER:` comments; the start G-code is a layer of its own.
+ */
+inline std::vector<Layer> splitLayers(const std::string_view gcode)
+{
+    constexpr std::string_view marker{ ";LAYER:" };
+    constexpr std::string_view line_marker{ "\n;LAYER:" };
+
+    std::vector<Layer> layers;
+    std::size_t begin = 0;
+    std::optional<std::int64_t> layer_nr;
+    const auto add_layer = [&](const std::size_t end)
+    {
+        if (end > begin)
+        {
+            layers.push_back(Layer{ .text = gcode.substr(begin, end - begin), .layer_nr = layer_nr });
+        }
+    };
+
+    for (auto position = gcode.starts_with(marker) ? 0 : gcode.find(line_marker); position != std::string_view::npos; position = gcode.find(line_marker, begin))
+    {
+        const auto marker_begin = gcode[position] == '\n' ? position + 1 : position;
+        add_layer(marker_begin);
+        begin = marker_begin;
+        std::int64_t number{ 0 };
+        std::from_chars(gcode.data() + begin + marker.size(), gcode.data() + gcode.size(), number);
+        layer_nr = number;
+    }
+    add_layer(gcode.size());
+    return layers;
+}
+
+/*
+ * Returns the position at the end of a layer.
+ *
+ * Only the last lines of a layer set the position, so the layer is scanned backwards until every
+ * part of it is found. This is a lot cheaper than processing the layer, and gives the start positions
+ * of the next layers before they are processed in parallel.
+ */
+inline Position endPosition(const std::string_view text, const Position& start)
+{
+    const auto extrusion_mode = [&start](const std::string_view before) -> bool
+    {
+        // the last M82 or M83 at the start of a line decides the extrusion mode
+        for (auto position = before.size(); position > 0;)
+        {
+            position = before.rfind("M8", position - 1);
+            if (position == std::string_view::npos)
+            {
+                break;
+            }
+            if ((position == 0 || before[position - 1] == '\n') && position + 2 < before.size() && (before[position + 2] == '2' || before[position + 2] == '3'))
+            {
+                return before[position + 2] == '3';
+            }
+        }
+        return start.relative_extrusion;
+    };
+
+    std::optional<double> x;
+    std::optional<double> y;
+    std::optional<double> e;
+    std::optional<double> feedrate;
+    auto end = text.size();
+    while (end > 0 && ! (x.has_value() && y.has_value() && e.has_value() && feedrate.has_value()))
+    {
+        const auto begin = text.rfind('\n', end - 1);
+        const auto line_begin = begin == std::string_view::npos ? 0 : begin + 1;
+        const auto line_text = text.substr(line_begin, end - line_begin);
+        end = line_begin == 0 ? 0 : line_begin - 1;
+        if (line_text.empty() || (line_text.front() != 'G' && line_text.front() != 'g'))
+        {
+            continue;
+        }
+
+        const auto line = parseLine(line_text);
+        if (line.letter != 'G')
+        {
+            continue;
+        }
+        if (line.code == 28)
+        {
+            x = x.value_or(0.0);
+            y = y.value_or(0.0);
+            continue;
+        }
+        if (line.code != 92 && ! line.isMove() && ! line.isArc())
+        {
+            continue;
+        }
+        if (! x.has_value())
+        {
+            x = line.x;
+        }
+        if (! y.has_value())
+        {
+            y = line.y;
+        }
+        if (! feedrate.has_value() && line.code != 92)
+        {
+            feedrate = line.f;
+        }
+        if (! e.has_value() && line.e.has_value())
+        {
+            // with relative extrusion the position of the extruder is not needed
+            e = line.code == 92 || ! extrusion_mode(text.substr(0, line_begin)) ? *line.e : start.e;
+        }
+    }
+    return Position{
+        .x = x.value_or(start.x),
+        .y = y.value_or(start.y),
+        .e = e.value_or(start.e),
+        .feedrate = feedrate.value_or(start.feedrate),
+        .relative_extrusion = extrusion_mode(text),
+    };
+}
+
+/*
+ * A move of a layer that is processed as a GCodePath.
+ */
+struct Move
+{
+    std::size_t begin{ 0 }; // offset of the line in the layer
+    std::size_t end{ 0 }; // offset past the line, including its line break
+    const cura::plugins::v0::GCodePath* message{ nullptr };
+    bool rapid{ false }; // G0
+    double start_x{ 0.0 }; // mm
+    double start_y{ 0.0 }; // mm
+    double end_x{ 0.0 }; // mm
+    double end_y{ 0.0 }; // mm
+    std::optional<double> start_z; // mm, if known
+    std::optional<double> end_z; // mm, when the line moves in Z as well
+    double start_e{ 0.0 }; // mm
+    double e_delta{ 0.0 }; // mm
+    std::optional<double> e; // mm, as written on the line
+    double feedrate{ 0.0 }; // mm/min
+    bool relative_extrusion{ false };
+};
+
+/*
+ * Appends ` <letter><value>` with at most `decimals` decimals, without trailing zeros. The value is
+ * rounded to an integer number of units of the last decimal, which is a lot faster to write than a
+ * floating point number.
+ */
+inline void appendParameter(std::string& text, const char letter, const double value, const int decimals)
+{
+    constexpr std::array<std::int64_t, 7> scales{ 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    auto units = std::llround(value * static_cast<double>(scales[static_cast<std::size_t>(decimals)]));
+    text += ' ';
+    text += letter;
+    if (units < 0)
+    {
+        text += '-';
+        units = -units;
+    }
+
+    // the digits of the units, with leading zeros up to a digit before the decimal point
+    std::array<char, 32> digits{};
+    const auto digits_begin = digits.data() + decimals + 1;
+    const auto digits_end = std::to_chars(digits_begin, digits.data() + digits.size(), units).ptr;
+    const auto number_begin = std::min(digits_begin, digits_end - decimals - 1);
+    std::fill(number_begin, digits_begin, '0');
+    const std::string_view number{ number_begin, digits_end };
+
+    text.append(number.substr(0, number.size() - static_cast<std::size_t>(decimals)));
+    auto fraction = number.substr(number.size() - static_cast<std::size_t>(decimals));
+    fraction = fraction.substr(0, fraction.find_last_not_of('0') + 1);
+    if (! fraction.empty())
+    {
+        text += '.';
+        text.append(fraction);
+    }
+}
+
+/*
+ * Writes the pieces a move was split into. The E values are interpolated along the move such that
+ * the last piece ends exactly where the move ends, and the feedrate of the move is restored after
+ * the pieces for the lines that follow.
+ */
+inline void appendPieces(std::string& text, const Move& move, const std::span<const gradual_flow::GCodePath> pieces)
+{
+    constexpr auto e_scale{ 1e5 }; // E is written with 5 decimals
+    const auto move_length = std::hypot(move.end_x - move.start_x, move.end_y - move.start_y);
+    const auto e_units = std::llround(move.e_delta * e_scale);
+
+    std::string feedrate;
+    std::string previous_feedrate;
+    std::int64_t previous_e_units{ 0 };
+    for (std::size_t index = 0; index < pieces.size(); ++index)
+    {
+        const auto is_last = index + 1 == pieces.size();
+        const auto& point = pieces[index].points.back();
+        const auto x = is_last ? move.end_x : static_cast<double>(point.X) / 1e3;
+        const auto y = is_last ? move.end_y : static_cast<double>(point.Y) / 1e3;
+        const auto fraction = is_last ? 1.0 : std::clamp(std::hypot(x - move.start_x, y - move.start_y) / move_length, 0.0, 1.0);
+
+        text += move.rapid ? "G0" : "G1";
+        feedrate.clear();
+        appendParameter(feedrate, 'F', pieces[index].speed * 60. / 1e3, 1);
+        if (feedrate != previous_feedrate)
+        {
+            text += feedrate;
+            previous_feedrate = feedrate;
+        }
+        appendParameter(text, 'X', x, 3);
+        appendParameter(text, 'Y', y, 3);
+        if (move.end_z.has_value())
+        {
+            appendParameter(text, 'Z', move.start_z.has_value() ? *move.start_z + (*move.end_z - *move.start_z) * fraction : *move.end_z, 3);
+        }
+        if (move.e.has_value())
+        {
+            const auto e_units_so_far = is_last ? e_units : std::llround(static_cast<double>(e_units) * fraction);
+            if (move.relative_extrusion)
+            {
+                appendParameter(text, 'E', static_cast<double>(e_units_so_far - previous_e_units) / e_scale, 5);
+            }
+            else
+            {
+                appendParameter(text, 'E', is_last ? *move.e : move.start_e + static_cast<double>(e_units_so_far) / e_scale, 5);
+            }
+            previous_e_units = e_units_so_far;
+        }
+        text += '\n';
+    }
+
+    feedrate.clear();
+    appendParameter(feedrate, 'F', move.feedrate, 1);
+    if (feedrate != previous_feedrate)
+    {
+        text += "G1";
+        text += feedrate;
+        text += '\n';
+    }
+}
+
+/*
+ * Applies the gradual flow to the moves of a layer.
+ *
+ * @param layer the layer
+ * @param start the position at the start of the layer
+ * @return the G-code of the layer with the modified moves
+ */
+inline std::string processLayer(const Layer& layer, const Position& start, const Options& options)
+{
+    const auto& text = layer.text;
+    const auto filament_area = std::numbers::pi * options.filament_diameter * options.filament_diameter / 4.; // um^2
+
+    // constructing a message costs more than parsing its line, so every thread keeps the messages of
+    // the layers it processed and fills them in again for the next layer
+    thread_local std::deque<cura::plugins::v0::GCodePath> messages;
+    // most lines of a layer are moves of about 30 bytes
+    std::vector<Move> moves;
+    moves.reserve(text.size() / 32);
+    std::vector<gradual_flow::GCodePath> gcode_paths;
+    gcode_paths.reserve(text.size() / 32);
+    auto position = start;
+    std::optional<double> z;
+    auto retracted = false;
+    for (std::size_t begin = 0; begin < text.size();)
+    {
+        const auto line_break = text.find('\n', begin);
+        const auto end = line_break == std::string_view::npos ? text.size() : line_break + 1;
+        const auto line_text = text.substr(begin, end - begin);
+        const auto line_begin = begin;
+        begin = end;
+        if (line_text.empty() || line_text.front() == ';')
+        {
+            continue;
+        }
+
+        const auto line = parseLine(line_text);
+        if (line.letter == 'M' && (line.code == 82 || line.code == 83))
+        {
+            position.relative_extrusion = line.code == 83;
+            continue;
+        }
+        if (line.letter != 'G')
+        {
+            continue;
+        }
+        if (line.code == 91)
+        {
+            throw std::runtime_error(fmt::format("Layer {}: relative positioning (G91) is not supported", layer.layer_nr.value_or(-1)));
+        }
+        if (line.code == 28)
+        {
+            position.x = 0.0;
+            position.y = 0.0;
+            z = 0.0;
+            continue;
+        }
+        if (line.code == 92)
+        {
+            position.x = line.x.value_or(position.x);
+            position.y = line.y.value_or(position.y);
+            position.e = line.e.value_or(position.e);
+            z = line.z.has_value() ? line.z : z;
+            continue;
+        }
+        if (! line.isMove() && ! line.isArc())
+        {
+            continue;
+        }
+
+        const auto e_delta = line.e.has_value() ? (position.relative_extrusion ? *line.e : *line.e - position.e) : 0.0;
+        Move move{
+            .begin = line_begin,
+            .end = end,
+            .rapid = line.code == 0,
+            .start_x = position.x,
+            .start_y = position.y,
+            .end_x = line.x.value_or(position.x),
+            .end_y = line.y.value_or(position.y),
+            .start_z = z,
+            .end_z = line.z,
+            .start_e = position.e,
+            .e_delta = e_delta,
+            .e = line.e,
+            .feedrate = line.f.value_or(position.feedrate),
+            .relative_extrusion = position.relative_extrusion,
+        };
+        position.x = move.end_x;
+        position.y = move.end_y;
+        position.e += e_delta;
+        position.feedrate = move.feedrate;
+        z = line.z.has_value() ? line.z : z;
+
+        const ClipperLib::IntPoint start_point{ std::llround(move.start_x * 1e3), std::llround(move.start_y * 1e3) };
+        const ClipperLib::IntPoint end_point{ std::llround(move.end_x * 1e3), std::llround(move.end_y * 1e3) };
+        if (e_delta < 0.)
+        {
+            retracted = true;
+        }
+        if (line.isArc() || start_point == end_point)
+        {
+            continue;
+        }
+
+        const auto extrudes = e_delta > 0.;
+        if (moves.size() == messages.size())
+        {
+            messages.emplace_back();
+        }
+        auto* message = &messages[moves.size()];
+        const auto length = std::hypot(static_cast<double>(end_point.X - start_point.X), static_cast<double>(end_point.Y - start_point.Y)); // um
+        // the flow of the message is the extruded volume per um, the other factors are 1
+        message->set_flow(extrudes ? e_delta * 1e3 * filament_area / length : 0.0);
+        message->set_width_factor(1.0);
+        message->set_speed_factor(1.0);
+        message->set_speed_back_pressure_factor(1.0);
+        message->set_line_width(1);
+        message->set_layer_thickness(1);
+        message->set_flow_ratio(1.0);
+        message->set_retract(! extrudes && retracted);
+        message->set_is_travel_path(! extrudes);
+        message->mutable_speed_derivatives()->set_velocity(move.feedrate / 60.);
+        retracted = retracted && ! extrudes;
+
+        move.message = message;
+        moves.push_back(move);
+        gcode_paths.emplace_back(gradual_flow::GCodePath{ .original_gcode_path_data = message, .points = { start_point, end_point } });
+    }
+
+    const auto first_extruding_path = std::find_if(gcode_paths.begin(), gcode_paths.end(), [](const auto& path) { return ! path.isTravel(); });
+    if (first_extruding_path == gcode_paths.end())
+    {
+        return std::string{ text };
+    }
+    const auto target_flow = first_extruding_path->flow();
+    const auto flow_limit = layer.layer_nr == 0 ? options.layer_0_flow_acceleration : options.flow_acceleration;
+    gradual_flow::GCodeState state{
+        .current_flow = target_flow,
+        .flow_acceleration = flow_limit,
+        .flow_deceleration = flow_limit,
+        .discretized_duration = options.discretized_duration,
+        .target_end_flow = target_flow,
+        .reset_flow_duration = options.reset_flow_duration,
+        .flow_step_tolerance = options.flow_step_tolerance,
+    };
+    const auto processed_paths = gradual_flow::coalesceGcodePaths(state.processGcodePaths(gcode_paths));
+
+    // every move is processed into one or more consecutive pieces
+    std::string output;
+    output.reserve(text.size() + text.size() / 8);
+    std::size_t copied = 0;
+    auto processed_path = processed_paths.begin();
+    for (const auto& move : moves)
+    {
+        const auto pieces_begin = processed_path;
+        while (processed_path != processed_paths.end() && processed_path->original_gcode_path_data == move.message)
+        {
+            ++processed_path;
+        }
+        const std::span<const gradual_flow::GCodePath> pieces{ pieces_begin, processed_path };
+        // a path that reaches its target flow gets the speed back from the flow, which can differ in the last bits
+        if (pieces.empty() || (pieces.size() == 1 && std::abs(pieces.front().speed - pieces.front().targetSpeed()) <= 1e-9 * pieces.front().targetSpeed()))
+        {
+            continue;
+        }
+        output.append(text.substr(copied, move.begin - copied));
+        appendPieces(output, move, pieces);
+        copied = move.end;
+    }
+    output.append(text.substr(copied));
+    return output;
+}
+
+/*
+ * Applies the gradual flow to a G-code file.
+ *
+ * The layers are processed in batches of a few layers per thread. The start positions of the layers
+ * of a batch are found first, then the layers are processed in parallel and written in order.
+ */
+inline void processFile(const std::filesystem::path& input_path, const std::filesystem::path& output_path, const Options& options, gradual_flow::WorkerPool& worker_pool)
+{
+    const auto start_time = std::chrono::steady_clock::now();
+    // the input is mapped while the output is written, truncating the output would pull the input from under it
+    std::error_code error;
+    if (std::filesystem::equivalent(input_path, output_path, error))
+    {
+        throw std::runtime_error(fmt::format("{} and {} are the same file, write the output to another file", input_path.string(), output_path.string()));
+    }
+    const MappedFile input{ input_path };
+    const auto layers = splitLayers(input.contents());
+
+    std::ofstream output{ output_path, std::ios::binary };
+    if (! output)
+    {
+        throw std::runtime_error(fmt::format("Failed to create {}", output_path.string()));
+    }
+
+    const auto batch_size = 4 * worker_pool.threadCount();
+    Position position;
+    std::vector<Position> start_positions;
+    std::vector<std::string> layer_outputs;
+    for (std::size_t batch_begin = 0; batch_begin < layers.size(); batch_begin += batch_size)
+    {
+        const auto count = std::min(batch_size, layers.size() - batch_begin);
+        start_positions.resize(count);
+        for (std::size_t index = 0; index < count; ++index)
+        {
+            start_positions[index] = position;
+            position = endPosition(layers[batch_begin + index].text, position);
+        }
+
+        layer_outputs.resize(count);
+        worker_pool.parallelFor(
+            count,
+            [&](const std::size_t index)
+            {
+                layer_outputs[index] = processLayer(layers[batch_begin + index], start_positions[index], options);
+            });
+        for (const auto& layer_output : layer_outputs)
+        {
+            output.write(layer_output.data(), static_cast<std::streamsize>(layer_output.size()));
+        }
+    }
+
+    output.close();
+    if (! output)
+    {
+        throw std::runtime_error(fmt::format("Failed to write {}", output_path.string()));
+    }
+    const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    const auto megabytes = static_cast<double>(input.contents().size()) / 1e6;
+    spdlog::info("Processed {} layers, {:.1f} MB in {:.3f} s ({:.0f} MB/s)", layers.size(), megabytes, seconds, megabytes / std::max(seconds, 1e-9));
+}
+
+} // namespace offline
+
+} // namespace plugin
+
+#endif // PLUGIN_OFFLINE_H
@@ -2,21 +2,31 @@
 #define PLUGIN_PLUGIN_H
 
 #include "plugin/broadcast.h"
+#include "plugin/completion_tokens.h"
 #include "plugin/modify.h"
+#include "plugin/modify_stream.h"
 #include "plugin/handshake.h"
 #include "plugin/metadata.h"
 
 #include <agrpc/asio_grpc.hpp>
 #include <boost/asio/co_spawn.hpp>
-#include <boost/asio/detached.hpp>
+#include <boost/asio/signal_set.hpp>
 #include <fmt/format.h>
+#include <grpc/grpc.h>
 #include <grpcpp/security/server_credentials.h>
 #include <grpcpp/server.h>
 #include <grpcpp/server_builder.h>
 
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <filesystem>
 #include <memory>
 #include <optional>
+#include <stdexcept>
+#include <string>
 #include <string_view>
+#include <system_error>
 #include <utility>
 
 namespace plugin
@@ -31,7 +41,63 @@ public:
 
     Plugin(std::string_view address, std::string_view port, std::shared_ptr<grpc::ServerCredentials> credentials)
     {
-        builder_.AddListeningPort(fmt::format("{}:{}", address, port.data()), std::move(credentials));
+        builder_.AddListeningPort(fmt::format("{}:{}", address, port.data()), std::move(credentials), &selected_port_);
+    }
+
+    /*
+     * Listens on a unix domain socket instead of a TCP port, for an engine on the same host.
+     *
+     * The socket is only accessible by the user running the plugin, and is removed when the plugin
+     * stops. It is bound in a directory next to it that only that user can enter, and only moved to
+     * its path once its permissions are narrowed, so it is never reachable with the permissions the
+     * umask leaves. A socket left behind by a plugin that did not stop cleanly is replaced.
+     *
+     * @param socket_path the path of the socket file
+     */
+    Plugin(const std::filesystem::path& socket_path, std::shared_ptr<grpc::ServerCredentials> credentials)
+        : socket_path_{ socket_path }
+    {
+        if (std::filesystem::exists(std::filesystem::symlink_status(socket_path)))
+        {
+            if (! std::filesystem::is_socket(std::filesystem::symlink_status(socket_path)))
+            {
+                throw std::runtime_error(fmt::format("Cannot listen on {}, the file exists and is not a socket", socket_path.string()));
+            }
+            std::filesystem::remove(socket_path);
+        }
+        private_directory_ = privateDirectory(socket_path);
+        builder_.AddListeningPort(fmt::format("unix:{}", boundSocketPath().string()), std::move(credentials), &selected_port_);
+    }
+
+    /*
+     * Sets the size of the largest message the plugin receives or sends, a layer with more paths
+     * than fit in a single message can only be modified through the streaming service.
+     *
+     * @param max_message_size the size in bytes, -1 for no limit
+     */
+    void setMaxMessageSize(const int max_message_size)
+    {
+        builder_.SetMaxReceiveMessageSize(max_message_size);
+        builder_.SetMaxSendMessageSize(max_message_size);
+    }
+
+    /*
+     * Lets several plugin processes listen on the same address and port, the kernel then spreads
+     * the connections over the processes.
+     *
+     * @param reuse_port whether to listen with SO_REUSEPORT
+     */
+    void setReusePort(const bool reuse_port)
+    {
+        builder_.AddChannelArgument(GRPC_ARG_ALLOW_REUSEPORT, reuse_port ? 1 : 0);
+    }
+
+    /*
+     * @return the port the plugin listens on once started, the port is chosen by the system when it is given as 0
+     */
+    int port() const
+    {
+        return selected_port_;
     }
 
     void addHandshakeService(Handshake&& service)
@@ -52,21 +118,63 @@ public:
         builder_.RegisterService(generate_.value().generate_service.get());
     }
 
+    void addGenerateStreamService(gradual_flow::GenerateStream<G>&& service)
+    {
+        generate_stream_ = std::move(service);
+        builder_.RegisterService(generate_stream_.value().generate_stream_service.get());
+    }
+
     void start()
     {
         server_ = builder_.BuildAndStart();
+        if (server_ == nullptr)
+        {
+            removePrivateDirectory();
+            throw std::runtime_error("Failed to start the plugin server");
+        }
+        if (socket_path_.has_value())
+        {
+            // the socket file is created with the permissions of the umask, narrowing the umask instead would affect all threads
+            std::error_code error;
+            std::filesystem::permissions(boundSocketPath(), std::filesystem::perms::owner_read | std::filesystem::perms::owner_write, std::filesystem::perm_options::replace, error);
+            if (error)
+            {
+                removePrivateDirectory();
+                throw std::runtime_error(fmt::format("Failed to restrict the permissions of {}: {}", socket_path_->string(), error.message()));
+            }
+            std::filesystem::rename(boundSocketPath(), socket_path_.value(), error);
+            removePrivateDirectory();
+            if (error)
+            {
+                throw std::runtime_error(fmt::format("Failed to move the socket to {}: {}", socket_path_->string(), error.message()));
+            }
+        }
     }
 
     void run()
     {
-        boost::asio::co_spawn(context_, handshake_.run(), boost::asio::detached);
+        // stop on SIGINT or SIGTERM as well, so the plugin gets to clean up
+        boost::asio::signal_set signals{ context_, SIGINT, SIGTERM };
+        signals.async_wait(
+            [this](const boost::system::error_code& error, int)
+            {
+                if (! error)
+                {
+                    context_.stop();
+                }
+            });
+        boost::asio::co_spawn(context_, handshake_.run(), recycling_detached);
         if (broadcast.has_value())
         {
-            boost::asio::co_spawn(context_, broadcast.value().run(), boost::asio::detached);
+            boost::asio::co_spawn(context_, broadcast.value().run(), recycling_detached);
         }
         if (generate_.has_value())
         {
-            boost::asio::co_spawn(context_, generate_.value().run(), boost::asio::detached);
+            boost::asio::co_spawn(context_, generate_.value().run(), recycling_detached);
+        }
+        if (generate_stream_.has_value())
+        {
+            boost::asio::co_spawn(context_, generate_stream_.value().run(), recycling_detached);
         }
         context_.run();
     }
@@ -75,14 +183,56 @@ public:
     {
         context_.stop();
         server_->Shutdown();
+        if (socket_path_.has_value())
+        {
+            std::error_code error;
+            std::filesystem::remove(socket_path_.value(), error);
+        }
+        removePrivateDirectory();
     }
 
 private:
+    /*
+     * Creates a directory next to the socket that only the user running the plugin can enter.
+     */
+    static std::filesystem::path privateDirectory(const std::filesystem::path& socket_path)
+    {
+        // kept short, the path of a unix domain socket is limited to about a hundred bytes
+        auto directory_template = (socket_path.parent_path() / ".gfXXXXXX").string();
+        if (::mkdtemp(directory_template.data()) == nullptr)
+        {
+            throw std::system_error(errno, std::generic_category(), fmt::format("Failed to create a directory for {}", socket_path.string()));
+        }
+        return directory_template;
+    }
+
+    /*
+     * @return the path the socket is bound to, in the private directory
+     */
+    std::filesystem::path boundSocketPath() const
+    {
+        return private_directory_.value() / "s";
+    }
+
+    void removePrivateDirectory()
+    {
+        if (private_directory_.has_value())
+        {
+            std::error_code error;
+            std::filesystem::remove_all(private_directory_.value(), error);
+            private_directory_.reset();
+        }
+    }
+
     grpc::ServerBuilder builder_{};
     agrpc::GrpcContext context_{ builder_.AddCompletionQueue() };
     std::unique_ptr<grpc::Server> server_;
     Handshake handshake_;
     std::optional<G> generate_;
+    std::optional<gradual_flow::GenerateStream<G>> generate_stream_;
+    int selected_port_{ 0 };
+    std::optional<std::filesystem::path> socket_path_;
+    std::optional<std::filesystem::path> private_directory_; // until the socket is moved to its path
 };
 
 
@@ -0,0 +1,170 @@
+#ifndef PLUGIN_PRINT_TIME_IMPACT_H
+#define PLUGIN_PRINT_TIME_IMPACT_H
+
+#include "gradual_flow/gcode_path.h"
+
+#include <spdlog/spdlog.h>
+
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace plugin
+{
+
+/*
+ * How much the gradual flow lengthens the extrusion of one or more layers. Travels are not counted,
+ * the gradual flow does not change them.
+ */
+struct PrintTimeImpact
+{
+    std::size_t layers{ 0 };
+    double original_duration{ 0.0 }; // s, of the extruding paths at their target speed
+    double modified_duration{ 0.0 }; // s, of the extruding paths as returned
+    std::size_t original_paths{ 0 }; // extruding paths in the requests
+    std::size_t modified_paths{ 0 }; // extruding paths in the responses
+
+    void addOriginal(const gradual_flow::GCodePath& path)
+    {
+        if (! path.isTravel())
+        {
+            original_duration += path.total_length / path.targetSpeed();
+            original_paths++;
+        }
+    }
+
+    void addModified(const gradual_flow::GCodePath& path)
+    {
+        if (! path.isTravel())
+        {
+            modified_duration += path.totalDuration();
+            modified_paths++;
+        }
+    }
+
+    PrintTimeImpact& operator+=(const PrintTimeImpact& other)
+    {
+        layers += other.layers;
+        original_duration += other.original_duration;
+        modified_duration += other.modified_duration;
+        original_paths += other.original_paths;
+        modified_paths += other.modified_paths;
+        return *this;
+    }
+
+    double addedDuration() const // s
+    {
+        return modified_duration - original_duration;
+    }
+
+    /*
+     * @return the added duration relative to the original duration
+     */
+    double addedFraction() const
+    {
+        return original_duration > 0.0 ? addedDuration() / original_duration : 0.0;
+    }
+
+    /*
+     * @return the number of paths added by splitting paths into the pieces of a ramp
+     */
+    std::size_t splitPaths() const
+    {
+        return modified_paths > original_paths ? modified_paths - original_paths : 0;
+    }
+};
+
+/*
+ * Returns the impact of the gradual flow on a layer.
+ *
+ * @param original_paths the paths of the request
+ * @param modified_paths the paths of the response
+ */
+inline PrintTimeImpact printTimeImpact(const std::vector<gradual_flow::GCodePath>& original_paths, const std::vector<gradual_flow::GCodePath>& modified_paths)
+{
+    PrintTimeImpact impact{ .layers = 1 };
+    for (const auto& path : original_paths)
+    {
+        impact.addOriginal(path);
+    }
+    for (const auto& path : modified_paths)
+    {
+        impact.addModified(path);
+    }
+    return impact;
+}
+
+/*
+ * Adds up the impact of the gradual flow on the layers of every engine session, so it can be compared
+ * between printer profiles and settings.
+ */
+class PrintTimeImpacts
+{
+public:
+    void add(const std::string& session, const PrintTimeImpact& impact)
+    {
+        std::lock_guard lock{ mutex_ };
+        impacts_[session] += impact;
+    }
+
+    std::optional<PrintTimeImpact> find(const std::string& session) const
+    {
+        std::lock_guard lock{ mutex_ };
+        const auto it = impacts_.find(session);
+        if (it == impacts_.end())
+        {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    /*
+     * Logs the impact on the layers of a session and forgets the session.
+     */
+    void erase(const std::string& session)
+    {
+        std::lock_guard lock{ mutex_ };
+        const auto it = impacts_.find(session);
+        if (it == impacts_.end())
+        {
+            return;
+        }
+        log(session, it->second);
+        impacts_.erase(it);
+    }
+
+    /*
+     * Logs the impact on the layers of every session.
+     */
+    void report() const
+    {
+        std::lock_guard lock{ mutex_ };
+        for (const auto& [session, impact] : impacts_)
+        {
+            log(session, impact);
+        }
+    }
+
+private:
+    static void log(const std::string& session, const PrintTimeImpact& impact)
+    {
+        spdlog::info(
+            "Session {}: gradual flow adds {:.3f} s ({:.2f}%) to {:.3f} s of extrusion in {} layers, splitting off {} paths",
+            session,
+            impact.addedDuration(),
+            impact.addedFraction() * 100.,
+            impact.original_duration,
+            impact.layers,
+            impact.splitPaths());
+    }
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, PrintTimeImpact> impacts_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_PRINT_TIME_IMPACT_H
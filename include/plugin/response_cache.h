@@ -0,0 +1,266 @@
+#ifndef PLUGIN_RESPONSE_CACHE_H
+#define PLUGIN_RESPONSE_CACHE_H
+
+#include "gradual_flow/gcode_path.h"
+#include "plugin/flow_timeline.h"
+#include "plugin/metrics.h"
+#include "plugin/print_time_impact.h"
+
+#include <google/protobuf/repeated_ptr_field.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace plugin
+{
+
+/*
+ * Identifies the result of a modify request: the content of the paths and everything that
+ * influences how they are processed.
+ *
+ * The paths are compared byte for byte, the hash only picks the bucket; two layers with the same
+ * hash never share a response.
+ */
+struct ResponseCacheKey
+{
+    std::uint64_t gcode_paths_hash{ 0 }; // of gcode_paths, compared first
+    std::string gcode_paths; // serialized, see serializeMessages
+    std::int64_t extruder_nr{ 0 };
+    bool initial_layer{ false };
+    double flow_acceleration{ 0.0 }; // um^3/s^2
+    double discretized_duration{ 0.0 }; // s
+    double reset_flow_duration{ 0.0 }; // s
+    double flow_step_tolerance{ 0.0 }; // um^3/s
+    bool time_optimal_ramps{ false };
+    std::optional<gradual_flow::LayerFlowState> start_flow_state;
+    std::optional<gradual_flow::FeaturePolicies> feature_policies;
+
+    bool operator==(const ResponseCacheKey&) const = default;
+};
+
+/*
+ * The response to a modify request, together with the flow state the next layer continues from and
+ * how much the response lengthens the layer.
+ */
+template<class Rsp>
+struct LayerResponse
+{
+    Rsp response;
+    gradual_flow::LayerFlowState end_flow_state;
+    PrintTimeImpact print_time_impact;
+    // when the flow timeline is recorded; the paths of the response no longer tell which path of the
+    // request they belong to, so a layer answered from the cache is recorded from these rows
+    FlowTimelineRows timeline_rows;
+};
+
+struct ResponseCacheKeyHash
+{
+    std::size_t operator()(const ResponseCacheKey& key) const noexcept
+    {
+        auto hash = key.gcode_paths_hash;
+        const auto combine = [&hash](const std::size_t value)
+        {
+            hash ^= value + 0x9e3779b97f4a7c15ULL + (hash << 6U) + (hash >> 2U);
+        };
+        combine(std::hash<std::int64_t>{}(key.extruder_nr));
+        combine(std::hash<bool>{}(key.initial_layer));
+        combine(std::hash<double>{}(key.flow_acceleration));
+        combine(std::hash<double>{}(key.discretized_duration));
+        combine(std::hash<double>{}(key.reset_flow_duration));
+        combine(std::hash<double>{}(key.flow_step_tolerance));
+        combine(std::hash<bool>{}(key.time_optimal_ramps));
+        if (key.start_flow_state.has_value())
+        {
+            combine(std::hash<double>{}(key.start_flow_state->flow));
+            combine(std::hash<double>{}(key.start_flow_state->discretized_duration_remaining));
+            combine(std::hash<int>{}(static_cast<int>(key.start_flow_state->flow_state)));
+        }
+        if (key.feature_policies.has_value())
+        {
+            for (const auto& policy : *key.feature_policies)
+            {
+                combine(std::hash<bool>{}(policy.exempt));
+                combine(std::hash<double>{}(policy.flow_acceleration));
+            }
+        }
+        return hash;
+    }
+};
+
+/*
+ * MurmurHash64A, hashes 8 bytes per step.
+ */
+inline std::uint64_t hashBytes(const std::string_view data, const std::uint64_t seed = 0)
+{
+    constexpr std::uint64_t m = 0xc6a4a7935bd1e995ULL;
+    constexpr int r = 47;
+
+    auto hash = seed ^ (data.size() * m);
+    const auto* bytes = data.data();
+    const auto block_count = data.size() / 8;
+    for (std::size_t i = 0; i < block_count; ++i)
+    {
+        std::uint64_t k;
+        std::memcpy(&k, bytes + i * 8, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        hash ^= k;
+        hash *= m;
+    }
+
+    const auto* tail = reinterpret_cast<const unsigned char*>(bytes + block_count * 8);
+    switch (data.size() & 7U)
+    {
+    case 7:
+        hash ^= std::uint64_t{ tail[6] } << 48U;
+        [[fallthrough]];
+    case 6:
+        hash ^= std::uint64_t{ tail[5] } << 40U;
+        [[fallthrough]];
+    case 5:
+        hash ^= std::uint64_t{ tail[4] } << 32U;
+        [[fallthrough]];
+    case 4:
+        hash ^= std::uint64_t{ tail[3] } << 24U;
+        [[fallthrough]];
+    case 3:
+        hash ^= std::uint64_t{ tail[2] } << 16U;
+        [[fallthrough]];
+    case 2:
+        hash ^= std::uint64_t{ tail[1] } << 8U;
+        [[fallthrough]];
+    case 1:
+        hash ^= std::uint64_t{ tail[0] };
+        hash *= m;
+        [[fallthrough]];
+    default:
+        break;
+    }
+
+    hash ^= hash >> r;
+    hash *= m;
+    hash ^= hash >> r;
+    return hash;
+}
+
+/*
+ * Serializes every message in the range, in order. Every message is preceded by its size; protobuf
+ * messages are not delimited, so without it two messages could serialize to the same bytes as one.
+ *
+ * @return the serialized messages
+ */
+template<class Msg>
+std::string serializeMessages(const google::protobuf::RepeatedPtrField<Msg>& messages)
+{
+    std::string bytes;
+    for (const auto& message : messages)
+    {
+        const auto size = static_cast<std::uint64_t>(message.ByteSizeLong());
+        bytes.append(reinterpret_cast<const char*>(&size), sizeof(size));
+        message.AppendToString(&bytes);
+    }
+    return bytes;
+}
+
+/*
+ * A least recently used cache of modify responses, limited by the memory the stored responses use.
+ */
+template<class Rsp>
+class ResponseCache
+{
+public:
+    using response_t = std::shared_ptr<const LayerResponse<Rsp>>;
+
+    /*
+     * @param capacity maximum number of bytes used by the cached responses, 0 disables the cache
+     * @param metrics the metrics to count hits, misses and evictions in
+     */
+    explicit ResponseCache(const std::size_t capacity = 0, std::shared_ptr<Metrics> metrics = std::make_shared<Metrics>())
+        : capacity_{ capacity }
+        , metrics_{ std::move(metrics) }
+    {
+    }
+
+    bool enabled() const
+    {
+        return capacity_ > 0;
+    }
+
+    response_t find(const ResponseCacheKey& key)
+    {
+        std::lock_guard lock{ mutex_ };
+        const auto it = index_.find(key);
+        if (it == index_.end())
+        {
+            metrics_->cache_misses++;
+            return nullptr;
+        }
+        metrics_->cache_hits++;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->response;
+    }
+
+    void insert(ResponseCacheKey key, response_t response)
+    {
+        const auto size = response->response.SpaceUsedLong() + response->timeline_rows.bytes() + key.gcode_paths.capacity() + sizeof(LayerResponse<Rsp>) + sizeof(ResponseCacheKey)
+                        + sizeof(Entry);
+        if (size > capacity_)
+        {
+            return;
+        }
+
+        std::lock_guard lock{ mutex_ };
+        if (const auto it = index_.find(key); it != index_.end())
+        {
+            erase(it->second);
+        }
+        while (size_ + size > capacity_)
+        {
+            erase(std::prev(entries_.end()));
+            metrics_->cache_evictions++;
+        }
+        const auto index_entry = index_.emplace(std::move(key), entries_.end()).first;
+        entries_.emplace_front(Entry{ .key = &index_entry->first, .response = std::move(response), .size = size });
+        index_entry->second = entries_.begin();
+        size_ += size;
+        metrics_->cache_bytes = size_;
+    }
+
+private:
+    struct Entry
+    {
+        const ResponseCacheKey* key{ nullptr }; // owned by the index, the paths are only kept once
+        response_t response;
+        std::size_t size{ 0 }; // bytes
+    };
+
+    void erase(const typename std::list<Entry>::iterator entry)
+    {
+        size_ -= entry->size;
+        index_.erase(index_.find(*entry->key));
+        entries_.erase(entry);
+        metrics_->cache_bytes = size_;
+    }
+
+    std::size_t capacity_;
+    std::size_t size_{ 0 };
+    std::shared_ptr<Metrics> metrics_;
+    std::mutex mutex_;
+    std::list<Entry> entries_;
+    std::unordered_map<ResponseCacheKey, typename std::list<Entry>::iterator, ResponseCacheKeyHash> index_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_RESPONSE_CACHE_H
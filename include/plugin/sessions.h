@@ -0,0 +1,243 @@
+#ifndef PLUGIN_SESSIONS_H
+#define PLUGIN_SESSIONS_H
+
+#include "plugin/metrics.h"
+#include "plugin/settings.h"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace plugin
+{
+
+/*
+ * The settings of every engine session, keyed by cura-engine-uuid.
+ *
+ * A session is only ever ended implicitly, by the engine no longer calling the plugin. Sessions
+ * that were not seen for the time to live are evicted, and so are the least recently seen sessions
+ * once their settings exceed the memory budget. Other state of a session, such as the flow state
+ * of its last layer, is released by the functions registered with onEvict().
+ */
+class Sessions
+{
+public:
+    using clock_t = std::chrono::steady_clock;
+
+    /*
+     * @param time_to_live how long a session is kept after it was last seen
+     * @param memory_budget the memory the settings of all sessions may use, in bytes
+     */
+    explicit Sessions(
+        const clock_t::duration time_to_live = std::chrono::hours{ 1 },
+        const std::size_t memory_budget = 16 * 1024 * 1024,
+        std::shared_ptr<Metrics> metrics = std::make_shared<Metrics>())
+        : time_to_live_{ time_to_live }
+        , memory_budget_{ memory_budget }
+        , metrics_{ std::move(metrics) }
+    {
+    }
+
+    /*
+     * Registers a function that releases the other state of a session once it is evicted.
+     */
+    void onEvict(std::function<void(const std::string&)> release)
+    {
+        std::lock_guard lock{ mutex_ };
+        release_.emplace_back(std::move(release));
+    }
+
+    void insert_or_assign(const std::string& session, Settings settings, const clock_t::time_point now = clock_t::now())
+    {
+        std::vector<std::string> evicted;
+        {
+            std::lock_guard lock{ mutex_ };
+            if (const auto it = sessions_.find(session); it != sessions_.end())
+            {
+                erase(it);
+            }
+            least_recently_seen_.push_front(session);
+            const auto bytes = memoryUse(session, settings);
+            sessions_.emplace(session, Session{ .settings = std::move(settings), .last_seen = now, .bytes = bytes, .position = least_recently_seen_.begin() });
+            bytes_ += bytes;
+            evicted = evict(now);
+        }
+        release(evicted);
+    }
+
+    /*
+     * Returns the settings of a session and marks the session as seen.
+     *
+     * @return the settings, or nothing when the session is unknown, or was evicted
+     */
+    std::optional<Settings> find(const std::string& session, const clock_t::time_point now = clock_t::now())
+    {
+        std::vector<std::string> evicted;
+        std::optional<Settings> settings;
+        {
+            std::lock_guard lock{ mutex_ };
+            evicted = evict(now);
+            const auto it = sessions_.find(session);
+            if (it != sessions_.end())
+            {
+                it->second.last_seen = now;
+                least_recently_seen_.splice(least_recently_seen_.begin(), least_recently_seen_, it->second.position);
+                settings = it->second.settings;
+            }
+        }
+        release(evicted);
+        return settings;
+    }
+
+    /*
+     * Returns the settings of a session and marks the session as seen.
+     *
+     * @throws std::out_of_range when the session is unknown, or was evicted
+     */
+    Settings at(const std::string& session, const clock_t::time_point now = clock_t::now())
+    {
+        auto settings = find(session, now);
+        if (! settings.has_value())
+        {
+            throw std::out_of_range(fmt::format("No settings were broadcast for session {}, or the session expired", session));
+        }
+        return std::move(settings.value());
+    }
+
+    bool contains(const std::string& session) const
+    {
+        std::lock_guard lock{ mutex_ };
+        return sessions_.contains(session);
+    }
+
+    std::size_t size() const
+    {
+        std::lock_guard lock{ mutex_ };
+        return sessions_.size();
+    }
+
+    /*
+     * @return the estimated memory use of the settings of all sessions, in bytes
+     */
+    std::size_t bytes() const
+    {
+        std::lock_guard lock{ mutex_ };
+        return bytes_;
+    }
+
+private:
+    struct Session
+    {
+        Settings settings;
+        clock_t::time_point last_seen;
+        std::size_t bytes{ 0 };
+        std::list<std::string>::iterator position; // in least_recently_seen_
+    };
+
+    /*
+     * Estimates the memory use of a session, with the values per extruder of every setting in the
+     * settings schema; the global settings are part of the Session itself.
+     */
+    static std::size_t memoryUse(const std::string& session, const Settings& settings)
+    {
+        std::size_t doubles = 0;
+        std::size_t bools = 0;
+        for (const auto& schema : settings_schema)
+        {
+            if (schema.flags != nullptr)
+            {
+                bools += (settings.*schema.flags).capacity();
+            }
+            if (schema.numbers != nullptr)
+            {
+                doubles += (settings.*schema.numbers).capacity();
+            }
+        }
+        // the key is stored in the map and in the recency list
+        return sizeof(Session) + 2 * (sizeof(std::string) + session.capacity()) + doubles * sizeof(double) + bools / 8;
+    }
+
+    void erase(const std::unordered_map<std::string, Session>::iterator it)
+    {
+        bytes_ -= it->second.bytes;
+        least_recently_seen_.erase(it->second.position);
+        sessions_.erase(it);
+    }
+
+    /*
+     * Evicts the expired sessions, then the least recently seen ones while over the memory budget;
+     * the most recently seen session is always kept.
+     *
+     * @return the evicted sessions
+     */
+    std::vector<std::string> evict(const clock_t::time_point now)
+    {
+        std::vector<std::string> evicted;
+        while (! least_recently_seen_.empty())
+        {
+            const auto it = sessions_.find(least_recently_seen_.back());
+            const auto expired = now - it->second.last_seen > time_to_live_;
+            const auto over_budget = bytes_ > memory_budget_ && sessions_.size() > 1;
+            if (! expired && ! over_budget)
+            {
+                break;
+            }
+            spdlog::info("Evicting session {}, last seen {} s ago", it->first, std::chrono::duration_cast<std::chrono::seconds>(now - it->second.last_seen).count());
+            evicted.push_back(it->first);
+            erase(it);
+        }
+        metrics_->evicted_sessions += evicted.size();
+        metrics_->active_sessions = sessions_.size();
+        metrics_->session_bytes = bytes_;
+        return evicted;
+    }
+
+    /*
+     * Releases the other state of the evicted sessions, outside of the lock so the release
+     * functions can use the sessions as well.
+     */
+    void release(const std::vector<std::string>& evicted) const
+    {
+        if (evicted.empty())
+        {
+            return;
+        }
+        std::vector<std::function<void(const std::string&)>> release;
+        {
+            std::lock_guard lock{ mutex_ };
+            release = release_;
+        }
+        for (const auto& session : evicted)
+        {
+            for (const auto& release_session : release)
+            {
+                release_session(session);
+            }
+        }
+    }
+
+    clock_t::duration time_to_live_;
+    std::size_t memory_budget_;
+    std::shared_ptr<Metrics> metrics_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Session> sessions_;
+    std::list<std::string> least_recently_seen_; // most recently seen first
+    std::size_t bytes_{ 0 };
+    std::vector<std::function<void(const std::string&)>> release_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_SESSIONS_H
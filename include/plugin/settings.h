@@ -5,16 +5,26 @@
 #include "cura/plugins/slots/handshake/v0/handshake.grpc.pb.h"
 #include "plugin/metadata.h"
 
+#include <fmt/format.h>
+#include <fmt/ranges.h>
 #include <range/v3/all.hpp>
+#include <spdlog/spdlog.h>
 
 #include <algorithm>
+#include <array>
 #include <cctype>
 #include <ctre.hpp>
 #include <locale>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <semver.hpp>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 namespace plugin
 {
@@ -26,71 +36,26 @@ struct Settings
     std::vector<double> max_flow_acceleration;
     std::vector<double> layer_0_max_flow_acceleration;
     std::vector<double> gradual_flow_discretisation_step_size;
+    std::vector<bool> gradual_flow_adaptive_discretisation;
+    std::vector<double> gradual_flow_discretisation_tolerance;
+    std::vector<bool> gradual_flow_time_optimal_ramps;
+    std::vector<bool> gradual_flow_inner_wall_exempt;
+    std::vector<double> gradual_flow_inner_wall_max_flow_acceleration;
+    std::vector<bool> gradual_flow_skin_exempt;
+    std::vector<double> gradual_flow_skin_max_flow_acceleration;
+    std::vector<bool> gradual_flow_infill_exempt;
+    std::vector<double> gradual_flow_infill_max_flow_acceleration;
+    std::vector<bool> gradual_flow_support_exempt;
+    std::vector<double> gradual_flow_support_max_flow_acceleration;
     double reset_flow_duration { 0.0};
 
-    explicit Settings(const cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest& request, const std::shared_ptr<Metadata>& metadata)
-        : metadata{ metadata }
-    {
-        for (const auto& [idx, extruder_setting] : request.extruder_settings() | ranges::views::enumerate)
-        {
-            const auto gradual_flow_enabled_setting = retrieveSettings("gradual_flow_enabled", extruder_setting, metadata);
-            const auto max_flow_acceleration_setting = retrieveSettings("max_flow_acceleration", extruder_setting, metadata);
-            const auto layer_0_max_flow_acceleration_setting = retrieveSettings("layer_0_max_flow_acceleration", extruder_setting, metadata);
-            const auto gradual_flow_discretisation_step_size_setting = retrieveSettings("gradual_flow_discretisation_step_size", extruder_setting, metadata);
-
-            if (! gradual_flow_enabled_setting.has_value() || ! max_flow_acceleration_setting.has_value() || ! layer_0_max_flow_acceleration_setting.has_value()
-                || ! gradual_flow_discretisation_step_size_setting.has_value())
-            {
-                spdlog::error(
-                    "Extruder: {} <gradual_flow_enabled: {}, max_flow_acceleration: {}, layer_0_max_flow_acceleration: {}, gradual_flow_discretisation_step_size: {}>",
-                    idx,
-                    gradual_flow_enabled_setting.has_value(),
-                    max_flow_acceleration_setting.has_value(),
-                    layer_0_max_flow_acceleration_setting.has_value(),
-                    gradual_flow_discretisation_step_size_setting.has_value());
-                throw std::runtime_error(fmt::format(
-                    "Extruder: {} <gradual_flow_enabled: {}, max_flow_acceleration: {}, layer_0_max_flow_acceleration: {}, gradual_flow_discretisation_step_size: {}>",
-                    idx,
-                    gradual_flow_enabled_setting.has_value(),
-                    max_flow_acceleration_setting.has_value(),
-                    layer_0_max_flow_acceleration_setting.has_value(),
-                    gradual_flow_discretisation_step_size_setting.has_value()));
-            }
-            gradual_flow_enabled.emplace_back(gradual_flow_enabled_setting.value() == "True" || gradual_flow_enabled_setting.value() == "true");
-            max_flow_acceleration.emplace_back(std::stod(max_flow_acceleration_setting.value()) * 1e9);
-            layer_0_max_flow_acceleration.emplace_back(std::stod(layer_0_max_flow_acceleration_setting.value()) * 1e9);
-            gradual_flow_discretisation_step_size.emplace_back(std::stod(gradual_flow_discretisation_step_size_setting.value()));
-        }
-        reset_flow_duration = std::stod(retrieveSettings("reset_flow_duration", request, metadata).value());
-    }
-
-    [[maybe_unused]] static std::optional<std::string> retrieveSettings(const std::string& settings_key, const cura::plugins::slots::broadcast::v0::Settings& settings, const auto& metadata)
-    {
-        const auto settings_key_ = settingKey(settings_key, metadata->plugin_name, metadata->plugin_version);
-        if (settings.settings().contains(settings_key_))
-        {
-            return settings.settings().at(settings_key_);
-        }
-
-        return std::nullopt;
-    }
-
-    [[maybe_unused]] static std::optional<std::string> retrieveSettings(
-        const std::string& settings_key,
-        const size_t extruder_nr,
-        const cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest& request,
-        const auto& metadata)
-    {
-        const auto& settings = request.extruder_settings().at(static_cast<int>(extruder_nr));
-        return retrieveSettings(settings_key, settings, metadata);
-    }
-
-    [[maybe_unused]] static std::optional<std::string>
-        retrieveSettings(const std::string& settings_key, const cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest& request, const auto& metadata)
-    {
-        const auto& global_settings = request.global_settings();
-        return retrieveSettings(settings_key, global_settings, metadata);
-    }
+    /*
+     * Reads the settings of the plugin from a broadcast, as described by settings_schema. All invalid
+     * and missing settings are reported together.
+     *
+     * @throws std::runtime_error when a required setting is missing or a setting has an invalid value
+     */
+    explicit Settings(const cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest& request, const std::shared_ptr<Metadata>& metadata);
 
     static bool validatePlugin(const cura::plugins::slots::handshake::v0::CallRequest& request, const std::shared_ptr<Metadata>& metadata)
     {
@@ -115,6 +80,181 @@ struct Settings
     }
 };
 
+/*
+ * Describes how a setting of the plugin is read from a broadcast into Settings. An extruder setting
+ * has a value per extruder, a global setting a single value.
+ */
+struct SettingSchema
+{
+    enum class Type
+    {
+        Bool, // "True" or "False"
+        Number, // a number in the unit of the setting
+        Choice, // one of the options of an enum setting
+    };
+
+    std::string_view key;
+    Type type{ Type::Number };
+    bool required{ false }; // an optional setting that is missing is false or 0.0
+    std::vector<bool> Settings::*flags{ nullptr }; // for extruder Bool and Choice settings
+    std::vector<double> Settings::*numbers{ nullptr }; // for extruder Number settings
+    double Settings::*number{ nullptr }; // for global Number settings
+    double scale{ 1.0 }; // from the unit of the setting to the unit used by the plugin
+    std::string_view choice{}; // the option of a Choice setting that sets the flag
+    std::string_view unit{};
+};
+
+/*
+ * All settings of the plugin, see CuraEngineGradualFlow/gradual_flow_settings.def.json. A new
+ * setting only needs a field in Settings and an entry here.
+ */
+inline constexpr std::array settings_schema{
+    SettingSchema{ .key = "gradual_flow_enabled", .type = SettingSchema::Type::Bool, .required = true, .flags = &Settings::gradual_flow_enabled },
+    SettingSchema{ .key = "max_flow_acceleration", .required = true, .numbers = &Settings::max_flow_acceleration, .scale = 1e9, .unit = "mm³/s²" },
+    SettingSchema{ .key = "layer_0_max_flow_acceleration", .required = true, .numbers = &Settings::layer_0_max_flow_acceleration, .scale = 1e9, .unit = "mm³/s²" },
+    SettingSchema{ .key = "gradual_flow_discretisation_step_size", .required = true, .numbers = &Settings::gradual_flow_discretisation_step_size, .unit = "s" },
+    SettingSchema{ .key = "gradual_flow_discretisation_mode",
+                   .type = SettingSchema::Type::Choice,
+                   .flags = &Settings::gradual_flow_adaptive_discretisation,
+                   .choice = "adaptive" },
+    SettingSchema{ .key = "gradual_flow_discretisation_tolerance", .numbers = &Settings::gradual_flow_discretisation_tolerance, .scale = 1e9, .unit = "mm³/s" },
+    SettingSchema{ .key = "gradual_flow_ramp_planner", .type = SettingSchema::Type::Choice, .flags = &Settings::gradual_flow_time_optimal_ramps, .choice = "time_optimal" },
+    SettingSchema{ .key = "gradual_flow_inner_wall_policy", .type = SettingSchema::Type::Choice, .flags = &Settings::gradual_flow_inner_wall_exempt, .choice = "exempt" },
+    SettingSchema{ .key = "gradual_flow_inner_wall_max_flow_acceleration", .numbers = &Settings::gradual_flow_inner_wall_max_flow_acceleration, .scale = 1e9, .unit = "mm³/s²" },
+    SettingSchema{ .key = "gradual_flow_skin_policy", .type = SettingSchema::Type::Choice, .flags = &Settings::gradual_flow_skin_exempt, .choice = "exempt" },
+    SettingSchema{ .key = "gradual_flow_skin_max_flow_acceleration", .numbers = &Settings::gradual_flow_skin_max_flow_acceleration, .scale = 1e9, .unit = "mm³/s²" },
+    SettingSchema{ .key = "gradual_flow_infill_policy", .type = SettingSchema::Type::Choice, .flags = &Settings::gradual_flow_infill_exempt, .choice = "exempt" },
+    SettingSchema{ .key = "gradual_flow_infill_max_flow_acceleration", .numbers = &Settings::gradual_flow_infill_max_flow_acceleration, .scale = 1e9, .unit = "mm³/s²" },
+    SettingSchema{ .key = "gradual_flow_support_policy", .type = SettingSchema::Type::Choice, .flags = &Settings::gradual_flow_support_exempt, .choice = "exempt" },
+    SettingSchema{ .key = "gradual_flow_support_max_flow_acceleration", .numbers = &Settings::gradual_flow_support_max_flow_acceleration, .scale = 1e9, .unit = "mm³/s²" },
+    SettingSchema{ .key = "reset_flow_duration", .required = true, .number = &Settings::reset_flow_duration, .unit = "s" },
+};
+
+/*
+ * Returns the full keys of settings_schema, in the same order. The keys only depend on the name and
+ * version of the plugin, so they are built once instead of on every broadcast.
+ */
+inline const std::vector<std::string>& settingKeys(const Metadata& metadata)
+{
+    static std::mutex mutex;
+    static std::map<std::pair<std::string, std::string>, std::vector<std::string>> setting_keys;
+
+    std::lock_guard lock{ mutex };
+    auto [it, inserted] = setting_keys.try_emplace({ std::string{ metadata.plugin_name }, std::string{ metadata.plugin_version } });
+    if (inserted)
+    {
+        for (const auto& schema : settings_schema)
+        {
+            it->second.push_back(Settings::settingKey(schema.key, metadata.plugin_name, metadata.plugin_version));
+        }
+    }
+    return it->second;
+}
+
+/*
+ * Reads a single setting, a missing optional setting is false or 0.0.
+ *
+ * @param extruder the extruder the settings are of, none for the global settings
+ * @param errors receives the reason when the setting is missing or invalid
+ * @return the value, a flag is 0.0 or 1.0
+ */
+inline double parseSetting(
+    const SettingSchema& schema,
+    const std::string& key,
+    const cura::plugins::slots::broadcast::v0::Settings& settings,
+    const std::optional<std::size_t> extruder,
+    std::vector<std::string>& errors)
+{
+    // only formatted for an error, settings are read for every extruder on every broadcast
+    const auto scope = [extruder]
+    {
+        return extruder.has_value() ? fmt::format("extruder {}", extruder.value()) : std::string{ "global" };
+    };
+
+    const auto it = settings.settings().find(key);
+    if (it == settings.settings().end())
+    {
+        if (schema.required)
+        {
+            errors.push_back(fmt::format("{}: {} is missing", scope(), schema.key));
+        }
+        return 0.0;
+    }
+
+    const auto& value = it->second;
+    switch (schema.type)
+    {
+    case SettingSchema::Type::Bool:
+        if (value == "True" || value == "true")
+        {
+            return 1.0;
+        }
+        if (value != "False" && value != "false")
+        {
+            errors.push_back(fmt::format("{}: {} is '{}', not True or False", scope(), schema.key, value));
+        }
+        return 0.0;
+    case SettingSchema::Type::Choice:
+        return value == schema.choice ? 1.0 : 0.0;
+    case SettingSchema::Type::Number:
+        try
+        {
+            std::size_t parsed_size{ 0 };
+            const auto number = std::stod(value, &parsed_size);
+            if (parsed_size == value.size())
+            {
+                return number * schema.scale;
+            }
+        }
+        catch (const std::logic_error&)
+        {
+        }
+        errors.push_back(fmt::format("{}: {} is '{}', not a number in {}", scope(), schema.key, value, schema.unit));
+        return 0.0;
+    }
+    return 0.0;
+}
+
+inline Settings::Settings(const cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest& request, const std::shared_ptr<Metadata>& metadata)
+    : metadata{ metadata }
+{
+    const auto& keys = settingKeys(*metadata);
+    std::vector<std::string> errors;
+    for (const auto& [schema_idx, schema] : settings_schema | ranges::views::enumerate)
+    {
+        const auto& key = keys[schema_idx];
+        if (schema.number != nullptr)
+        {
+            this->*schema.number = parseSetting(schema, key, request.global_settings(), std::nullopt, errors);
+            continue;
+        }
+        for (const auto& [idx, extruder_setting] : request.extruder_settings() | ranges::views::enumerate)
+        {
+            const auto value = parseSetting(schema, key, extruder_setting, static_cast<std::size_t>(idx), errors);
+            if (schema.flags != nullptr)
+            {
+                (this->*schema.flags).push_back(value != 0.0);
+            }
+            else
+            {
+                (this->*schema.numbers).push_back(value);
+            }
+        }
+    }
+
+    // adaptive discretisation needs a tolerance, without it the fixed step size is used
+    for (std::size_t idx = 0; idx < gradual_flow_adaptive_discretisation.size(); ++idx)
+    {
+        gradual_flow_adaptive_discretisation[idx] = gradual_flow_adaptive_discretisation[idx] && gradual_flow_discretisation_tolerance[idx] > 0.0;
+    }
+
+    if (! errors.empty())
+    {
+        spdlog::error("Invalid settings: {}", fmt::join(errors, "; "));
+        throw std::runtime_error(fmt::format("Invalid settings: {}", fmt::join(errors, "; ")));
+    }
+}
+
 using settings_t = std::unordered_map<std::string, Settings>;
 
 } // namespace plugin
@@ -0,0 +1,582 @@
+#ifndef PLUGIN_SHARED_MEMORY_H
+#define PLUGIN_SHARED_MEMORY_H
+
+#include "cura/plugins/v0/gcodepath.pb.h"
+
+#include <fmt/format.h>
+#include <google/protobuf/repeated_ptr_field.h>
+#include <grpcpp/server_context.h>
+#include <range/v3/view/enumerate.hpp>
+
+#if ! defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace plugin
+{
+
+/*
+ * Moves the points of the paths of a layer through shared memory instead of through the messages.
+ *
+ * The engine creates a POSIX shared memory region and uses it as a ring buffer of blocks. For a
+ * modify call it writes the points of the layer into a block in a compact binary layout, clears
+ * the points from the request, and names the region and the block in the client metadata. The
+ * request then only carries the path attributes. If the modified points fit in the block the plugin
+ * writes them back into it, clears them from the response and confirms this in the trailing
+ * metadata; otherwise the response carries the points as usual. The engine releases the block once
+ * it has read the response.
+ *
+ * The plugin only opens regions named after the session of the call, see regionName(), that belong
+ * to the user running the plugin and that no other user can access.
+ *
+ * The layout of a block, native endianness, every field 8 byte aligned from the start of the block:
+ *   uint64 sequence     the sequence number of the call, also sent in the metadata
+ *   uint64 path_count
+ *   uint64 point_count  of every path
+ *   int64  x, y         of every point of every path, in order
+ */
+namespace shared_memory
+{
+
+constexpr std::string_view name_key{ "gradual-flow-shm-name" };
+constexpr std::string_view offset_key{ "gradual-flow-shm-offset" };
+constexpr std::string_view size_key{ "gradual-flow-shm-size" };
+constexpr std::string_view sequence_key{ "gradual-flow-shm-sequence" };
+constexpr std::string_view response_key{ "gradual-flow-shm-response" }; // trailing metadata, set when the points are written back
+
+/*
+ * @return whether the character can be part of the session or the suffix in a region name
+ */
+constexpr bool isNameCharacter(const char character)
+{
+    return (character >= '0' && character <= '9') || (character >= 'a' && character <= 'z') || (character >= 'A' && character <= 'Z') || character == '-';
+}
+
+/*
+ * @param session the cura-engine-uuid of the engine session
+ * @param suffix distinguishes several regions of a session, may be empty
+ * @return the name of a shared memory region of the session
+ */
+inline std::string regionName(const std::string_view session, const std::string_view suffix = {})
+{
+    if (session.empty() || ! std::ranges::all_of(session, isNameCharacter) || ! std::ranges::all_of(suffix, isNameCharacter))
+    {
+        throw std::invalid_argument(fmt::format("Session {} cannot name a shared memory region", session));
+    }
+    return suffix.empty() ? fmt::format("/gradual_flow_{}", session) : fmt::format("/gradual_flow_{}_{}", session, suffix);
+}
+
+/*
+ * @return whether a region with this name may be used by the session
+ */
+inline bool isRegionOf(const std::string_view name, const std::string_view session)
+{
+    const auto base_name = regionName(session);
+    if (! name.starts_with(base_name))
+    {
+        return false;
+    }
+    const auto suffix = name.substr(base_name.size());
+    return suffix.empty() || (suffix.size() > 1 && suffix.front() == '_' && std::ranges::all_of(suffix.substr(1), isNameCharacter));
+}
+
+/*
+ * A block of a shared memory region, as named in the metadata of a call.
+ */
+struct Block
+{
+    std::string name;
+    std::uint64_t offset{ 0 }; // bytes
+    std::uint64_t size{ 0 }; // bytes
+    std::uint64_t sequence{ 0 };
+};
+
+/*
+ * A mapped POSIX shared memory region. The creator of a region removes its name again.
+ */
+class Region
+{
+public:
+    /*
+     * Creates a new region that only the current user can open.
+     *
+     * @param name the name of the region, starting with a slash
+     * @param size the size in bytes
+     */
+    static std::shared_ptr<Region> create(const std::string& name, const std::size_t size)
+    {
+#if ! defined(_WIN32)
+        const auto fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+        if (fd < 0)
+        {
+            throw std::runtime_error(fmt::format("Failed to create shared memory {}", name));
+        }
+        if (::ftruncate(fd, static_cast<off_t>(size)) != 0)
+        {
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw std::runtime_error(fmt::format("Failed to resize shared memory {} to {} bytes", name, size));
+        }
+        return std::shared_ptr<Region>(new Region{ name, fd, size, true });
+#else
+        throw std::runtime_error("Shared memory is not supported on this platform");
+#endif
+    }
+
+    /*
+     * Opens an existing region, of the current user and only accessible by that user.
+     *
+     * @param name the name of the region, starting with a slash
+     */
+    static std::shared_ptr<Region> open(const std::string& name)
+    {
+#if ! defined(_WIN32)
+        const auto fd = ::shm_open(name.c_str(), O_RDWR | O_NOFOLLOW, 0);
+        struct stat status
+        {
+        };
+        if (fd < 0 || ::fstat(fd, &status) != 0)
+        {
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            throw std::runtime_error(fmt::format("Failed to open shared memory {}", name));
+        }
+        if (status.st_uid != ::geteuid() || (status.st_mode & (S_IRWXG | S_IRWXO)) != 0)
+        {
+            ::close(fd);
+            throw std::runtime_error(fmt::format("Shared memory {} is not private to the user running the plugin", name));
+        }
+        if (status.st_size <= 0 || static_cast<std::uintmax_t>(status.st_size) > std::numeric_limits<std::size_t>::max())
+        {
+            ::close(fd);
+            throw std::runtime_error(fmt::format("Shared memory {} has an invalid size of {} bytes", name, status.st_size));
+        }
+        return std::shared_ptr<Region>(new Region{ name, fd, static_cast<std::size_t>(status.st_size), false });
+#else
+        throw std::runtime_error("Shared memory is not supported on this platform");
+#endif
+    }
+
+    Region(const Region&) = delete;
+    Region& operator=(const Region&) = delete;
+
+    ~Region()
+    {
+#if ! defined(_WIN32)
+        ::munmap(data_, size_);
+        if (owner_)
+        {
+            ::shm_unlink(name_.c_str());
+        }
+#endif
+    }
+
+    const std::string& name() const
+    {
+        return name_;
+    }
+
+    std::size_t size() const
+    {
+        return size_;
+    }
+
+    /*
+     * @return the bytes of a block, after checking that it lies within the region
+     */
+    std::span<std::byte> block(const std::uint64_t offset, const std::uint64_t size) const
+    {
+        if (offset > size_ || size > size_ - offset)
+        {
+            throw std::out_of_range(fmt::format("Block [{}, {}) is outside of shared memory {} of {} bytes", offset, offset + size, name_, size_));
+        }
+        return { static_cast<std::byte*>(data_) + offset, static_cast<std::size_t>(size) };
+    }
+
+private:
+#if ! defined(_WIN32)
+    Region(std::string name, const int fd, const std::size_t size, const bool owner)
+        : name_{ std::move(name) }
+        , size_{ size }
+        , owner_{ owner }
+    {
+        data_ = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data_ == MAP_FAILED)
+        {
+            if (owner_)
+            {
+                ::shm_unlink(name_.c_str());
+            }
+            throw std::runtime_error(fmt::format("Failed to map shared memory {}", name_));
+        }
+    }
+#endif
+
+    std::string name_;
+    void* data_{ nullptr };
+    std::size_t size_{ 0 }; // bytes
+    bool owner_{ false };
+};
+
+/*
+ * @return the number of bytes needed to store the points of the paths in a block
+ */
+inline std::size_t blockSize(const google::protobuf::RepeatedPtrField<cura::plugins::v0::GCodePath>& gcode_paths)
+{
+    std::size_t size = 2 * sizeof(std::uint64_t);
+    for (const auto& path : gcode_paths)
+    {
+        size += sizeof(std::uint64_t) + static_cast<std::size_t>(path.path().path_size()) * 2 * sizeof(std::int64_t);
+    }
+    return size;
+}
+
+/*
+ * Moves the points of the paths into a block.
+ *
+ * @param block the block to write to, at least blockSize(gcode_paths) bytes
+ * @param sequence the sequence number of the call
+ * @param gcode_paths the paths, their points are cleared
+ */
+inline void writeBlock(const std::span<std::byte> block, const std::uint64_t sequence, google::protobuf::RepeatedPtrField<cura::plugins::v0::GCodePath>& gcode_paths)
+{
+    if (block.size() < blockSize(gcode_paths))
+    {
+        throw std::length_error(fmt::format("The points of {} paths do not fit in a block of {} bytes", gcode_paths.size(), block.size()));
+    }
+    auto* cursor = block.data();
+    const auto write = [&cursor](const auto value)
+    {
+        std::memcpy(cursor, &value, sizeof(value));
+        cursor += sizeof(value);
+    };
+
+    write(sequence);
+    write(static_cast<std::uint64_t>(gcode_paths.size()));
+    for (const auto& path : gcode_paths)
+    {
+        write(static_cast<std::uint64_t>(path.path().path_size()));
+    }
+    for (auto& path : gcode_paths)
+    {
+        for (const auto& point : path.path().path())
+        {
+            write(static_cast<std::int64_t>(point.x()));
+            write(static_cast<std::int64_t>(point.y()));
+        }
+        path.mutable_path()->clear_path();
+    }
+}
+
+/*
+ * Restores the points of the paths from a block.
+ *
+ * @param block the block to read from
+ * @param sequence the sequence number of the call, guards against a block that was reused already
+ * @param gcode_paths the paths without their points, in the order they were written
+ */
+inline void readBlock(const std::span<const std::byte> block, const std::uint64_t sequence, google::protobuf::RepeatedPtrField<cura::plugins::v0::GCodePath>& gcode_paths)
+{
+    auto* cursor = block.data();
+    auto remaining = block.size();
+    const auto read = [&]<class T>(T& value)
+    {
+        if (remaining < sizeof(value))
+        {
+            throw std::length_error(fmt::format("Shared memory block of {} bytes ends early", block.size()));
+        }
+        std::memcpy(&value, cursor, sizeof(value));
+        cursor += sizeof(value);
+        remaining -= sizeof(value);
+    };
+
+    std::uint64_t block_sequence = 0;
+    std::uint64_t path_count = 0;
+    read(block_sequence);
+    read(path_count);
+    if (block_sequence != sequence || path_count != static_cast<std::uint64_t>(gcode_paths.size()))
+    {
+        throw std::runtime_error(fmt::format(
+            "Shared memory block <sequence: {}, paths: {}> does not belong to call <sequence: {}, paths: {}>",
+            block_sequence,
+            path_count,
+            sequence,
+            gcode_paths.size()));
+    }
+
+    std::vector<std::uint64_t> point_counts(path_count);
+    for (auto& point_count : point_counts)
+    {
+        read(point_count);
+    }
+    for (const auto& [path_index, point_count] : point_counts | ranges::views::enumerate)
+    {
+        // a corrupt count would otherwise reserve far more than the block holds before any point is read
+        constexpr auto point_size = 2 * sizeof(std::int64_t);
+        if (point_count > remaining / point_size || point_count > static_cast<std::uint64_t>(std::numeric_limits<int>::max()))
+        {
+            throw std::length_error(fmt::format("Shared memory block of {} bytes ends early", block.size()));
+        }
+        auto& points = *gcode_paths.Mutable(static_cast<int>(path_index))->mutable_path()->mutable_path();
+        points.Clear();
+        points.Reserve(static_cast<int>(point_count));
+        for (std::uint64_t index = 0; index < point_count; ++index)
+        {
+            std::int64_t x = 0;
+            std::int64_t y = 0;
+            read(x);
+            read(y);
+            auto& point = *points.Add();
+            point.set_x(x);
+            point.set_y(y);
+        }
+    }
+}
+
+/*
+ * The shared memory regions opened by the plugin, per name, with the engine sessions that use them.
+ */
+class Channel
+{
+public:
+    /*
+     * @return the block named in the metadata of a call, if the call uses shared memory
+     */
+    static std::optional<Block> requestBlock(const grpc::ServerContext& server_context)
+    {
+        const auto& client_metadata = server_context.client_metadata();
+        const auto value = [&client_metadata](const std::string_view key) -> std::optional<std::string>
+        {
+            const auto it = client_metadata.find(grpc::string_ref{ key.data(), key.size() });
+            if (it == client_metadata.end())
+            {
+                return std::nullopt;
+            }
+            return std::string{ it->second.data(), it->second.size() };
+        };
+
+        const auto name = value(name_key);
+        if (! name.has_value())
+        {
+            return std::nullopt;
+        }
+        const auto offset = value(offset_key);
+        const auto size = value(size_key);
+        const auto sequence = value(sequence_key);
+        if (! offset.has_value() || ! size.has_value() || ! sequence.has_value())
+        {
+            throw std::runtime_error(fmt::format("Incomplete shared memory block of {} in the client metadata", name.value()));
+        }
+        return Block{ .name = name.value(), .offset = std::stoull(offset.value()), .size = std::stoull(size.value()), .sequence = std::stoull(sequence.value()) };
+    }
+
+    /*
+     * Restores the points of a request from its block.
+     *
+     * @param session the engine session the request belongs to, the region stays open until all
+     * sessions that used it are closed
+     * @throws std::runtime_error when the region is not one of the session, see regionName()
+     */
+    void read(const std::string& session, const Block& block, google::protobuf::RepeatedPtrField<cura::plugins::v0::GCodePath>& gcode_paths)
+    {
+        readBlock(bytes(session, block), block.sequence, gcode_paths);
+    }
+
+    /*
+     * Moves the points of a response into the block of its request, if they fit.
+     *
+     * @param session the engine session the response belongs to
+     * @return whether the points were moved, otherwise the response carries them
+     */
+    bool write(const std::string& session, const Block& block, google::protobuf::RepeatedPtrField<cura::plugins::v0::GCodePath>& gcode_paths)
+    {
+        if (blockSize(gcode_paths) > block.size)
+        {
+            return false;
+        }
+        writeBlock(bytes(session, block), block.sequence, gcode_paths);
+        return true;
+    }
+
+    /*
+     * Unmaps the regions that only the session used, once the session ended.
+     */
+    void close(const std::string& session)
+    {
+        std::lock_guard lock{ mutex_ };
+        for (auto it = regions_.begin(); it != regions_.end();)
+        {
+            it->second.sessions.erase(session);
+            it = it->second.sessions.empty() ? regions_.erase(it) : std::next(it);
+        }
+    }
+
+    /*
+     * @return the number of mapped regions
+     */
+    std::size_t size() const
+    {
+        std::lock_guard lock{ mutex_ };
+        return regions_.size();
+    }
+
+private:
+    struct OpenRegion
+    {
+        std::shared_ptr<Region> region;
+        std::unordered_set<std::string> sessions;
+    };
+
+    /*
+     * @return the bytes of the block, the region is opened on first use
+     */
+    std::span<std::byte> bytes(const std::string& session, const Block& block)
+    {
+        if (! isRegionOf(block.name, session))
+        {
+            throw std::runtime_error(fmt::format("Shared memory {} is not a region of session {}", block.name, session));
+        }
+        std::shared_ptr<Region> region;
+        {
+            std::lock_guard lock{ mutex_ };
+            auto& open_region = regions_[block.name];
+            if (open_region.region == nullptr)
+            {
+                try
+                {
+                    open_region.region = Region::open(block.name);
+                }
+                catch (...)
+                {
+                    regions_.erase(block.name);
+                    throw;
+                }
+            }
+            open_region.sessions.insert(session);
+            region = open_region.region;
+        }
+        return region->block(block.offset, block.size);
+    }
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, OpenRegion> regions_;
+};
+
+/*
+ * The engine side of the channel: allocates blocks from a region in ring order. Used by the
+ * stand-in engine in the tests and benchmarks.
+ */
+class Ring
+{
+public:
+    explicit Ring(std::shared_ptr<Region> region)
+        : region_{ std::move(region) }
+    {
+    }
+
+    /*
+     * Allocates a block after the previously allocated ones, wrapping around to the start of the
+     * region when it does not fit before the end.
+     *
+     * @param size the size of the block in bytes
+     * @return the block, or nothing when the unreleased blocks leave no room; the caller then sends
+     * the points in the messages
+     */
+    std::optional<Block> allocate(const std::uint64_t size)
+    {
+        const auto aligned_size = (size + alignment - 1) / alignment * alignment;
+        std::optional<std::uint64_t> offset;
+        if (blocks_.empty())
+        {
+            head_ = 0;
+            tail_ = 0;
+        }
+        if (blocks_.empty() || head_ > tail_)
+        {
+            // the allocated blocks are [tail, head), try after them, then before them
+            if (head_ + aligned_size <= region_->size())
+            {
+                offset = head_;
+            }
+            else if (aligned_size <= tail_)
+            {
+                offset = 0;
+            }
+        }
+        else if (head_ + aligned_size <= tail_)
+        {
+            // the allocated blocks wrap around, only [head, tail) is free
+            offset = head_;
+        }
+        if (! offset.has_value())
+        {
+            return std::nullopt;
+        }
+
+        blocks_.emplace_back(offset.value(), aligned_size);
+        head_ = offset.value() + aligned_size;
+        return Block{ .name = region_->name(), .offset = offset.value(), .size = aligned_size, .sequence = ++sequence_ };
+    }
+
+    /*
+     * Releases the oldest allocated block.
+     *
+     * @throws std::logic_error when no block is allocated
+     */
+    void release()
+    {
+        if (blocks_.empty())
+        {
+            throw std::logic_error(fmt::format("Released more blocks than were allocated from shared memory {}", region_->name()));
+        }
+        blocks_.pop_front();
+        if (! blocks_.empty())
+        {
+            tail_ = blocks_.front().first;
+        }
+    }
+
+    std::span<std::byte> bytes(const Block& block) const
+    {
+        return region_->block(block.offset, block.size);
+    }
+
+private:
+    static constexpr std::uint64_t alignment{ 8 }; // bytes
+
+    std::shared_ptr<Region> region_;
+    std::deque<std::pair<std::uint64_t, std::uint64_t>> blocks_; // offset and size, oldest first
+    std::uint64_t head_{ 0 }; // bytes, end of the newest block
+    std::uint64_t tail_{ 0 }; // bytes, start of the oldest block
+    std::uint64_t sequence_{ 0 };
+};
+
+} // namespace shared_memory
+} // namespace plugin
+
+#endif // PLUGIN_SHARED_MEMORY_H
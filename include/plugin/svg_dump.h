@@ -0,0 +1,322 @@
+#ifndef PLUGIN_SVG_DUMP_H
+#define PLUGIN_SVG_DUMP_H
+
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/utils.h"
+#include "plugin/metrics.h"
+
+#include <fmt/format.h>
+#include <spdlog/spdlog.h>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace plugin
+{
+
+/*
+ * Writes the paths of processed layers, before and after the gradual flow, as SVG files to diagnose
+ * prints without a debug build.
+ *
+ * The slicing threads only copy the paths of a layer into a queue, a background thread renders and
+ * writes them. Once the queue holds `queue_depth` layers further layers are dropped, so a slow disk
+ * never slows down slicing.
+ *
+ * The files are named after the process, the order in which the layers were queued, the layer and
+ * the extruder, so the worker processes can share a directory.
+ */
+class SvgDump
+{
+public:
+    /*
+     * A path of a layer, independent of the request it came from.
+     */
+    struct Path
+    {
+        gradual_flow::geometry::polyline<> points;
+        double flow{ 0.0 }; // um^3/s
+        bool travel{ false };
+    };
+
+    struct Layer
+    {
+        std::uint64_t sequence{ 0 };
+        std::int64_t layer_nr{ 0 };
+        std::int64_t extruder_nr{ 0 };
+        std::vector<Path> input_paths;
+        std::vector<Path> output_paths;
+    };
+
+    /*
+     * @param directory the directory to write the SVG files to, an empty path disables the dump
+     * @param queue_depth maximum number of layers waiting to be written
+     * @param metrics the metrics to count written and dropped layers in
+     */
+    explicit SvgDump(std::filesystem::path directory = {}, const std::size_t queue_depth = 16, std::shared_ptr<Metrics> metrics = std::make_shared<Metrics>())
+        : directory_{ std::move(directory) }
+        , queue_depth_{ queue_depth }
+        , metrics_{ std::move(metrics) }
+    {
+        if (directory_.empty())
+        {
+            return;
+        }
+        std::filesystem::create_directories(directory_);
+        buffer_.reserve(initial_buffer_size);
+        writer_ = std::thread{ [this] { write(); } };
+    }
+
+    SvgDump(const SvgDump&) = delete;
+    SvgDump& operator=(const SvgDump&) = delete;
+
+    ~SvgDump()
+    {
+        stop();
+    }
+
+    bool enabled() const
+    {
+        return ! directory_.empty();
+    }
+
+    /*
+     * Queues the paths of a layer to be written, unless the queue is full.
+     *
+     * @param layer_nr the number of the layer
+     * @param extruder_nr the extruder that prints the paths
+     * @param input_paths the paths of the layer as requested
+     * @param output_paths the paths of the layer with the gradual flow applied
+     * @return if the layer is queued
+     */
+    bool dump(const std::int64_t layer_nr, const std::int64_t extruder_nr, const std::vector<gradual_flow::GCodePath>& input_paths, const std::vector<gradual_flow::GCodePath>& output_paths)
+    {
+        if (! enabled())
+        {
+            return false;
+        }
+        if (full())
+        {
+            metrics_->dropped_svg_layers++;
+            return false;
+        }
+
+        // copy the paths outside the lock, the queue only has to be locked to move them in
+        return dump(Layer{ .layer_nr = layer_nr, .extruder_nr = extruder_nr, .input_paths = snapshot(input_paths), .output_paths = snapshot(output_paths) });
+    }
+
+    /*
+     * Queues a layer of which the paths were copied already, unless the queue is full.
+     *
+     * @param layer the layer, its sequence number is assigned here
+     * @return if the layer is queued
+     */
+    bool dump(Layer&& layer)
+    {
+        if (! enabled())
+        {
+            return false;
+        }
+        {
+            std::lock_guard lock{ mutex_ };
+            if (stopping_ || queue_.size() >= queue_depth_)
+            {
+                metrics_->dropped_svg_layers++;
+                return false;
+            }
+            layer.sequence = sequence_++;
+            queue_.emplace_back(std::move(layer));
+        }
+        queued_.notify_one();
+        return true;
+    }
+
+    /*
+     * Writes the queued layers and stops the writer thread; later layers are dropped.
+     */
+    void stop()
+    {
+        {
+            std::lock_guard lock{ mutex_ };
+            stopping_ = true;
+        }
+        queued_.notify_one();
+        if (writer_.joinable())
+        {
+            writer_.join();
+        }
+    }
+
+    /*
+     * Renders the input paths of a layer, and next to them its output paths, colored by flow from
+     * blue at no flow to red at the highest flow of the input paths.
+     *
+     * @param buffer the buffer to append the SVG document to
+     */
+    static void render(fmt::memory_buffer& buffer, const Layer& layer)
+    {
+        auto min_x = std::numeric_limits<double>::max();
+        auto min_y = std::numeric_limits<double>::max();
+        auto max_x = std::numeric_limits<double>::lowest();
+        auto max_y = std::numeric_limits<double>::lowest();
+        auto max_flow = 0.0;
+        for (const auto& path : layer.input_paths)
+        {
+            for (const auto& point : path.points)
+            {
+                min_x = std::min(min_x, static_cast<double>(point.X) * 1e-3);
+                min_y = std::min(min_y, static_cast<double>(point.Y) * 1e-3);
+                max_x = std::max(max_x, static_cast<double>(point.X) * 1e-3);
+                max_y = std::max(max_y, static_cast<double>(point.Y) * 1e-3);
+            }
+            max_flow = std::max(max_flow, path.flow);
+        }
+        if (min_x > max_x)
+        {
+            min_x = min_y = max_x = max_y = 0.0;
+        }
+        const auto margin = 1.0; // mm
+        const auto width = max_x - min_x + 2. * margin;
+        const auto height = max_y - min_y + 2. * margin;
+
+        auto out = std::back_inserter(buffer);
+        fmt::format_to(
+            out,
+            "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"{} {} {} {}\">\n<!-- layer {}, extruder {} -->\n",
+            min_x - margin,
+            min_y - margin,
+            2. * width,
+            height,
+            layer.layer_nr,
+            layer.extruder_nr);
+        renderPaths(buffer, "input", 0.0, layer.input_paths, max_flow);
+        renderPaths(buffer, "output", width, layer.output_paths, max_flow);
+        fmt::format_to(out, "</svg>\n");
+    }
+
+    /*
+     * @return a copy of a path that does not refer to its request
+     */
+    static Path snapshot(const gradual_flow::GCodePath& gcode_path)
+    {
+        return Path{ .points = gcode_path.points, .flow = gcode_path.flow(), .travel = gcode_path.isTravel() };
+    }
+
+private:
+    static constexpr std::size_t initial_buffer_size = 4 * 1024 * 1024;
+
+    bool full()
+    {
+        std::lock_guard lock{ mutex_ };
+        return stopping_ || queue_.size() >= queue_depth_;
+    }
+
+    static std::vector<Path> snapshot(const std::vector<gradual_flow::GCodePath>& gcode_paths)
+    {
+        std::vector<Path> paths;
+        paths.reserve(gcode_paths.size());
+        for (const auto& gcode_path : gcode_paths)
+        {
+            paths.emplace_back(snapshot(gcode_path));
+        }
+        return paths;
+    }
+
+    static void renderPaths(fmt::memory_buffer& buffer, const std::string_view id, const double offset, const std::vector<Path>& paths, const double max_flow)
+    {
+        auto out = std::back_inserter(buffer);
+        fmt::format_to(out, "<g id=\"{}\" transform=\"translate({} 0)\">\n", id, offset);
+        for (const auto& path : paths)
+        {
+            fmt::format_to(out, "<path d=\"");
+            gradual_flow::appendSvgPathData(buffer, path.points);
+            if (path.travel)
+            {
+                fmt::format_to(out, "\" fill=\"none\" stroke=\"black\" stroke-width=\"0.05\" />\n");
+                continue;
+            }
+            const auto flow_ratio = max_flow > 0.0 ? std::clamp(path.flow / max_flow, 0.0, 1.0) : 1.0;
+            const auto [r, g, b] = gradual_flow::utils::hsvToRgb(240. * (1. - flow_ratio), 100., 100.);
+            fmt::format_to(out, "\" fill=\"none\" stroke=\"rgb({},{},{})\" stroke-width=\"0.1\" />\n", r, g, b);
+        }
+        fmt::format_to(out, "</g>\n");
+    }
+
+    void write()
+    {
+        while (true)
+        {
+            Layer layer;
+            {
+                std::unique_lock lock{ mutex_ };
+                queued_.wait(lock, [this] { return stopping_ || ! queue_.empty(); });
+                if (queue_.empty())
+                {
+                    return;
+                }
+                layer = std::move(queue_.front());
+                queue_.pop_front();
+            }
+
+            // the buffer keeps its capacity, so after the first large layers rendering does not allocate
+            buffer_.clear();
+            try
+            {
+                render(buffer_, layer);
+                const auto path = directory_ / fmt::format("{}_{:06}_layer_{}_extruder_{}.svg", process_id_, layer.sequence, layer.layer_nr, layer.extruder_nr);
+                std::ofstream file{ path, std::ios::binary };
+                file.write(buffer_.data(), static_cast<std::streamsize>(buffer_.size()));
+                if (! file)
+                {
+                    throw std::runtime_error(fmt::format("cannot write {}", path.string()));
+                }
+                metrics_->written_svg_layers++;
+            }
+            catch (const std::exception& e)
+            {
+                metrics_->dropped_svg_layers++;
+                spdlog::warn("SVG dump of layer {}: {}", layer.layer_nr, e.what());
+            }
+        }
+    }
+
+    std::filesystem::path directory_;
+#if defined(_WIN32)
+    int process_id_{ ::_getpid() };
+#else
+    int process_id_{ static_cast<int>(::getpid()) };
+#endif
+    std::size_t queue_depth_{ 0 };
+    std::shared_ptr<Metrics> metrics_;
+    fmt::memory_buffer buffer_; // only used by the writer thread
+    std::mutex mutex_;
+    std::condition_variable queued_;
+    std::deque<Layer> queue_;
+    std::uint64_t sequence_{ 0 };
+    bool stopping_{ false };
+    std::thread writer_;
+};
+
+} // namespace plugin
+
+#endif // PLUGIN_SVG_DUMP_H
@@ -0,0 +1,277 @@
+#ifndef PLUGIN_WORKERS_H
+#define PLUGIN_WORKERS_H
+
+#include <fmt/format.h>
+#include <fmt/ranges.h>
+#include <spdlog/spdlog.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+#if ! defined(_WIN32)
+#include <csignal>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <exception>
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace plugin::workers
+{
+
+/*
+ * @return the CPUs the process is allowed to run on
+ */
+inline std::vector<int> availableCpus()
+{
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (::sched_getaffinity(0, sizeof(cpu_set), &cpu_set) == 0)
+    {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+        {
+            if (CPU_ISSET(cpu, &cpu_set))
+            {
+                cpus.push_back(cpu);
+            }
+        }
+        return cpus;
+    }
+#endif
+    for (int cpu = 0; cpu < static_cast<int>(std::max(1U, std::thread::hardware_concurrency())); ++cpu)
+    {
+        cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+/*
+ * Splits the CPUs into one contiguous set per worker, so that the workers do not compete for the
+ * same cores and caches. With more workers than CPUs, every worker gets a single CPU and CPUs are
+ * shared.
+ *
+ * @param cpus the CPUs to divide
+ * @param worker_count the number of workers
+ * @return the CPU set of every worker
+ */
+inline std::vector<std::vector<int>> cpuSets(const std::vector<int>& cpus, const std::size_t worker_count)
+{
+    std::vector<std::vector<int>> cpu_sets(worker_count);
+    if (cpus.empty())
+    {
+        return cpu_sets;
+    }
+    for (std::size_t worker = 0; worker < worker_count; ++worker)
+    {
+        if (worker_count >= cpus.size())
+        {
+            cpu_sets[worker] = { cpus[worker % cpus.size()] };
+        }
+        else
+        {
+            const auto first = static_cast<std::ptrdiff_t>(worker * cpus.size() / worker_count);
+            const auto last = static_cast<std::ptrdiff_t>((worker + 1) * cpus.size() / worker_count);
+            cpu_sets[worker].assign(cpus.begin() + first, cpus.begin() + last);
+        }
+    }
+    return cpu_sets;
+}
+
+/*
+ * Runs the plugin in a number of worker processes, each pinned to its own set of CPUs, so that
+ * concurrent slices do not contend for a single heap and a single server.
+ *
+ * The workers are forked before any of them creates a gRPC server, and listen on the same port
+ * with SO_REUSEPORT. The kernel then hands every connection to one of the workers. The engine
+ * usually shares a single connection between the calls of its slots to a plugin, so the handshake,
+ * the settings broadcast and the modify calls of a slice reach the worker that owns the session.
+ * Nothing guarantees that however: an engine that reconnects, or opens a channel per slot, can
+ * reach a worker that never received the settings of its session. That worker answers with the
+ * original paths and counts the layer in the metrics, see Generate::call.
+ *
+ * A worker that crashes is started again, sessions it owned are lost and the engine reports the
+ * failed calls. A worker that exits, or crashes right after starting, stops all workers.
+ */
+class Supervisor
+{
+public:
+    /*
+     * @param worker_count the number of worker processes
+     * @param worker runs the plugin in a worker process, with the number of CPUs the worker is
+     *        pinned to, and returns its exit code
+     */
+    Supervisor(const std::size_t worker_count, std::function<int(std::size_t)> worker)
+        : cpu_sets_{ cpuSets(availableCpus(), worker_count) }
+        , worker_{ std::move(worker) }
+        , pids_(worker_count, 0)
+        , start_times_(worker_count)
+    {
+    }
+
+    /*
+     * Starts the workers and waits until all of them stopped. SIGINT and SIGTERM are passed on to
+     * the workers.
+     *
+     * @return the exit code of the supervisor, a failure when a worker failed
+     */
+    [[nodiscard]] int run()
+    {
+#if defined(_WIN32)
+        throw std::runtime_error("Worker processes are not supported on Windows");
+#else
+        sigset_t signals;
+        sigemptyset(&signals);
+        sigaddset(&signals, SIGINT);
+        sigaddset(&signals, SIGTERM);
+        sigaddset(&signals, SIGCHLD);
+        ::pthread_sigmask(SIG_BLOCK, &signals, &previous_signals_);
+
+        for (std::size_t index = 0; index < pids_.size(); ++index)
+        {
+            pids_[index] = spawn(index);
+        }
+
+        auto exit_code = EXIT_SUCCESS;
+        auto stopping = false;
+        const auto stop = [this, &stopping]()
+        {
+            if (! stopping)
+            {
+                stopping = true;
+                spdlog::info("Stopping {} workers", std::ranges::count_if(pids_, [](const auto pid) { return pid != 0; }));
+                for (const auto pid : pids_)
+                {
+                    if (pid != 0)
+                    {
+                        ::kill(pid, SIGTERM);
+                    }
+                }
+            }
+        };
+
+        while (std::ranges::any_of(pids_, [](const auto pid) { return pid != 0; }))
+        {
+            int signal_number{ 0 };
+            ::sigwait(&signals, &signal_number);
+            if (signal_number != SIGCHLD)
+            {
+                stop();
+                continue;
+            }
+
+            int status{ 0 };
+            pid_t pid{ 0 };
+            while ((pid = ::waitpid(-1, &status, WNOHANG)) > 0)
+            {
+                const auto worker = std::ranges::find(pids_, pid);
+                if (worker == pids_.end())
+                {
+                    continue;
+                }
+                const auto index = static_cast<std::size_t>(worker - pids_.begin());
+                *worker = 0;
+                if (stopping)
+                {
+                    continue;
+                }
+                if (WIFSIGNALED(status) && std::chrono::steady_clock::now() - start_times_[index] > minimum_uptime)
+                {
+                    spdlog::warn("Worker {} was killed by signal {}, restarting it", index, WTERMSIG(status));
+                    *worker = spawn(index);
+                    continue;
+                }
+                const auto failed = WIFSIGNALED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+                if (failed)
+                {
+                    spdlog::error("Worker {} failed, stopping the other workers", index);
+                    exit_code = EXIT_FAILURE;
+                }
+                stop();
+            }
+        }
+
+        ::pthread_sigmask(SIG_SETMASK, &previous_signals_, nullptr);
+        return exit_code;
+#endif
+    }
+
+private:
+    static constexpr std::chrono::seconds minimum_uptime{ 5 }; // a worker crashing sooner is not restarted
+
+    std::vector<std::vector<int>> cpu_sets_;
+    std::function<int(std::size_t)> worker_;
+    std::vector<int> pids_; // 0 for a worker that is not running
+    std::vector<std::chrono::steady_clock::time_point> start_times_;
+#if ! defined(_WIN32)
+    sigset_t previous_signals_{};
+
+    /*
+     * Forks a worker process, the worker never returns from this call.
+     *
+     * @param index the index of the worker
+     * @return the process id of the worker
+     */
+    int spawn(const std::size_t index)
+    {
+        const auto pid = ::fork();
+        if (pid == -1)
+        {
+            throw std::system_error(errno, std::generic_category(), "Failed to start a worker");
+        }
+        if (pid != 0)
+        {
+            start_times_[index] = std::chrono::steady_clock::now();
+            return pid;
+        }
+
+        ::pthread_sigmask(SIG_SETMASK, &previous_signals_, nullptr);
+        auto exit_code = EXIT_FAILURE;
+        try
+        {
+            pin(cpu_sets_[index]);
+            spdlog::info("Worker {} (pid {}) runs on CPUs {}", index, ::getpid(), fmt::join(cpu_sets_[index], ","));
+            exit_code = worker_(std::max<std::size_t>(1, cpu_sets_[index].size()));
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("Worker {} failed: {}", index, e.what());
+        }
+        std::exit(exit_code);
+    }
+
+    static void pin([[maybe_unused]] const std::vector<int>& cpus)
+    {
+#if defined(__linux__)
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (const auto cpu : cpus)
+        {
+            CPU_SET(cpu, &cpu_set);
+        }
+        if (::sched_setaffinity(0, sizeof(cpu_set), &cpu_set) != 0)
+        {
+            spdlog::warn("Failed to pin worker to CPUs {}", fmt::join(cpus, ","));
+        }
+#endif
+    }
+#endif
+};
+
+} // namespace plugin::workers
+
+#endif // PLUGIN_WORKERS_H
@@ -2,8 +2,11 @@
 #include "cura/plugins/slots/gcode_paths/v0/modify.grpc.pb.h"
 #include "cura/plugins/slots/gcode_paths/v0/modify.pb.h"
 #include "plugin/cmdline.h" // Custom command line argument definitions
+#include "plugin/flow_timeline.h" // Flow timeline export
 #include "plugin/handshake.h" // Handshake interface
+#include "plugin/offline.h" // Offline G-code processing
 #include "plugin/plugin.h" // Plugin interface
+#include "plugin/workers.h" // Worker processes
 
 #include <boost/asio/signal_set.hpp>
 #include <docopt/docopt.h> // Library for parsing command line arguments
@@ -11,6 +14,11 @@
 #include <grpcpp/server.h>
 #include <spdlog/spdlog.h> // Logging library
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
 #include <map>
 
 using namespace cura::plugins::slots::gcode_paths::v0;
@@ -22,14 +30,132 @@ int main(int argc, const char** argv)
     const std::map<std::string, docopt::value> args
         = docopt::docopt(fmt::format(plugin::cmdline::USAGE, plugin::cmdline::NAME), { argv + 1, argv + argc }, show_help, plugin::cmdline::VERSION_ID);
 
+    if (args.at("offline").asBool())
+    {
+        const plugin::offline::Options options{
+            .flow_acceleration = std::stod(args.at("--max-flow-acceleration").asString()) * 1e9,
+            .layer_0_flow_acceleration = std::stod(args.at("--layer-0-max-flow-acceleration").asString()) * 1e9,
+            .discretized_duration = std::stod(args.at("--discretisation-step-size").asString()),
+            .flow_step_tolerance = std::stod(args.at("--discretisation-tolerance").asString()) * 1e9,
+            .reset_flow_duration = std::stod(args.at("--reset-flow-duration").asString()),
+            .filament_diameter = std::stod(args.at("--filament-diameter").asString()) * 1e3,
+        };
+        plugin::gradual_flow::WorkerPool worker_pool{ std::stoul(args.at("--threads").asString()) };
+        try
+        {
+            plugin::offline::processFile(args.at("<input>").asString(), args.at("<output>").asString(), options, worker_pool);
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("Error: {}", e.what());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    if (args.at("timeline").asBool())
+    {
+        try
+        {
+            const plugin::FlowTimelineReader reader{ args.at("<timeline>").asString() };
+            fmt::print("{:>8} {:>8} {:>10} {:>10} {:>8} {:>14}\n", "layer", "extruder", "time [s]", "peak flow", "ramps", "transition [s]");
+            plugin::FlowTimelineSummary total;
+            for (const auto& layer : reader.layers())
+            {
+                const auto summary = plugin::summarize(layer);
+                fmt::print(
+                    "{:>8} {:>8} {:>10.3f} {:>10.3f} {:>8} {:>14.3f}\n",
+                    summary.layer_nr,
+                    summary.extruder_nr,
+                    summary.duration,
+                    summary.peak_flow,
+                    summary.ramp_count,
+                    summary.transition_duration);
+                total.duration += summary.duration;
+                total.peak_flow = std::max(total.peak_flow, summary.peak_flow);
+                total.ramp_count += summary.ramp_count;
+                total.transition_duration += summary.transition_duration;
+            }
+            fmt::print(
+                "{:>17} {:>10.3f} {:>10.3f} {:>8} {:>14.3f}\n",
+                "total",
+                total.duration,
+                total.peak_flow,
+                total.ramp_count,
+                total.transition_duration);
+        }
+        catch (const std::exception& e)
+        {
+            spdlog::error("Error: {}", e.what());
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
     using generate_t = plugin::gradual_flow::Generate<modify::GCodePathsModifyService::AsyncService, modify::CallResponse, modify::CallRequest>;
-    plugin::Plugin<generate_t> plugin{ args.at("--address").asString(), args.at("--port").asString(), grpc::InsecureServerCredentials() };
-    plugin.addHandshakeService(plugin::Handshake{ .metadata = plugin.metadata, .broadcast_subscriptions = { cura::plugins::v0::SlotID::SETTINGS_BROADCAST } });
-
-    auto broadcast_settings = std::make_shared<plugin::Broadcast::settings_t>();
-    plugin.addBroadcastService(plugin::Broadcast{ .settings = broadcast_settings, .metadata = plugin.metadata });
-    plugin.addGenerateService(generate_t{ .settings = broadcast_settings, .metadata = plugin.metadata });
-    plugin.start();
-    plugin.run();
-    plugin.stop();
+    const auto worker_count = std::stoul(args.at("--workers").asString());
+    // gRPC takes the message size in bytes as an int
+    const auto max_message_size = std::stoul(args.at("--max-message-size").asString());
+    if (max_message_size == 0 || max_message_size > static_cast<unsigned long>(std::numeric_limits<int>::max()) / (1024 * 1024))
+    {
+        spdlog::error("--max-message-size must be between 1 and {} megabytes", std::numeric_limits<int>::max() / (1024 * 1024));
+        return EXIT_FAILURE;
+    }
+    const auto run_plugin = [&args, worker_count, max_message_size](const std::size_t cpu_count)
+    {
+        auto plugin = args.at("--socket") ? plugin::Plugin<generate_t>{ std::filesystem::path{ args.at("--socket").asString() }, grpc::InsecureServerCredentials() }
+                                          : plugin::Plugin<generate_t>{ args.at("--address").asString(), args.at("--port").asString(), grpc::InsecureServerCredentials() };
+        plugin.setMaxMessageSize(static_cast<int>(max_message_size * 1024 * 1024));
+        if (worker_count > 1)
+        {
+            plugin.setReusePort(true);
+        }
+        plugin.addHandshakeService(plugin::Handshake{ .metadata = plugin.metadata, .broadcast_subscriptions = { cura::plugins::v0::SlotID::SETTINGS_BROADCAST } });
+
+        auto metrics = std::make_shared<plugin::Metrics>();
+        const auto session_memory_budget = std::stoul(args.at("--session-memory").asString()) * 1024 * 1024;
+        auto broadcast_settings
+            = std::make_shared<plugin::Broadcast::settings_t>(std::chrono::minutes{ std::stoul(args.at("--session-ttl").asString()) }, session_memory_budget, metrics);
+        auto layer_flow_states = std::make_shared<plugin::LayerFlowStates>();
+        auto shared_memory_channel = std::make_shared<plugin::shared_memory::Channel>();
+        auto print_time_impacts = std::make_shared<plugin::PrintTimeImpacts>();
+        // the rest of the state of a session goes together with its settings
+        broadcast_settings->onEvict(
+            [layer_flow_states, shared_memory_channel, print_time_impacts](const std::string& session)
+            {
+                layer_flow_states->erase(session);
+                shared_memory_channel->close(session);
+                print_time_impacts->erase(session);
+            });
+        plugin.addBroadcastService(plugin::Broadcast{ .settings = broadcast_settings, .metadata = plugin.metadata, .metrics = metrics, .layer_flow_states = layer_flow_states });
+        const auto thread_count = std::stoul(args.at("--threads").asString());
+        auto worker_pool = std::make_shared<plugin::gradual_flow::WorkerPool>(thread_count == 0 ? cpu_count : thread_count);
+        const auto response_cache_size = std::stoul(args.at("--cache-size").asString()) * 1024 * 1024;
+        auto response_cache = std::make_shared<plugin::ResponseCache<modify::CallResponse>>(response_cache_size, metrics);
+        auto svg_dump = args.at("--svg-dump") ? std::make_shared<plugin::SvgDump>(std::filesystem::path{ args.at("--svg-dump").asString() }, std::stoul(args.at("--svg-dump-queue").asString()), metrics)
+                                              : std::make_shared<plugin::SvgDump>();
+        auto flow_timeline = std::make_shared<plugin::FlowTimeline>(args.at("--flow-timeline") ? std::filesystem::path{ args.at("--flow-timeline").asString() } : std::filesystem::path{});
+        const generate_t generate{ .settings = broadcast_settings, .metadata = plugin.metadata, .worker_pool = worker_pool, .response_cache = response_cache, .layer_flow_states = layer_flow_states, .metrics = metrics, .shared_memory_channel = shared_memory_channel, .svg_dump = svg_dump, .flow_timeline = flow_timeline, .print_time_impacts = print_time_impacts, .compare_planner = args.at("--compare-planner").asBool() };
+        plugin.addGenerateService(generate_t{ generate });
+        plugin.addGenerateStreamService(plugin::gradual_flow::GenerateStream<generate_t>{ .generate = generate });
+        plugin.start();
+        plugin.run();
+        plugin.stop();
+        svg_dump->stop();
+        print_time_impacts->report();
+        metrics->report();
+        return EXIT_SUCCESS;
+    };
+
+    if (worker_count <= 1)
+    {
+        return run_plugin(0);
+    }
+    // the workers can only share a TCP port that is known up front
+    if (args.at("--socket") || args.at("--port").asString() == "0")
+    {
+        spdlog::error("--workers needs a fixed --port and cannot be combined with --socket");
+        return EXIT_FAILURE;
+    }
+    return plugin::workers::Supervisor{ worker_count, run_plugin }.run();
 }
\ No newline at end of file
@@ -0,0 +1,117 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#include "allocation_counter.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+
+namespace
+{
+
+std::atomic<bool> counting{ false };
+std::atomic<std::uint64_t> allocation_count{ 0 };
+std::atomic<std::uint64_t> allocation_bytes{ 0 };
+
+void count(const std::size_t size) noexcept
+{
+    if (counting.load(std::memory_order_relaxed))
+    {
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        allocation_bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+#if defined(__GLIBC__)
+// glibc lets a program replace malloc and friends, the replacements pass on to the originals
+extern "C"
+{
+    void* __libc_malloc(std::size_t size);
+    void* __libc_calloc(std::size_t count, std::size_t size);
+    void* __libc_realloc(void* memory, std::size_t size);
+
+    void* malloc(std::size_t size)
+    {
+        count(size);
+        return __libc_malloc(size);
+    }
+
+    void* calloc(std::size_t count_, std::size_t size)
+    {
+        count(count_ * size);
+        return __libc_calloc(count_, size);
+    }
+
+    void* realloc(void* memory, std::size_t size)
+    {
+        count(size);
+        return __libc_realloc(memory, size);
+    }
+}
+
+namespace
+{
+void* allocate(const std::size_t size) noexcept
+{
+    return malloc(size);
+}
+} // namespace
+#else
+namespace
+{
+void* allocate(const std::size_t size) noexcept
+{
+    count(size);
+    return std::malloc(size);
+}
+} // namespace
+#endif
+
+// The array and nothrow forms of operator new call these
+void* operator new(std::size_t size)
+{
+    if (void* memory = allocate(size == 0 ? 1 : size))
+    {
+        return memory;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void* memory) noexcept
+{
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    std::free(memory);
+}
+
+namespace plugin::gradual_flow::test
+{
+
+AllocationCounter::AllocationCounter()
+{
+    if (counting.exchange(true))
+    {
+        throw std::logic_error("Only a single AllocationCounter can exist at a time");
+    }
+    allocation_count = 0;
+    allocation_bytes = 0;
+}
+
+AllocationCounter::~AllocationCounter()
+{
+    counting = false;
+}
+
+Allocations AllocationCounter::allocations() const noexcept
+{
+    return { .count = allocation_count.load(), .bytes = allocation_bytes.load() };
+}
+
+} // namespace plugin::gradual_flow::test
@@ -0,0 +1,42 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef TESTS_ALLOCATION_COUNTER_H
+#define TESTS_ALLOCATION_COUNTER_H
+
+#include <cstdint>
+
+namespace plugin::gradual_flow::test
+{
+
+struct Allocations
+{
+    std::uint64_t count{ 0 };
+    std::uint64_t bytes{ 0 };
+};
+
+/*
+ * Counts the heap allocations of all threads while it exists. Allocations through operator new are
+ * always counted, with glibc those through malloc, calloc and realloc as well.
+ *
+ * The allocations are counted by replacements of the global allocation functions in
+ * allocation_counter.cpp, only a single counter can exist at a time.
+ */
+class AllocationCounter
+{
+public:
+    AllocationCounter();
+    ~AllocationCounter();
+
+    AllocationCounter(const AllocationCounter&) = delete;
+    AllocationCounter& operator=(const AllocationCounter&) = delete;
+
+    /*
+     * @return the allocations since the counter was created
+     */
+    Allocations allocations() const noexcept;
+};
+
+} // namespace plugin::gradual_flow::test
+
+#endif // TESTS_ALLOCATION_COUNTER_H
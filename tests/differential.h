@@ -0,0 +1,438 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef TESTS_DIFFERENTIAL_H
+#define TESTS_DIFFERENTIAL_H
+
+#include "gradual_flow/chunked_processing.h"
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/streaming_gcode_state.h"
+#include "gradual_flow/worker_pool.h"
+#include "reference_gcode_state.h"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <optional>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * Differential testing of the gradual flow engines against the frozen reference, see
+ * reference_gcode_state.h.
+ *
+ * A layer, with the settings and the state it starts with, is decoded from arbitrary bytes, so the
+ * same harness runs on the random inputs of the Catch2 test and on the inputs of libFuzzer, see
+ * fuzz_differential.cpp. A failing input is minimized by removing bytes while it keeps failing.
+ */
+namespace plugin::gradual_flow::test
+{
+
+/*
+ * Reads the parameters of a layer from bytes; reading past the end gives zeros, so all inputs are
+ * valid layers and every prefix of an input is a smaller layer.
+ */
+class FuzzInput
+{
+public:
+    explicit FuzzInput(const std::span<const std::uint8_t> data)
+        : data_{ data }
+    {
+    }
+
+    bool empty() const
+    {
+        return position_ >= data_.size();
+    }
+
+    std::uint8_t byte()
+    {
+        return empty() ? 0 : data_[position_++];
+    }
+
+    /*
+     * @return a value in [min, max], from two bytes
+     */
+    double uniform(const double min, const double max)
+    {
+        const auto high = byte();
+        const auto low = byte();
+        return min + (max - min) * static_cast<double>(high << 8 | low) / 65535.;
+    }
+
+private:
+    std::span<const std::uint8_t> data_;
+    std::size_t position_{ 0 };
+};
+
+struct FuzzedLayer
+{
+    std::deque<cura::plugins::v0::GCodePath> messages; // the original path data, a deque does not move its elements
+    std::vector<GCodePath> gcode_paths;
+    GCodeState state;
+};
+
+/*
+ * Decodes a layer; the settings and start state first, then paths until the input ends. Paths are
+ * retracts, travels or extrusions with 1 to 6 segments, some of which have no length.
+ */
+inline FuzzedLayer fuzzedLayer(const std::span<const std::uint8_t> data)
+{
+    constexpr std::size_t max_path_count{ 128 };
+
+    FuzzInput input{ data };
+    FuzzedLayer layer;
+    auto& state = layer.state;
+    state.flow_acceleration = std::pow(10., input.uniform(7.5, 10.5)); // um^3/s^2
+    state.flow_deceleration = std::pow(10., input.uniform(7.5, 10.5)); // um^3/s^2
+    state.discretized_duration = input.uniform(.02, .5); // s
+    state.flow_step_tolerance = input.byte() % 2 == 0 ? 0. : std::pow(10., input.uniform(7., 9.)); // um^3/s
+    state.reset_flow_duration = input.uniform(.1, 5.); // s
+    state.flow_state = static_cast<FlowState>(input.byte() % 3);
+    state.current_flow = input.uniform(0., 2e10); // um^3/s
+    state.discretized_duration_remaining = input.byte() % 2 == 0 ? 0. : input.uniform(0., state.discretized_duration); // s
+    state.target_end_flow = input.uniform(0., 2e10); // um^3/s
+
+    ClipperLib::IntPoint point{ 0, 0 };
+    while (! input.empty() && layer.gcode_paths.size() < max_path_count)
+    {
+        const auto kind = input.byte() % 8;
+        const auto retract = kind == 0;
+        const auto travel = kind <= 1;
+
+        auto& message = layer.messages.emplace_back();
+        message.set_flow(travel ? 0. : input.uniform(.2, 1.5));
+        message.set_width_factor(1.);
+        message.set_speed_factor(1.);
+        message.set_speed_back_pressure_factor(1.);
+        message.set_line_width(static_cast<std::int64_t>(input.uniform(100., 1000.)));
+        message.set_layer_thickness(200);
+        message.set_flow_ratio(1.);
+        message.set_retract(retract);
+        message.mutable_speed_derivatives()->set_velocity(input.uniform(1., 300.)); // mm/s
+
+        geometry::polyline<> points;
+        points.emplace_back(point);
+        const auto segment_count = 1 + input.byte() % 6;
+        const auto scale = 1 + input.byte() % 64; // segments of up to about 50 mm
+        for (auto segment = 0; segment < segment_count; ++segment)
+        {
+            point.X += static_cast<std::int8_t>(input.byte()) * scale * 6;
+            point.Y += static_cast<std::int8_t>(input.byte()) * scale * 6;
+            points.emplace_back(point);
+        }
+        layer.gcode_paths.emplace_back(GCodePath{ .original_gcode_path_data = &message, .points = std::move(points) });
+    }
+    return layer;
+}
+
+/*
+ * @return random input of 20 to 2000 bytes
+ */
+inline std::vector<std::uint8_t> randomFuzzInput(const std::uint32_t seed)
+{
+    std::mt19937 generator{ seed };
+    std::uniform_int_distribution<std::size_t> size{ 20, 2000 };
+    std::uniform_int_distribution<int> byte{ 0, 255 };
+    std::vector<std::uint8_t> data(size(generator));
+    for (auto& value : data)
+    {
+        value = static_cast<std::uint8_t>(byte(generator));
+    }
+    return data;
+}
+
+struct Engine
+{
+    std::string_view name;
+    std::function<std::vector<GCodePath>(GCodeState&, const std::vector<GCodePath>&)> process;
+};
+
+/*
+ * The engines that have to give the same paths as the reference; add new implementations of the
+ * gradual flow passes here.
+ */
+inline const std::vector<Engine>& engines()
+{
+    static WorkerPool pool{ 4 };
+    static const std::vector<Engine> engines{
+        Engine{ .name = "serial",
+                .process = [](GCodeState& state, const std::vector<GCodePath>& gcode_paths) { return state.processGcodePaths(gcode_paths); } },
+        Engine{ .name = "parallel",
+                .process = [](GCodeState& state, const std::vector<GCodePath>& gcode_paths) { return processGcodePathsParallel(state, gcode_paths, pool); } },
+        Engine{ .name = "streaming",
+                .process =
+                    [](GCodeState& state, const std::vector<GCodePath>& gcode_paths)
+                {
+                    StreamingGCodeState streaming_state{ state };
+                    std::vector<GCodePath> paths;
+                    for (const auto& gcode_path : gcode_paths)
+                    {
+                        for (auto& path : streaming_state.push(gcode_path))
+                        {
+                            paths.emplace_back(std::move(path));
+                        }
+                    }
+                    for (auto& path : streaming_state.finish())
+                    {
+                        paths.emplace_back(std::move(path));
+                    }
+                    return paths;
+                } },
+    };
+    return engines;
+}
+
+/*
+ * Checks that the flow stays within the target flow of every path, and changes by at most a single
+ * step of the flow acceleration or deceleration between consecutive extrusions; unless a retract or a
+ * long travel in between resets the flow.
+ *
+ * With feature policies a ramp up is limited by the policy of the path it ramps up in, and a ramp
+ * down by the policy of the path it ramps down from. Exempt paths are not ramped, so the flow may
+ * jump up to an exempt path and down from one.
+ *
+ * @return the first violation, if any
+ */
+inline std::optional<std::string> flowLimitViolation(const GCodeState& state, const std::vector<GCodePath>& paths)
+{
+    constexpr double tolerance{ 1e-6 }; // relative
+    const auto max_step = [&state](const GCodePath& path, const utils::Direction direction)
+    {
+        const auto acceleration = state.pathFlowAcceleration(path, direction);
+        return acceleration * state.accelerationStepDuration(acceleration) * (1. + tolerance);
+    };
+
+    std::optional<double> previous_flow;
+    const GCodePath* previous_path{ nullptr };
+    for (const auto& [index, path] : paths | ranges::views::enumerate)
+    {
+        if (path.isTravel())
+        {
+            if (path.isRetract() || path.totalDuration() > state.reset_flow_duration)
+            {
+                previous_flow.reset();
+            }
+            continue;
+        }
+        const auto flow = path.extrusionVolumePerMm() * path.speed;
+        if (flow > path.targetFlow() * (1. + tolerance))
+        {
+            return fmt::format("path {} has a flow of {} above its target flow {}", index, flow, path.targetFlow());
+        }
+        if (previous_flow.has_value())
+        {
+            const auto steep_increase = ! state.isExempt(path) && flow - *previous_flow > max_step(path, utils::Direction::Forward);
+            const auto steep_decrease = ! state.isExempt(*previous_path) && *previous_flow - flow > max_step(*previous_path, utils::Direction::Backward);
+            if (steep_increase || steep_decrease)
+            {
+                return fmt::format("the flow changes from {} to {} at path {}, by more than a step", *previous_flow, flow, index);
+            }
+        }
+        previous_flow = flow;
+        previous_path = &path;
+    }
+    return std::nullopt;
+}
+
+/*
+ * Compares the paths of an engine with those of the reference, after merging the consecutive pieces
+ * of a path with the same speed; engines may split a path differently as long as it prints the same.
+ *
+ * @return the first difference, if any
+ */
+inline std::optional<std::string> pathsDifference(std::vector<GCodePath> reference_paths, std::vector<GCodePath> engine_paths)
+{
+    constexpr double point_tolerance{ 2. }; // um
+    constexpr double tolerance{ 1e-6 }; // relative, for the speeds and lengths
+
+    reference_paths = coalesceGcodePaths(std::move(reference_paths));
+    engine_paths = coalesceGcodePaths(std::move(engine_paths));
+    if (reference_paths.size() != engine_paths.size())
+    {
+        return fmt::format("{} paths instead of the {} of the reference", engine_paths.size(), reference_paths.size());
+    }
+    const auto close = [](const double lhs, const double rhs, const double absolute_tolerance)
+    {
+        return std::abs(lhs - rhs) <= absolute_tolerance + tolerance * std::max(std::abs(lhs), std::abs(rhs));
+    };
+    for (std::size_t index = 0; index < reference_paths.size(); ++index)
+    {
+        const auto& reference_path = reference_paths[index];
+        const auto& engine_path = engine_paths[index];
+        if (engine_path.original_gcode_path_data != reference_path.original_gcode_path_data)
+        {
+            return fmt::format("path {} is a piece of another path than in the reference", index);
+        }
+        if (engine_path.points.size() != reference_path.points.size())
+        {
+            return fmt::format("path {} has {} points instead of {}", index, engine_path.points.size(), reference_path.points.size());
+        }
+        for (std::size_t point_index = 0; point_index < reference_path.points.size(); ++point_index)
+        {
+            const auto& reference_point = reference_path.points[point_index];
+            const auto& engine_point = engine_path.points[point_index];
+            if (std::hypot(engine_point.X - reference_point.X, engine_point.Y - reference_point.Y) > point_tolerance)
+            {
+                return fmt::format(
+                    "point {} of path {} is ({}, {}) instead of ({}, {})",
+                    point_index,
+                    index,
+                    engine_point.X,
+                    engine_point.Y,
+                    reference_point.X,
+                    reference_point.Y);
+            }
+        }
+        if (! close(engine_path.speed, reference_path.speed, 0.))
+        {
+            return fmt::format("path {} has a speed of {} um/s instead of {}", index, engine_path.speed, reference_path.speed);
+        }
+        if (! close(engine_path.total_length, reference_path.total_length, point_tolerance))
+        {
+            return fmt::format("path {} has a length of {} um instead of {}", index, engine_path.total_length, reference_path.total_length);
+        }
+    }
+    return std::nullopt;
+}
+
+/*
+ * Processes the layer with the reference and with every engine.
+ *
+ * @return the first difference or flow limit violation of an engine, if any
+ */
+inline std::optional<std::string> differenceFromReference(const FuzzedLayer& layer)
+{
+    if (layer.gcode_paths.empty())
+    {
+        return std::nullopt;
+    }
+
+    auto reference_state = layer.state;
+    const auto reference_paths = reference::processGcodePaths(reference_state, layer.gcode_paths);
+    if (const auto violation = flowLimitViolation(layer.state, reference_paths))
+    {
+        return fmt::format("reference: {}", *violation);
+    }
+    for (const auto& engine : engines())
+    {
+        auto state = layer.state;
+        const auto paths = engine.process(state, layer.gcode_paths);
+        if (const auto violation = flowLimitViolation(layer.state, paths))
+        {
+            return fmt::format("{}: {}", engine.name, *violation);
+        }
+        if (const auto difference = pathsDifference(reference_paths, paths))
+        {
+            return fmt::format("{}: {}", engine.name, *difference);
+        }
+    }
+    return std::nullopt;
+}
+
+/*
+ * Minimizes a failing input; removes ever smaller chunks of bytes, and then lowers the remaining
+ * bytes, as long as the input keeps failing.
+ *
+ * @param fails whether an input still fails
+ * @return the minimized input
+ */
+inline std::vector<std::uint8_t> shrink(std::vector<std::uint8_t> data, const std::function<bool(std::span<const std::uint8_t>)>& fails)
+{
+    for (auto chunk_size = std::max<std::size_t>(1, data.size() / 2); chunk_size > 0; chunk_size /= 2)
+    {
+        for (std::size_t begin = 0; begin + chunk_size <= data.size();)
+        {
+            auto candidate = data;
+            candidate.erase(std::next(candidate.begin(), static_cast<std::ptrdiff_t>(begin)), std::next(candidate.begin(), static_cast<std::ptrdiff_t>(begin + chunk_size)));
+            if (fails(candidate))
+            {
+                data = std::move(candidate);
+            }
+            else
+            {
+                begin += chunk_size;
+            }
+        }
+    }
+    for (std::size_t index = 0; index < data.size(); ++index)
+    {
+        for (const auto value : { std::uint8_t{ 0 }, static_cast<std::uint8_t>(data[index] / 2) })
+        {
+            auto candidate = data;
+            candidate[index] = value;
+            if (value < data[index] && fails(candidate))
+            {
+                data = std::move(candidate);
+            }
+        }
+    }
+    return data;
+}
+
+/*
+ * @return the layer and its start state in a readable form, to reproduce a failure
+ */
+inline std::string describe(const FuzzedLayer& layer)
+{
+    const auto& state = layer.state;
+    auto description = fmt::format(
+        "flow acceleration {} um^3/s^2, flow deceleration {} um^3/s^2, step {} s, step tolerance {} um^3/s, reset flow duration {} s, "
+        "start flow {} um^3/s with state {} and {} s of the step remaining, end flow {} um^3/s",
+        state.flow_acceleration,
+        state.flow_deceleration,
+        state.discretized_duration,
+        state.flow_step_tolerance,
+        state.reset_flow_duration,
+        state.current_flow,
+        static_cast<int>(state.flow_state),
+        state.discretized_duration_remaining,
+        state.target_end_flow);
+    for (const auto& path : layer.gcode_paths)
+    {
+        description += fmt::format("\n{} at {} um/s:", path.isRetract() ? "retract" : path.isTravel() ? "travel" : "extrusion", path.speed);
+        for (const auto& point : path.points)
+        {
+            description += fmt::format(" ({}, {})", point.X, point.Y);
+        }
+    }
+    return description;
+}
+
+/*
+ * @return the bytes as hexadecimal, to replay an input
+ */
+inline std::string hex(const std::span<const std::uint8_t> data)
+{
+    std::string text;
+    for (const auto value : data)
+    {
+        text += fmt::format("{:02x}", value);
+    }
+    return text;
+}
+
+/*
+ * @return the bytes of an input printed by `hex`
+ */
+inline std::vector<std::uint8_t> fromHex(const std::string_view text)
+{
+    std::vector<std::uint8_t> data;
+    for (std::size_t index = 0; index + 1 < text.size(); index += 2)
+    {
+        data.emplace_back(static_cast<std::uint8_t>(std::stoi(std::string{ text.substr(index, 2) }, nullptr, 16)));
+    }
+    return data;
+}
+
+} // namespace plugin::gradual_flow::test
+
+#endif // TESTS_DIFFERENTIAL_H
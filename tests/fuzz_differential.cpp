@@ -0,0 +1,46 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#include "differential.h"
+
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <span>
+
+/*
+ * libFuzzer target of the differential test, build it with the ENABLE_FUZZING option and clang, and run
+ * e.g. `./fuzz_differential -max_len=4096 corpus/`.
+ *
+ * On a difference the input is minimized before aborting, the printed bytes reproduce it with
+ * `fuzzedLayer`.
+ */
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size)
+{
+    using namespace plugin::gradual_flow::test;
+
+    const std::span<const std::uint8_t> input{ data, size };
+    if (! differenceFromReference(fuzzedLayer(input)).has_value())
+    {
+        return 0;
+    }
+
+    const auto minimized_input = shrink(
+        { input.begin(), input.end() },
+        [](const std::span<const std::uint8_t> candidate)
+        {
+            return differenceFromReference(fuzzedLayer(candidate)).has_value();
+        });
+    const auto layer = fuzzedLayer(minimized_input);
+    fmt::print(
+        stderr,
+        "minimized input ({} bytes): {}\n{}\n{}\n",
+        minimized_input.size(),
+        hex(minimized_input),
+        describe(layer),
+        differenceFromReference(layer).value_or("the minimized input no longer differs"));
+    std::abort();
+}
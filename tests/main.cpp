@@ -3,13 +3,41 @@
 
 #define CATCH_CONFIG_MAIN
 
+#include "gradual_flow/chunked_processing.h"
+#include "gradual_flow/fixed_point_gcode_state.h"
+#include "gradual_flow/flow_ramp_planner.h"
 #include "gradual_flow/gcode_path.h"
+#include "gradual_flow/streaming_gcode_state.h"
+#include "gradual_flow/worker_pool.h"
+#include "plugin/admission_control.h"
+#include "plugin/flow_timeline.h"
+#include "plugin/modify_stream.h"
+#include "plugin/offline.h"
+#include "plugin/print_time_impact.h"
+#include "plugin/response_cache.h"
+#include "plugin/sessions.h"
+#include "plugin/shared_memory.h"
+#include "plugin/svg_dump.h"
+#include "plugin/workers.h"
+#include "allocation_counter.h"
+#include "differential.h"
 
 #include <catch2/catch_all.hpp>
 #include <catch2/matchers/catch_matchers_string.hpp>
 #include <range/v3/algorithm/any_of.hpp>
 #include <range/v3/view/transform.hpp>
 
+#include <array>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <random>
+#include <span>
+#include <system_error>
+#include <thread>
+
 /*
  * of 200, and all flow/line width ratios set to 1.0. This means that the extrusion volume is 400 * 200 * 1.0 = 80000.
  * Mocks a GCodePath message with a given velocity. The default configuration has a line width of 400, a layer thickness
@@ -32,6 +60,134 @@ cura::plugins::v0::GCodePath mock_msg(double velocity = 100)
     return original_gcode_path_data;
 }
 
+/*
+ * Mocks a retracted travel GCodePath message, a travel has no flow.
+ *
+ * @return A GCodePath message for a retracted travel move.
+ */
+cura::plugins::v0::GCodePath mock_retract_msg()
+{
+    auto original_gcode_path_data = mock_msg();
+    original_gcode_path_data.set_flow(0.0);
+    original_gcode_path_data.set_retract(true);
+    return original_gcode_path_data;
+}
+
+using request_t = cura::plugins::slots::gcode_paths::v0::modify::CallRequest;
+using response_t = cura::plugins::slots::gcode_paths::v0::modify::CallResponse;
+using generate_t = plugin::gradual_flow::Generate<cura::plugins::slots::gcode_paths::v0::modify::GCodePathsModifyService::AsyncService, response_t, request_t>;
+
+/*
+ * Mocks a G-code file of two layers with absolute extrusion, each with a slow wall of 20 mm/s and a
+ * fast line of 100 mm/s, of a 0.4 mm wide line of 0.2 mm with 1.75 mm filament.
+ */
+std::string mock_gcode()
+{
+    return R"(;FLAVOR:Marlin
+M82 ;absolute extrusion mode
+G92 E0
+;LAYER:0
+G0 F6000 X10 Y10 Z0.2
+;TYPE:WALL-OUTER
+G1 F1200 X50 Y10 E1.33041
+G1 X50 Y50 E2.66082
+;TYPE:FILL
+G1 F6000 X90 Y50 E3.99123
+G1 F2700 E-1.00877
+;LAYER:1
+G0 F6000 X10 Y10 Z0.4
+G1 F2700 E3.99123
+;TYPE:WALL-OUTER
+G1 F1200 X50 Y10 E5.32164
+;TYPE:FILL
+G1 F6000 X90 Y10 E6.65205
+G0 X10 Y10
+;End of Gcode
+)";
+}
+
+/*
+ * A new, empty directory for the files of a single test, removed with everything in it when the
+ * test ends, also when a requirement fails. Tests running at the same time never share one.
+ */
+struct TemporaryDirectory
+{
+    std::filesystem::path path;
+
+    TemporaryDirectory()
+    {
+        std::random_device random;
+        do
+        {
+            path = std::filesystem::temp_directory_path() / fmt::format("gradual_flow_test_{}_{:08x}{:08x}", ::getpid(), random(), random());
+        } while (! std::filesystem::create_directory(path));
+    }
+
+    TemporaryDirectory(const TemporaryDirectory&) = delete;
+    TemporaryDirectory& operator=(const TemporaryDirectory&) = delete;
+
+    ~TemporaryDirectory()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(path, error);
+    }
+};
+
+/*
+ * Mocks the settings of a single extruder with gradual flow enabled, as they are broadcast by the engine.
+ */
+plugin::Settings mock_settings()
+{
+    const auto metadata = std::make_shared<plugin::Metadata>();
+    cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest settings_request;
+    const auto settingKey = [&metadata](const std::string_view key)
+    {
+        return plugin::Settings::settingKey(key, metadata->plugin_name, metadata->plugin_version);
+    };
+    auto& extruder_settings = *settings_request.add_extruder_settings()->mutable_settings();
+    extruder_settings[settingKey("gradual_flow_enabled")] = "True";
+    extruder_settings[settingKey("max_flow_acceleration")] = "1";
+    extruder_settings[settingKey("layer_0_max_flow_acceleration")] = "1";
+    extruder_settings[settingKey("gradual_flow_discretisation_step_size")] = "0.2";
+    (*settings_request.mutable_global_settings()->mutable_settings())[settingKey("reset_flow_duration")] = "2.0";
+    return plugin::Settings{ settings_request, metadata };
+}
+
+/*
+ * Mocks a modify request of a layer with paths of varying speeds, travels and retracts.
+ *
+ * @param path_count The number of paths in the layer.
+ */
+request_t mock_layer_request(const int path_count)
+{
+    request_t layer_request;
+    layer_request.set_extruder_nr(0);
+    layer_request.set_layer_nr(3);
+    long long y = 0;
+    const auto velocities = { 10.3, 97.1, 25.7, 61.3, 149.9, 5.1 };
+    for (auto index = 0; index < path_count; ++index)
+    {
+        auto& path = *layer_request.add_gcode_paths();
+        path = mock_msg(*std::next(velocities.begin(), index % velocities.size()));
+        if (index % 97 == 0)
+        {
+            path = mock_retract_msg();
+        }
+        else if (index % 31 == 0)
+        {
+            path.set_flow(0.0);
+        }
+        for (auto point_index = 0; point_index < 1 + index % 3; ++point_index)
+        {
+            y += 1013 + (index * 7919 + point_index * 31) % 19997;
+            auto& point = *path.mutable_path()->add_path();
+            point.set_x(0);
+            point.set_y(y);
+        }
+    }
+    return layer_request;
+}
+
 TEST_CASE("segment duration long line")
 {
     // Make sure all partition-segments will have the discretized
@@ -203,6 +359,45 @@ TEST_CASE("forward discretization steps")
     REQUIRE(limited_flow_acceleration_paths.size() == ceil(flow_delta / (flow_acceleration * discretized_duration)));
 }
 
+TEST_CASE("flow model policy")
+{
+    // A flow model that reaches the target flow in a single step leaves every path whole, at its
+    // target speed; the linear model ramps the same path up in steps.
+    struct ImmediateFlowModel
+    {
+        static double nextFlow(const double, const double target_flow, const double, const double)
+        {
+            return target_flow;
+        }
+    };
+
+    const auto slow_msg = mock_msg(10);
+    const auto fast_msg = mock_msg(100);
+    const std::vector<plugin::gradual_flow::GCodePath> paths{
+        { .original_gcode_path_data = &slow_msg, .points = { { 0, 0 }, { 10000, 0 } } },
+        { .original_gcode_path_data = &fast_msg, .points = { { 10000, 0 }, { 110000, 0 } } },
+    };
+    const plugin::gradual_flow::GCodeState state{
+        .current_flow = paths.front().targetFlow(),
+        .flow_acceleration = 1e9,
+        .flow_deceleration = 1e9,
+        .discretized_duration = 0.1,
+        .target_end_flow = paths.front().targetFlow(),
+        .flow_state = plugin::gradual_flow::FlowState::STABLE,
+    };
+
+    auto immediate_state = state;
+    const auto immediate_paths = immediate_state.processGcodePaths<ImmediateFlowModel>(paths);
+    REQUIRE(immediate_paths.size() == paths.size());
+    for (std::size_t index = 0; index < paths.size(); ++index)
+    {
+        REQUIRE(immediate_paths[index].speed == Catch::Approx(paths[index].targetSpeed()));
+    }
+
+    auto linear_state = state;
+    REQUIRE(linear_state.processGcodePaths(paths).size() > paths.size());
+}
+
 TEST_CASE("discretization steps backward")
 {
     // see forward discretization steps; but now the flow is decreased
@@ -395,3 +590,1444 @@ TEST_CASE("flow deceleration")
         REQUIRE(i == expected_steps);
     }
 }
+
+TEST_CASE("parallel chunked processing matches serial")
+{
+    // A layer with a number of islands separated by retracted travels; every island ramps up and down
+    // again. Processing the islands as independent chunks should give exactly the same result as
+    // processing the layer serially.
+    const auto original_gcode_path_data_100mm_s = mock_msg(100); // 100mm/s
+    const auto original_gcode_path_data_30mm_s = mock_msg(30); // 30mm/s
+    const auto original_gcode_path_data_10mm_s = mock_msg(10); // 10mm/s
+    const auto original_gcode_path_data_retract = mock_retract_msg();
+
+    std::vector<plugin::gradual_flow::GCodePath> paths;
+    for (int island = 0; island < 8; ++island)
+    {
+        const auto x = island * 40000000;
+        // alternate the slow path at the end of the island, so some islands end slower than the next one starts
+        const auto& end_data = island % 2 == 0 ? original_gcode_path_data_10mm_s : original_gcode_path_data_100mm_s;
+        paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_30mm_s, .points = { { x, 0 }, { x + 1000000, 0 } } });
+        paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_100mm_s, .points = { { x + 1000000, 0 }, { x + 20000000, 0 } } });
+        paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &end_data, .points = { { x + 20000000, 0 }, { x + 20100000, 0 } } });
+        paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_retract, .points = { { x + 20100000, 0 }, { x + 40000000, 0 } } });
+    }
+
+    REQUIRE(plugin::gradual_flow::flowResetChunkStarts(paths, 2.0).size() == 8);
+
+    const plugin::gradual_flow::GCodeState initial_state
+    {
+        .current_flow = paths.front().flow(),
+        .flow_acceleration = 1000000000.,
+        .flow_deceleration = 1000000000.,
+        .discretized_duration = 0.1,
+        .target_end_flow = paths.front().targetFlow(),
+        .reset_flow_duration = 2.0,
+        .flow_state = plugin::gradual_flow::FlowState::STABLE,
+    };
+
+    auto serial_state = initial_state;
+    const auto serial_paths = serial_state.processGcodePaths(paths);
+
+    plugin::gradual_flow::WorkerPool pool{ 4 };
+    auto parallel_state = initial_state;
+    const auto parallel_paths = plugin::gradual_flow::processGcodePathsParallel(parallel_state, paths, pool);
+
+    REQUIRE(parallel_paths.size() == serial_paths.size());
+    for (std::size_t i = 0; i < serial_paths.size(); ++i)
+    {
+        REQUIRE(parallel_paths[i].original_gcode_path_data == serial_paths[i].original_gcode_path_data);
+        REQUIRE(parallel_paths[i].points == serial_paths[i].points);
+        REQUIRE(parallel_paths[i].speed == serial_paths[i].speed);
+    }
+    REQUIRE(parallel_state.current_flow == serial_state.current_flow);
+    REQUIRE(parallel_state.discretized_duration_remaining == serial_state.discretized_duration_remaining);
+    REQUIRE(parallel_state.flow_state == serial_state.flow_state);
+}
+
+TEST_CASE("response cache evicts least recently used")
+{
+    // Identical gcode paths should give the same key, paths which only share the hash should not,
+    // and once the cache is full the least recently used response should be evicted first.
+    using response_t = cura::plugins::slots::gcode_paths::v0::modify::CallResponse;
+
+    cura::plugins::slots::gcode_paths::v0::modify::CallRequest request;
+    for (int i = 0; i < 100; ++i)
+    {
+        auto* path = request.add_gcode_paths();
+        path->CopyFrom(mock_msg(10 + i));
+        auto* point = path->mutable_path()->add_path();
+        point->set_x(i * 1000);
+        point->set_y(0);
+    }
+    auto same_request = request;
+    auto other_request = request;
+    other_request.mutable_gcode_paths(42)->mutable_speed_derivatives()->set_velocity(12.5);
+
+    const auto gcode_paths = plugin::serializeMessages(request.gcode_paths());
+    const auto other_gcode_paths = plugin::serializeMessages(other_request.gcode_paths());
+    const auto hash = plugin::hashBytes(gcode_paths);
+    REQUIRE(plugin::serializeMessages(same_request.gcode_paths()) == gcode_paths);
+    REQUIRE(other_gcode_paths != gcode_paths);
+    REQUIRE(plugin::hashBytes(other_gcode_paths) != hash);
+
+    auto response = std::make_shared<plugin::LayerResponse<response_t>>();
+    response->response.mutable_gcode_paths()->CopyFrom(request.gcode_paths());
+    const auto entry_size = response->response.SpaceUsedLong() + gcode_paths.size();
+
+    auto metrics = std::make_shared<plugin::Metrics>();
+    plugin::ResponseCache<response_t> cache{ entry_size * 2 + entry_size / 2, metrics };
+    const auto key = [&](const int extruder_nr)
+    {
+        return plugin::ResponseCacheKey{ .gcode_paths_hash = hash, .gcode_paths = gcode_paths, .extruder_nr = extruder_nr, .flow_acceleration = 1e9, .discretized_duration = 0.2 };
+    };
+
+    REQUIRE(cache.find(key(0)) == nullptr);
+    cache.insert(key(0), response);
+    auto colliding_key = key(0);
+    colliding_key.gcode_paths = other_gcode_paths; // a hash collision must not return the response of other paths
+    REQUIRE(cache.find(colliding_key) == nullptr);
+    cache.insert(key(1), response);
+    REQUIRE(cache.find(key(0)) != nullptr); // key 1 is now the least recently used entry
+    cache.insert(key(2), response);
+
+    REQUIRE(cache.find(key(1)) == nullptr);
+    REQUIRE(cache.find(key(0)) != nullptr);
+    REQUIRE(cache.find(key(2)) != nullptr);
+    REQUIRE(metrics->cache_hits == 3);
+    REQUIRE(metrics->cache_misses == 3);
+    REQUIRE(metrics->cache_evictions == 1);
+    REQUIRE(metrics->cache_bytes <= entry_size * 2 + entry_size / 2);
+}
+
+TEST_CASE("layer end flow state continues transition")
+{
+    // A long ramp is split over two layers. When the second layer starts from the flow state the
+    // first layer ended with, the flows should continue exactly as if both were a single layer.
+    const auto original_gcode_path_data = mock_msg();
+    const plugin::gradual_flow::GCodePath path_first_layer {
+        .original_gcode_path_data = &original_gcode_path_data,
+        .points = { { 0, 0 }, { 0, 130000 } },
+    };
+    const plugin::gradual_flow::GCodePath path_second_layer {
+        .original_gcode_path_data = &original_gcode_path_data,
+        .points = { { 0, 130000 }, { 0, 100000000 } },
+    };
+
+    const plugin::gradual_flow::GCodeState initial_state
+    {
+        .current_flow = 0.,
+        .flow_acceleration = 1000000000.,
+        .flow_deceleration = 1000000000.,
+        .discretized_duration = .1,
+        .target_end_flow = path_first_layer.targetFlow(),
+        .reset_flow_duration = 2.0,
+        .flow_state = plugin::gradual_flow::FlowState::STABLE,
+    };
+
+    auto single_state = initial_state;
+    const auto single_layer_paths = single_state.processGcodePaths({ path_first_layer, path_second_layer });
+
+    auto first_state = initial_state;
+    const auto first_layer_paths = first_state.processGcodePaths({ path_first_layer });
+    const auto end_flow_state = first_state.end_state;
+    REQUIRE(end_flow_state.flow_state == plugin::gradual_flow::FlowState::TRANSITION);
+    REQUIRE(end_flow_state.discretized_duration_remaining > 0.);
+    REQUIRE(end_flow_state.flow == Catch::Approx(first_layer_paths.back().flow()));
+
+    auto second_state = initial_state;
+    second_state.current_flow = end_flow_state.flow;
+    second_state.discretized_duration_remaining = end_flow_state.discretized_duration_remaining;
+    second_state.flow_state = end_flow_state.flow_state;
+    const auto second_layer_paths = second_state.processGcodePaths({ path_second_layer });
+
+    REQUIRE(first_layer_paths.size() + second_layer_paths.size() == single_layer_paths.size());
+    auto second_layer_path = second_layer_paths.begin();
+    for (const auto& path : single_layer_paths | ranges::views::drop(first_layer_paths.size()))
+    {
+        REQUIRE(second_layer_path->flow() == Catch::Approx(path.flow()));
+        REQUIRE(second_layer_path->totalDuration() == Catch::Approx(path.totalDuration()));
+        ++second_layer_path;
+    }
+
+    // a retract after the last extrusion resets the flow state
+    const auto original_gcode_path_data_retract = mock_retract_msg();
+    const plugin::gradual_flow::GCodePath retract_path{ .original_gcode_path_data = &original_gcode_path_data_retract, .points = { { 0, 130000 }, { 0, 0 } } };
+    auto retracted_state = initial_state;
+    retracted_state.processGcodePaths({ path_first_layer, retract_path });
+    REQUIRE(retracted_state.end_state == plugin::gradual_flow::LayerFlowState{});
+
+    // ending at the target flow is stable
+    REQUIRE(single_state.end_state.flow_state == plugin::gradual_flow::FlowState::STABLE);
+    REQUIRE(single_state.end_state.flow == Catch::Approx(path_second_layer.targetFlow()));
+
+    // when the backward pass slows down the end of the layer, the next layer continues from the flow it ends with
+    auto slowed_state = initial_state;
+    slowed_state.target_end_flow = 0.;
+    const auto slowed_paths = slowed_state.processGcodePaths({ path_first_layer });
+    REQUIRE(slowed_state.end_state.flow_state == plugin::gradual_flow::FlowState::STABLE);
+    REQUIRE(slowed_state.end_state.flow == slowed_paths.back().flow());
+    REQUIRE(slowed_state.end_state.flow < end_flow_state.flow);
+
+    // the engines end in the same state
+    plugin::gradual_flow::WorkerPool pool{ 2 };
+    auto parallel_state = initial_state;
+    plugin::gradual_flow::processGcodePathsParallel(parallel_state, { path_first_layer, retract_path, path_first_layer }, pool);
+    auto serial_state = initial_state;
+    serial_state.processGcodePaths({ path_first_layer, retract_path, path_first_layer });
+    REQUIRE(parallel_state.end_state == serial_state.end_state);
+    plugin::gradual_flow::StreamingGCodeState streaming_state{ initial_state };
+    for (const auto& path : { path_first_layer, retract_path, path_first_layer })
+    {
+        streaming_state.push(path);
+    }
+    streaming_state.finish();
+    REQUIRE(streaming_state.endState() == serial_state.end_state);
+}
+
+TEST_CASE("flow is limited across the layers")
+{
+    // The first layer ends fast and the second layer starts slow. The first layer slows down at its
+    // end towards the flow it starts with, and the second layer continues from the flow the first
+    // ends with, so the flow never changes by more than a step from one layer to the next.
+    const auto settings = mock_settings();
+    const auto layerRequest = [](const std::int64_t layer_nr, const long long y)
+    {
+        request_t layer_request;
+        layer_request.set_extruder_nr(0);
+        layer_request.set_layer_nr(layer_nr);
+        for (const auto& [velocity, points] : { std::pair{ 10., std::vector<long long>{ 0, 10000 } }, std::pair{ 100., std::vector<long long>{ 2010000 } } })
+        {
+            auto* path = layer_request.add_gcode_paths();
+            path->CopyFrom(mock_msg(velocity));
+            for (const auto x : points)
+            {
+                auto* point = path->mutable_path()->add_path();
+                point->set_x(x);
+                point->set_y(y);
+            }
+        }
+        return layer_request;
+    };
+    const auto first_layer_request = layerRequest(1, 0);
+    const auto second_layer_request = layerRequest(2, 10000);
+
+    const generate_t generate{};
+    const auto first_layer_response = generate.modifyGcodePaths(first_layer_request, settings, std::nullopt);
+    const auto second_layer_response = generate.modifyGcodePaths(second_layer_request, settings, first_layer_response.end_flow_state);
+
+    auto gcode_paths = generate_t::gcodePaths(first_layer_response.response);
+    std::ranges::move(generate_t::gcodePaths(second_layer_response.response), std::back_inserter(gcode_paths));
+    const auto fast_flow = generate_t::gcodePaths(first_layer_request).back().flow();
+    REQUIRE(first_layer_response.end_flow_state.flow_state == plugin::gradual_flow::FlowState::STABLE);
+    REQUIRE(first_layer_response.end_flow_state.flow < fast_flow / 2.);
+
+    const auto state = generate_t::gcodeState(second_layer_request, settings, gcode_paths.front().flow(), std::nullopt);
+    const auto violation = plugin::gradual_flow::test::flowLimitViolation(state, gcode_paths);
+    INFO(violation.value_or(""));
+    REQUIRE_FALSE(violation.has_value());
+}
+
+TEST_CASE("coalesce pieces with the same speed")
+{
+    // Pieces of the same original path with the same speed should be merged into one path, without
+    // changing the geometry or the speed profile.
+    const auto original_gcode_path_data_100mm_s = mock_msg(100); // 100mm/s
+    const auto original_gcode_path_data_10mm_s = mock_msg(10); // 10mm/s
+    const plugin::gradual_flow::GCodePath path_slow {
+        .original_gcode_path_data = &original_gcode_path_data_10mm_s,
+        .points = { { 0, 0 }, { 0, 1000 } },
+    };
+    plugin::gradual_flow::GCodePath piece_a {
+        .original_gcode_path_data = &original_gcode_path_data_100mm_s,
+        .points = { { 0, 1000 }, { 0, 2000 }, { 0, 3000 } },
+        .speed = 50000.,
+    };
+    plugin::gradual_flow::GCodePath piece_b {
+        .original_gcode_path_data = &original_gcode_path_data_100mm_s,
+        .points = { { 0, 3000 }, { 0, 4000 } },
+        .speed = 50000.,
+    };
+    plugin::gradual_flow::GCodePath piece_c {
+        .original_gcode_path_data = &original_gcode_path_data_100mm_s,
+        .points = { { 0, 4000 }, { 0, 8000 } },
+    };
+
+    const auto coalesced_paths = plugin::gradual_flow::coalesceGcodePaths({ path_slow, piece_a, piece_b, piece_c });
+
+    REQUIRE(coalesced_paths.size() == 3);
+    REQUIRE(coalesced_paths[1].points == plugin::gradual_flow::geometry::polyline<>{ { 0, 1000 }, { 0, 2000 }, { 0, 3000 }, { 0, 4000 } });
+    REQUIRE(coalesced_paths[1].speed == 50000.);
+    REQUIRE(coalesced_paths[1].total_length == Catch::Approx(coalesced_paths[1].totalLength()));
+    REQUIRE(coalesced_paths[1].totalDuration() == Catch::Approx(piece_a.totalDuration() + piece_b.totalDuration()));
+    REQUIRE(coalesced_paths[2].speed == piece_c.speed);
+}
+
+TEST_CASE("adaptive discretization stays within tolerance")
+{
+    // In adaptive mode every step increases the flow by the tolerance, so the step duration
+    // follows from the flow acceleration; gentle ramps get longer steps than steep ones.
+    const auto original_gcode_path_data = mock_msg();
+    const plugin::gradual_flow::GCodePath path {
+        .original_gcode_path_data = &original_gcode_path_data,
+        .points = { { 0, 0 }, { 0, 100000000 } },
+    };
+
+    const auto flow_step_tolerance = 500000000.;
+    for (const auto flow_acceleration : { 250000000., 1000000000., 4000000000. })
+    {
+        plugin::gradual_flow::GCodeState state {
+            .current_flow = 0.,
+            .flow_acceleration = flow_acceleration,
+            .flow_deceleration = flow_acceleration,
+            .discretized_duration = .1,
+            .target_end_flow = path.targetFlow(),
+            .flow_state = plugin::gradual_flow::FlowState::STABLE,
+            .flow_step_tolerance = flow_step_tolerance,
+        };
+
+        const auto step_duration = state.stepDuration(plugin::gradual_flow::utils::Direction::Forward);
+        REQUIRE(step_duration == Catch::Approx(flow_step_tolerance / flow_acceleration));
+
+        const auto limited_flow_acceleration_paths = state.processGcodePaths({ path });
+        REQUIRE(limited_flow_acceleration_paths.size() == ceil(path.flow() / flow_step_tolerance));
+
+        auto previous_flow = 0.;
+        for (const auto& discretized_path : limited_flow_acceleration_paths | ranges::views::drop_last(1))
+        {
+            REQUIRE(discretized_path.totalDuration() == Catch::Approx(step_duration).epsilon(0.01));
+            REQUIRE(discretized_path.flow() - previous_flow <= flow_step_tolerance * (1. + 1e-6));
+            previous_flow = discretized_path.flow();
+        }
+    }
+}
+
+TEST_CASE("time optimal ramp planner")
+{
+    // The planner should never print slower than the stepped ramps, keep the geometry, and never
+    // change the flow faster than the flow acceleration allows.
+    const auto original_gcode_path_data_100mm_s = mock_msg(100); // 100mm/s
+    const auto original_gcode_path_data_10mm_s = mock_msg(10); // 10mm/s
+    auto original_gcode_path_data_travel = mock_msg(150);
+    original_gcode_path_data_travel.set_flow(0.0);
+
+    std::vector<plugin::gradual_flow::GCodePath> gcode_paths;
+    gcode_paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_10mm_s, .points = { { 0, 0 }, { 0, 20000 } } });
+    gcode_paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_travel, .points = { { 0, 20000 }, { 0, 35000 } } });
+    gcode_paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_100mm_s, .points = { { 0, 35000 }, { 0, 134567 } } });
+    gcode_paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_10mm_s, .points = { { 0, 134567 }, { 0, 144321 } } });
+    gcode_paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = &original_gcode_path_data_100mm_s, .points = { { 0, 144321 }, { 0, 498765 } } });
+
+    const auto flow_acceleration = 1000000000.;
+    const auto step_duration = .1;
+    plugin::gradual_flow::GCodeState state {
+        .current_flow = gcode_paths.front().flow(),
+        .flow_acceleration = flow_acceleration,
+        .flow_deceleration = flow_acceleration,
+        .discretized_duration = step_duration,
+        .target_end_flow = gcode_paths.front().flow(),
+        .reset_flow_duration = 2.,
+    };
+    const auto stepped_paths = state.processGcodePaths(gcode_paths);
+
+    const plugin::gradual_flow::FlowRampPlanner planner {
+        .flow_acceleration = flow_acceleration,
+        .flow_deceleration = flow_acceleration,
+        .acceleration_step_duration = step_duration,
+        .deceleration_step_duration = step_duration,
+        .reset_flow_duration = 2.,
+    };
+    plugin::gradual_flow::WorkerPool pool{ 2 };
+    const auto planned_paths = planner.plan(gcode_paths, plugin::gradual_flow::FlowRampPlanner::unlimited_flow, gcode_paths.front().flow(), pool);
+
+    REQUIRE(plugin::gradual_flow::printDuration(planned_paths) < plugin::gradual_flow::printDuration(stepped_paths));
+
+    auto total_length = 0.;
+    for (const auto& path : gcode_paths)
+    {
+        total_length += path.total_length;
+    }
+    auto planned_length = 0.;
+    for (const auto& path : planned_paths)
+    {
+        planned_length += path.total_length;
+        REQUIRE(path.flow() <= path.targetFlow() * (1. + 1e-9));
+    }
+    REQUIRE(planned_length == Catch::Approx(total_length).epsilon(1e-6));
+
+    // between consecutive pieces the flow changes by at most one step, plus what the travel in between allows
+    std::optional<double> previous_flow;
+    auto travel_duration = 0.;
+    for (const auto& path : planned_paths)
+    {
+        if (path.isTravel())
+        {
+            travel_duration += path.totalDuration();
+            continue;
+        }
+        if (previous_flow.has_value())
+        {
+            REQUIRE(std::abs(path.flow() - *previous_flow) <= flow_acceleration * (step_duration + travel_duration) * (1. + 1e-6));
+        }
+        previous_flow = path.flow();
+        travel_duration = 0.;
+    }
+
+    // without a limit at its end, the layer ends in the flow the forward pass ends in
+    plugin::gradual_flow::LayerFlowState end_flow_state;
+    const auto unlimited_end_paths = planner.plan(gcode_paths, plugin::gradual_flow::FlowRampPlanner::unlimited_flow, plugin::gradual_flow::FlowRampPlanner::unlimited_flow, pool, &end_flow_state);
+    REQUIRE(end_flow_state.flow_state == plugin::gradual_flow::FlowState::STABLE);
+    REQUIRE(end_flow_state.flow == Catch::Approx(unlimited_end_paths.back().flow()));
+
+    // a limited end slows the layer down, the next layer continues from where it slowed down to
+    const auto limited_end_paths = planner.plan(gcode_paths, plugin::gradual_flow::FlowRampPlanner::unlimited_flow, gcode_paths.front().flow(), pool, &end_flow_state);
+    REQUIRE(end_flow_state.flow_state == plugin::gradual_flow::FlowState::STABLE);
+    REQUIRE(end_flow_state.flow == limited_end_paths.back().flow());
+}
+
+TEST_CASE("ramp planner is compared with stepped ramps on request")
+{
+    auto settings = mock_settings();
+    settings.gradual_flow_time_optimal_ramps = { true };
+    const auto layer_request = mock_layer_request(300);
+    generate_t generate{};
+
+    const auto planned_response = generate.modifyGcodePaths(layer_request, settings, std::nullopt);
+    REQUIRE(generate.metrics->planned_layers == 1);
+    REQUIRE(generate.metrics->compared_planned_layers == 0);
+
+    // the comparison only adds to the metrics, the layer is the same
+    generate.compare_planner = true;
+    const auto compared_response = generate.modifyGcodePaths(layer_request, settings, std::nullopt);
+    REQUIRE(generate.metrics->planned_layers == 2);
+    REQUIRE(generate.metrics->compared_planned_layers == 1);
+    REQUIRE(generate.metrics->planner_time_saved >= 0);
+    REQUIRE(compared_response.response.SerializeAsString() == planned_response.response.SerializeAsString());
+}
+
+TEST_CASE("streaming processing matches batch processing")
+{
+    // The streaming state should emit exactly the paths of the batch passes, while only keeping
+    // a bounded window of paths in memory.
+    std::vector<cura::plugins::v0::GCodePath> original_gcode_path_data;
+    for (const auto velocity : { 10.3, 97.1, 25.7, 61.3, 149.9, 5.1 })
+    {
+        original_gcode_path_data.emplace_back(mock_msg(velocity));
+    }
+    auto original_gcode_path_data_travel = mock_msg(150);
+    original_gcode_path_data_travel.set_flow(0.0);
+    const auto original_gcode_path_data_retract = mock_retract_msg();
+
+    std::vector<plugin::gradual_flow::GCodePath> gcode_paths;
+    long long y = 0;
+    for (auto index = 0; index < 3000; ++index)
+    {
+        const auto* data = &original_gcode_path_data[(index * 7 + index / 13) % original_gcode_path_data.size()];
+        if (index % 97 == 0)
+        {
+            data = &original_gcode_path_data_retract;
+        }
+        else if (index % 31 == 0)
+        {
+            data = &original_gcode_path_data_travel;
+        }
+        const auto length = 1013 + (index * 7919) % 19997;
+        gcode_paths.emplace_back(plugin::gradual_flow::GCodePath{ .original_gcode_path_data = data, .points = { { 0, y }, { 0, y + length } } });
+        y += length;
+    }
+
+    const plugin::gradual_flow::GCodeState state {
+        .current_flow = gcode_paths.front().flow(),
+        .flow_acceleration = 1000000000.,
+        .flow_deceleration = 1000000000.,
+        .discretized_duration = .1,
+        .target_end_flow = gcode_paths.front().flow(),
+        .reset_flow_duration = 2.,
+    };
+
+    auto batch_state = state;
+    const auto batch_paths = batch_state.processGcodePaths(gcode_paths);
+
+    plugin::gradual_flow::StreamingGCodeState streaming_state{ state };
+    std::vector<plugin::gradual_flow::GCodePath> streamed_paths;
+    std::size_t max_window_size = 0;
+    for (const auto& path : gcode_paths)
+    {
+        for (auto& finalized_path : streaming_state.push(path))
+        {
+            streamed_paths.emplace_back(std::move(finalized_path));
+        }
+        max_window_size = std::max(max_window_size, streaming_state.windowSize());
+    }
+    for (auto& finalized_path : streaming_state.finish())
+    {
+        streamed_paths.emplace_back(std::move(finalized_path));
+    }
+
+    REQUIRE(streamed_paths.size() == batch_paths.size());
+    for (std::size_t index = 0; index < batch_paths.size(); ++index)
+    {
+        REQUIRE(streamed_paths[index].original_gcode_path_data == batch_paths[index].original_gcode_path_data);
+        REQUIRE(streamed_paths[index].points == batch_paths[index].points);
+        REQUIRE(streamed_paths[index].speed == batch_paths[index].speed);
+    }
+    REQUIRE(max_window_size < batch_paths.size() / 10);
+}
+
+TEST_CASE("chunked layer matches unary layer")
+{
+    // A client that sends a layer in chunks over the streaming service should get back exactly the
+    // paths, and leave exactly the flow state, of a unary request with the whole layer.
+    const auto settings = mock_settings();
+    const auto layer_request = mock_layer_request(3000);
+
+    const auto start_flow_state = GENERATE(
+        std::optional<plugin::gradual_flow::LayerFlowState>{},
+        std::optional{ plugin::gradual_flow::LayerFlowState{ .flow = 1e6, .discretized_duration_remaining = .05, .flow_state = plugin::gradual_flow::FlowState::TRANSITION } });
+    const generate_t generate{};
+    const auto unary_response = generate.modifyGcodePaths(layer_request, settings, start_flow_state);
+
+    for (const auto chunk_size : { 1, 7, 100, 3000 })
+    {
+        plugin::gradual_flow::LayerStream<generate_t> layer_stream{ settings, start_flow_state, { .flow_timeline = true, .svg_dump = true } };
+        response_t streamed_response;
+        std::size_t max_request_count = 0;
+        for (auto begin = 0; begin < layer_request.gcode_paths_size(); begin += chunk_size)
+        {
+            request_t chunk;
+            chunk.set_extruder_nr(layer_request.extruder_nr());
+            chunk.set_layer_nr(layer_request.layer_nr());
+            for (auto index = begin; index < std::min(begin + chunk_size, layer_request.gcode_paths_size()); ++index)
+            {
+                chunk.add_gcode_paths()->CopyFrom(layer_request.gcode_paths(index));
+            }
+            streamed_response.mutable_gcode_paths()->MergeFrom(layer_stream.push(std::move(chunk)).gcode_paths());
+            max_request_count = std::max(max_request_count, layer_stream.requestCount());
+        }
+        streamed_response.mutable_gcode_paths()->MergeFrom(layer_stream.finish().gcode_paths());
+
+        REQUIRE(streamed_response.SerializeAsString() == unary_response.response.SerializeAsString());
+        REQUIRE(layer_stream.endFlowState() == unary_response.end_flow_state);
+        REQUIRE(layer_stream.printTimeImpact().modified_paths == unary_response.print_time_impact.modified_paths);
+        REQUIRE(layer_stream.printTimeImpact().modified_duration == Catch::Approx(unary_response.print_time_impact.modified_duration));
+        REQUIRE(layer_stream.printTimeImpact().original_duration == Catch::Approx(unary_response.print_time_impact.original_duration));
+
+        // the SVG dump gets the same paths as that of the unary layer
+        const auto svg_layer = layer_stream.takeSvgLayer();
+        REQUIRE(svg_layer.has_value());
+        REQUIRE(svg_layer->input_paths.size() == static_cast<std::size_t>(layer_request.gcode_paths_size()));
+        REQUIRE(svg_layer->output_paths.size() == static_cast<std::size_t>(streamed_response.gcode_paths_size()));
+
+        // every returned path is a row of the timeline
+        const auto& timeline_rows = layer_stream.timelineRows();
+        REQUIRE(timeline_rows.size() == static_cast<std::size_t>(streamed_response.gcode_paths_size()));
+        REQUIRE(timeline_rows.path_index.back() == static_cast<std::uint32_t>(layer_request.gcode_paths_size() - 1));
+        REQUIRE(std::ranges::is_sorted(timeline_rows.path_index));
+        REQUIRE(timeline_rows.duration >= unary_response.print_time_impact.modified_duration * (1. - 1e-9)); // and the travels
+
+        // only the requests with paths that are not sent yet are kept
+        const auto request_count = (layer_request.gcode_paths_size() + chunk_size - 1) / chunk_size;
+        REQUIRE(max_request_count <= std::max<std::size_t>(2, static_cast<std::size_t>(request_count) / 10));
+    }
+}
+
+TEST_CASE("shared memory layer matches message layer")
+{
+    // A stand-in engine passes the points of a layer through a shared memory ring; the plugin side
+    // restores them, modifies the layer and writes the modified points back. The result should be
+    // exactly that of a layer with the points in the messages.
+    const auto settings = mock_settings();
+    const auto layer_request = mock_layer_request(3000);
+    const generate_t generate{};
+    const auto message_response = generate.modifyGcodePaths(layer_request, settings, std::nullopt);
+
+    const auto region_name = plugin::shared_memory::regionName("session", std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    plugin::shared_memory::Ring ring{ plugin::shared_memory::Region::create(region_name, 8 * 1024 * 1024) };
+    plugin::shared_memory::Channel channel;
+
+    // the points of the response need more room than those of the request, one of the blocks is too small to hold them
+    for (const auto response_room : { 1.0, 8.0 })
+    {
+        auto request = layer_request;
+        const auto block = ring.allocate(static_cast<std::uint64_t>(static_cast<double>(plugin::shared_memory::blockSize(request.gcode_paths())) * response_room));
+        REQUIRE(block.has_value());
+        plugin::shared_memory::writeBlock(ring.bytes(*block), block->sequence, *request.mutable_gcode_paths());
+        REQUIRE(request.ByteSizeLong() < layer_request.ByteSizeLong());
+
+        channel.read("session", *block, *request.mutable_gcode_paths());
+        REQUIRE(request.SerializeAsString() == layer_request.SerializeAsString());
+        auto response = generate.modifyGcodePaths(request, settings, std::nullopt).response;
+        const auto written = channel.write("session", *block, *response.mutable_gcode_paths());
+        REQUIRE(written == (response_room > 1.0));
+
+        if (written)
+        {
+            plugin::shared_memory::readBlock(ring.bytes(*block), block->sequence, *response.mutable_gcode_paths());
+        }
+        REQUIRE(response.SerializeAsString() == message_response.response.SerializeAsString());
+
+        // a block that was reused by a later call is rejected
+        REQUIRE_THROWS(channel.read("session", { .name = block->name, .offset = block->offset, .size = block->size, .sequence = block->sequence + 1 }, *request.mutable_gcode_paths()));
+        ring.release();
+    }
+
+    // a corrupt point count is rejected before anything is reserved for it
+    for (const auto point_count : { std::uint64_t{ 1 } << 40U, std::numeric_limits<std::uint64_t>::max(), std::uint64_t{ 2 } })
+    {
+        const std::array<std::uint64_t, 5> corrupt_block{ 7, 1, point_count, 0, 0 };
+        auto gcode_paths = layer_request.gcode_paths();
+        gcode_paths.DeleteSubrange(1, gcode_paths.size() - 1);
+        REQUIRE_THROWS_AS(plugin::shared_memory::readBlock(std::as_bytes(std::span{ corrupt_block }), 7, gcode_paths), std::length_error);
+    }
+
+    // a session can only use the regions named after it
+    const auto block = ring.allocate(plugin::shared_memory::blockSize(layer_request.gcode_paths()));
+    REQUIRE(block.has_value());
+    auto request = layer_request;
+    plugin::shared_memory::writeBlock(ring.bytes(*block), block->sequence, *request.mutable_gcode_paths());
+    REQUIRE_THROWS(channel.read("other-session", *block, *request.mutable_gcode_paths()));
+    REQUIRE_THROWS(channel.read("session", { .name = "/gradual_flow_session/../other", .offset = block->offset, .size = block->size, .sequence = block->sequence }, *request.mutable_gcode_paths()));
+    REQUIRE(plugin::shared_memory::isRegionOf(region_name, "session"));
+    REQUIRE_FALSE(plugin::shared_memory::isRegionOf(plugin::shared_memory::regionName("sessions"), "session"));
+    REQUIRE_THROWS_AS(plugin::shared_memory::regionName("session/.."), std::invalid_argument);
+    ring.release();
+
+    // the region is unmapped once the sessions using it ended
+    REQUIRE(channel.size() == 1);
+    channel.close("session");
+    REQUIRE(channel.size() == 0);
+}
+
+TEST_CASE("shared memory ring wraps around")
+{
+    const auto region_name = plugin::shared_memory::regionName("session", std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+    plugin::shared_memory::Ring ring{ plugin::shared_memory::Region::create(region_name, 1000) };
+
+    const auto first = ring.allocate(400);
+    const auto second = ring.allocate(400);
+    REQUIRE(first.has_value());
+    REQUIRE(second.has_value());
+    REQUIRE(second->offset == 400);
+    REQUIRE(second->sequence == first->sequence + 1);
+
+    // full until the oldest block is released, then the next block wraps around to the start
+    REQUIRE_FALSE(ring.allocate(400).has_value());
+    ring.release();
+    const auto third = ring.allocate(396);
+    REQUIRE(third.has_value());
+    REQUIRE(third->offset == 0);
+    REQUIRE(third->size == 400);
+    REQUIRE_FALSE(ring.allocate(8).has_value());
+    ring.release();
+    ring.release();
+    REQUIRE_THROWS_AS(ring.release(), std::logic_error);
+    REQUIRE(ring.allocate(1000).has_value());
+}
+
+TEST_CASE("worker cpu sets")
+{
+    const std::vector<int> cpus{ 0, 1, 2, 3, 4, 5, 8, 9, 10, 11 };
+
+    const auto cpu_sets = plugin::workers::cpuSets(cpus, 3);
+    REQUIRE(cpu_sets == std::vector<std::vector<int>>{ { 0, 1, 2 }, { 3, 4, 5 }, { 8, 9, 10, 11 } });
+
+    // more workers than cpus share them, one cpu each
+    const auto shared_cpu_sets = plugin::workers::cpuSets({ 0, 1 }, 3);
+    REQUIRE(shared_cpu_sets == std::vector<std::vector<int>>{ { 0 }, { 1 }, { 0 } });
+
+    const auto uneven_cpu_sets = plugin::workers::cpuSets(cpus, 4);
+    REQUIRE(uneven_cpu_sets == std::vector<std::vector<int>>{ { 0, 1 }, { 2, 3, 4 }, { 5, 8 }, { 9, 10, 11 } });
+}
+
+TEST_CASE("worker without the settings of the session")
+{
+    // Two workers share the port, each with its own sessions; the settings broadcast of a session
+    // reached the first worker and a call of the session reaches the second one. The second worker
+    // should answer with the original paths instead of failing the call.
+    const auto layer_request = mock_layer_request(100);
+    const auto no_deadline = plugin::AdmissionControl::clock_t::time_point::max();
+    generate_t owner{};
+    generate_t other{};
+    owner.settings->insert_or_assign("session", mock_settings());
+
+    const auto owner_response = owner.call("session", layer_request, no_deadline);
+    REQUIRE(owner_response.SerializeAsString() == owner.modifyGcodePaths(layer_request, mock_settings(), std::nullopt).response.SerializeAsString());
+    REQUIRE(owner.metrics->unknown_session_layers == 0);
+
+    response_t other_response;
+    REQUIRE_NOTHROW(other_response = other.call("session", layer_request, no_deadline));
+    REQUIRE(other_response.gcode_paths().size() == layer_request.gcode_paths().size());
+    for (int index = 0; index < layer_request.gcode_paths_size(); ++index)
+    {
+        REQUIRE(other_response.gcode_paths(index).SerializeAsString() == layer_request.gcode_paths(index).SerializeAsString());
+    }
+    REQUIRE(other.metrics->unknown_session_layers == 1);
+    REQUIRE_FALSE(other.layer_flow_states->find("session", layer_request.extruder_nr(), layer_request.layer_nr() + 1).has_value());
+}
+
+TEST_CASE("admission control misses deadline")
+{
+    using namespace std::chrono_literals;
+    plugin::AdmissionControl admission_control;
+    const auto now = plugin::AdmissionControl::clock_t::now();
+
+    // before the first layer the processing time is a cautious guess
+    const auto initial_estimate = admission_control.estimate(1000);
+    REQUIRE(initial_estimate >= std::chrono::nanoseconds{ static_cast<std::int64_t>(1000 * plugin::AdmissionControl::initial_path_cost) });
+    REQUIRE(admission_control.admit(1000, now + initial_estimate + 1ms, now));
+    REQUIRE_FALSE(admission_control.admit(1000, now + 1ms, now));
+
+    // the first layer replaces the guess
+    admission_control.record(1000, 1s);
+    REQUIRE(admission_control.estimate(1000) == 1250ms);
+    REQUIRE_FALSE(admission_control.admit(1000, now + 1s, now));
+    REQUIRE(admission_control.admit(100, now + 1s, now));
+    REQUIRE(admission_control.admit(1000000, plugin::AdmissionControl::clock_t::time_point::max(), now));
+    REQUIRE_FALSE(admission_control.admit(0, now - 1ms, now));
+
+    // recent layers weigh most
+    const auto previous_estimate = admission_control.estimate(1000);
+    admission_control.record(1000, 0s);
+    REQUIRE(admission_control.estimate(1000) < previous_estimate);
+    REQUIRE(admission_control.estimate(1000) > 0s);
+}
+
+TEST_CASE("admission control only learns from processed layers")
+{
+    const auto layer_request = mock_layer_request(100);
+    const auto no_deadline = plugin::AdmissionControl::clock_t::time_point::max();
+    generate_t generate{};
+    generate.response_cache = std::make_shared<plugin::ResponseCache<response_t>>(1 << 24, generate.metrics);
+    generate.settings->insert_or_assign("session", mock_settings());
+    const auto initial_estimate = generate.admission_control->estimate(100);
+
+    const auto processed_response = generate.call("session", layer_request, no_deadline);
+    const auto processed_estimate = generate.admission_control->estimate(100);
+    REQUIRE(processed_estimate != initial_estimate);
+
+    // the answer from the cache takes next to no time, it is neither admitted nor recorded
+    const auto past_deadline = plugin::AdmissionControl::clock_t::now() - std::chrono::seconds{ 1 };
+    const auto cached_response = generate.call("session", layer_request, past_deadline);
+    REQUIRE(generate.metrics->cache_hits == 1);
+    REQUIRE(generate.metrics->degraded_layers == 0);
+    REQUIRE(cached_response.SerializeAsString() == processed_response.SerializeAsString());
+    REQUIRE(generate.admission_control->estimate(100) == processed_estimate);
+
+    // a layer that has to be processed is not admitted past its deadline
+    auto other_request = layer_request;
+    other_request.mutable_gcode_paths(0)->mutable_speed_derivatives()->set_velocity(12.5);
+    generate.call("session", other_request, past_deadline);
+    REQUIRE(generate.metrics->degraded_layers == 1);
+}
+
+TEST_CASE("sessions expire and stay within the memory budget")
+{
+    using namespace std::chrono_literals;
+    auto metrics = std::make_shared<plugin::Metrics>();
+    const auto start = plugin::Sessions::clock_t::now();
+
+    SECTION("time to live")
+    {
+        plugin::Sessions sessions{ 10min, 1024 * 1024, metrics };
+        plugin::LayerFlowStates layer_flow_states;
+        sessions.onEvict([&layer_flow_states](const std::string& session) { layer_flow_states.erase(session); });
+
+        sessions.insert_or_assign("a", mock_settings(), start);
+        sessions.insert_or_assign("b", mock_settings(), start);
+        layer_flow_states.store("a", 0, 1, plugin::gradual_flow::LayerFlowState{ .flow = 1e6 });
+
+        // seeing a session keeps it alive, the state of an expired session is released with it
+        REQUIRE_NOTHROW(sessions.at("b", start + 8min));
+        REQUIRE_THROWS_AS(sessions.at("a", start + 12min), std::out_of_range);
+        REQUIRE_FALSE(layer_flow_states.find("a", 0, 2).has_value());
+        REQUIRE(sessions.contains("b"));
+        REQUIRE(metrics->evicted_sessions == 1);
+        REQUIRE(metrics->active_sessions == 1);
+    }
+
+    SECTION("memory budget")
+    {
+        plugin::Sessions unbounded_sessions;
+        unbounded_sessions.insert_or_assign("a", mock_settings(), start);
+        const auto session_bytes = unbounded_sessions.bytes();
+
+        // every setting of the schema counts, those of the print features as well
+        auto feature_settings = mock_settings();
+        feature_settings.gradual_flow_support_max_flow_acceleration.resize(1001);
+        unbounded_sessions.insert_or_assign("a", feature_settings, start);
+        REQUIRE(unbounded_sessions.bytes() >= session_bytes + 1000 * sizeof(double));
+        unbounded_sessions.insert_or_assign("a", mock_settings(), start);
+
+        plugin::Sessions sessions{ 10min, 3 * session_bytes, metrics };
+        for (const auto& session : { "a", "b", "c" })
+        {
+            sessions.insert_or_assign(session, mock_settings(), start);
+        }
+        REQUIRE(sessions.size() == 3);
+        REQUIRE(metrics->session_bytes == 3 * session_bytes);
+
+        // the least recently seen session makes room
+        REQUIRE_NOTHROW(sessions.at("a", start + 1s));
+        sessions.insert_or_assign("d", mock_settings(), start + 2s);
+        REQUIRE(sessions.size() == 3);
+        REQUIRE(sessions.contains("a"));
+        REQUIRE_FALSE(sessions.contains("b"));
+        REQUIRE(sessions.bytes() <= 3 * session_bytes);
+    }
+}
+
+TEST_CASE("settings are read with the schema")
+{
+    const auto settings = mock_settings();
+    REQUIRE(settings.gradual_flow_enabled == std::vector<bool>{ true });
+    REQUIRE(settings.max_flow_acceleration == std::vector<double>{ 1e9 });
+    REQUIRE(settings.gradual_flow_discretisation_step_size == std::vector<double>{ 0.2 });
+    REQUIRE(settings.gradual_flow_adaptive_discretisation == std::vector<bool>{ false });
+    REQUIRE(settings.gradual_flow_time_optimal_ramps == std::vector<bool>{ false });
+    REQUIRE(settings.gradual_flow_infill_exempt == std::vector<bool>{ false });
+    REQUIRE(settings.gradual_flow_infill_max_flow_acceleration == std::vector<double>{ 0.0 });
+    REQUIRE(settings.reset_flow_duration == 2.0);
+
+    // every invalid or missing setting is reported at once
+    const auto metadata = std::make_shared<plugin::Metadata>();
+    const auto settingKey = [&metadata](const std::string_view key)
+    {
+        return plugin::Settings::settingKey(key, metadata->plugin_name, metadata->plugin_version);
+    };
+    cura::plugins::slots::broadcast::v0::BroadcastServiceSettingsRequest settings_request;
+    auto& extruder_settings = *settings_request.add_extruder_settings()->mutable_settings();
+    extruder_settings[settingKey("gradual_flow_enabled")] = "yes";
+    extruder_settings[settingKey("max_flow_acceleration")] = "1mm";
+    extruder_settings[settingKey("layer_0_max_flow_acceleration")] = "1";
+    REQUIRE_THROWS_WITH(
+        (plugin::Settings{ settings_request, metadata }),
+        Catch::Matchers::ContainsSubstring("extruder 0: gradual_flow_enabled is 'yes'") && Catch::Matchers::ContainsSubstring("extruder 0: max_flow_acceleration is '1mm'")
+            && Catch::Matchers::ContainsSubstring("extruder 0: gradual_flow_discretisation_step_size is missing")
+            && Catch::Matchers::ContainsSubstring("global: reset_flow_duration is missing"));
+}
+
+TEST_CASE("allocation budget of the layer pipeline")
+{
+    // Budgets for a fixed layer of 300 paths, that is processed into 1489 paths; a change that
+    // allocates more on the hot path fails here. The budgets leave about 10% for differences between
+    // standard libraries. Lower them when a change saves allocations, raise them only deliberately.
+    constexpr std::uint64_t process_allocation_budget{ 20300 }; // measured 18454
+    constexpr std::uint64_t process_byte_budget{ 1150000 }; // measured 1046168
+    constexpr std::uint64_t response_allocation_budget{ 11350 }; // measured 10316
+    constexpr std::uint64_t response_byte_budget{ 877000 }; // measured 797152
+
+    const auto settings = mock_settings();
+    const auto layer_request = mock_layer_request(300);
+    const auto path_count = static_cast<std::uint64_t>(layer_request.gcode_paths_size());
+
+    plugin::gradual_flow::test::Allocations parse_allocations;
+    std::vector<plugin::gradual_flow::GCodePath> gcode_paths;
+    {
+        const plugin::gradual_flow::test::AllocationCounter counter;
+        gcode_paths = generate_t::gcodePaths(layer_request);
+        parse_allocations = counter.allocations();
+    }
+
+    plugin::gradual_flow::test::Allocations process_allocations;
+    std::vector<plugin::gradual_flow::GCodePath> processed_paths;
+    {
+        auto state = generate_t::gcodeState(layer_request, settings, gcode_paths.front().targetFlow(), std::nullopt);
+        const plugin::gradual_flow::test::AllocationCounter counter;
+        processed_paths = state.processGcodePaths(gcode_paths);
+        process_allocations = counter.allocations();
+    }
+
+    plugin::gradual_flow::test::Allocations response_allocations;
+    {
+        response_t response;
+        const plugin::gradual_flow::test::AllocationCounter counter;
+        generate_t::addGcodePaths(response, processed_paths);
+        response_allocations = counter.allocations();
+    }
+
+    // parsing allocates the points of every path once
+    std::uint64_t point_count{ 0 };
+    for (const auto& path : layer_request.gcode_paths())
+    {
+        point_count += static_cast<std::uint64_t>(path.path().path_size()) + 1;
+    }
+    REQUIRE(parse_allocations.count <= path_count + 1);
+    REQUIRE(parse_allocations.bytes <= path_count * sizeof(plugin::gradual_flow::GCodePath) + point_count * sizeof(ClipperLib::IntPoint));
+
+    REQUIRE(process_allocations.count <= process_allocation_budget);
+    REQUIRE(process_allocations.bytes <= process_byte_budget);
+    REQUIRE(response_allocations.count <= response_allocation_budget);
+    REQUIRE(response_allocations.bytes <= response_byte_budget);
+}
+
+TEST_CASE("engines match the reference on random layers")
+{
+    // Every engine must produce the paths of the frozen reference for random layers, settings and
+    // start states, see differential.h. A failing layer is minimized and printed, replay the bytes
+    // with `fuzzedLayer`. The fuzz_differential target searches far more layers than these seeds.
+    const auto seed = GENERATE(range(0u, 300u));
+    const auto input = plugin::gradual_flow::test::randomFuzzInput(seed);
+    const auto difference = plugin::gradual_flow::test::differenceFromReference(plugin::gradual_flow::test::fuzzedLayer(input));
+    if (difference.has_value())
+    {
+        const auto minimized_input = plugin::gradual_flow::test::shrink(
+            input,
+            [](const std::span<const std::uint8_t> candidate)
+            {
+                return plugin::gradual_flow::test::differenceFromReference(plugin::gradual_flow::test::fuzzedLayer(candidate)).has_value();
+            });
+        const auto minimized_layer = plugin::gradual_flow::test::fuzzedLayer(minimized_input);
+        INFO("seed " << seed << ": " << *difference);
+        INFO("minimized input: " << plugin::gradual_flow::test::hex(minimized_input));
+        INFO(plugin::gradual_flow::test::describe(minimized_layer));
+        INFO(plugin::gradual_flow::test::differenceFromReference(minimized_layer).value_or("the minimized input no longer differs"));
+        REQUIRE_FALSE(difference.has_value());
+    }
+}
+
+TEST_CASE("engines match the reference on layers found by the harness")
+{
+    // Minimized inputs of earlier failures, replayed with `fuzzedLayer`.
+    const auto input = GENERATE(
+        // A run of zero length paths, each shorter than the step duration the backward pass carries
+        // into it, holds the flow of the deceleration ramp; the streaming engine finalized paths
+        // before the ramp reached them.
+        std::string_view{ "cd00a36e0000654900000000000043000000004f0000000000008d0000000000000000006500000000000023000000000000000000000000005f0000"
+                          "00000000000000004a2d009000520000647900026600c6001c00687700610064830000" });
+    const auto layer = plugin::gradual_flow::test::fuzzedLayer(plugin::gradual_flow::test::fromHex(input));
+    INFO(plugin::gradual_flow::test::describe(layer));
+    REQUIRE(plugin::gradual_flow::test::differenceFromReference(layer) == std::nullopt);
+}
+
+TEST_CASE("offline gcode processing")
+{
+    const TemporaryDirectory directory;
+    const auto input_path = directory.path / "input.gcode";
+    const auto output_path = directory.path / "output.gcode";
+    const auto input = mock_gcode();
+    std::ofstream{ input_path, std::ios::binary } << input;
+
+    plugin::gradual_flow::WorkerPool worker_pool{ 2 };
+    const auto process = [&](const double flow_acceleration)
+    {
+        const plugin::offline::Options options{ .flow_acceleration = flow_acceleration, .layer_0_flow_acceleration = flow_acceleration };
+        plugin::offline::processFile(input_path, output_path, options, worker_pool);
+        std::ifstream output_file{ output_path, std::ios::binary };
+        return std::string{ std::istreambuf_iterator<char>{ output_file }, std::istreambuf_iterator<char>{} };
+    };
+
+    SECTION("moves within the flow acceleration are copied unchanged")
+    {
+        REQUIRE(process(1e15) == input);
+    }
+
+    SECTION("fast moves after slow moves are split into a ramp")
+    {
+        const auto output = process(1e9);
+        REQUIRE(output != input);
+
+        // the other lines and the slow moves are kept, the fast lines start slower
+        for (const auto line : { ";LAYER:0\nG0 F6000 X10 Y10 Z0.2\n", "G1 F1200 X50 Y10 E1.33041\nG1 X50 Y50 E2.66082\n;TYPE:FILL\nG1 F", ";LAYER:1\n", "G1 F2700 E-1.00877\n" })
+        {
+            REQUIRE_THAT(output, Catch::Matchers::ContainsSubstring(line));
+        }
+        REQUIRE_THAT(output, ! Catch::Matchers::ContainsSubstring("G1 F6000 X90"));
+
+        // the pieces end where the moves end, with the same amount of material
+        const auto ramp_begin = output.find(";TYPE:FILL\n", output.find(";LAYER:1")) + std::string_view{ ";TYPE:FILL\n" }.size();
+        const auto ramp = std::string_view{ output }.substr(ramp_begin, output.find("G0 X10 Y10", ramp_begin) - ramp_begin);
+        const auto ramp_end = plugin::offline::endPosition(ramp, {});
+        REQUIRE(ramp_end.x == Catch::Approx(90.0));
+        REQUIRE(ramp_end.y == Catch::Approx(10.0));
+        REQUIRE(ramp_end.e == Catch::Approx(6.65205));
+        // the feedrate of the move is restored for the travel after it
+        REQUIRE(ramp_end.feedrate == Catch::Approx(6000.0));
+        REQUIRE(std::ranges::count(ramp, '\n') > 2);
+        const auto first_piece = plugin::offline::parseLine(ramp.substr(0, ramp.find('\n')));
+        REQUIRE(first_piece.f.has_value());
+        REQUIRE(*first_piece.f < 6000.0);
+    }
+
+    SECTION("the input is never overwritten by its own output")
+    {
+        const auto hard_link_path = directory.path / "hard_link.gcode";
+        const auto symlink_path = directory.path / "symlink.gcode";
+        std::filesystem::create_hard_link(input_path, hard_link_path);
+        std::filesystem::create_symlink(input_path, symlink_path);
+        const plugin::offline::Options options{ .flow_acceleration = 1e9, .layer_0_flow_acceleration = 1e9 };
+        for (const auto& same_path : { input_path, hard_link_path, symlink_path })
+        {
+            REQUIRE_THROWS_AS(plugin::offline::processFile(input_path, same_path, options, worker_pool), std::runtime_error);
+        }
+        std::ifstream input_file{ input_path, std::ios::binary };
+        REQUIRE(std::string{ std::istreambuf_iterator<char>{ input_file }, std::istreambuf_iterator<char>{} } == input);
+    }
+}
+
+TEST_CASE("svg dump of processed layers")
+{
+    const auto original_gcode_path_data_10mm_s = mock_msg(10);
+    const auto original_gcode_path_data_100mm_s = mock_msg(100);
+    const auto travel_gcode_path_data = mock_retract_msg();
+    const std::vector<plugin::gradual_flow::GCodePath> input_paths{
+        { .original_gcode_path_data = &original_gcode_path_data_10mm_s, .points = { { 0, 0 }, { 10000, 0 } } },
+        { .original_gcode_path_data = &travel_gcode_path_data, .points = { { 10000, 0 }, { 10000, 5000 } } },
+        { .original_gcode_path_data = &original_gcode_path_data_100mm_s, .points = { { 10000, 5000 }, { 0, 5000 } } },
+    };
+    plugin::gradual_flow::GCodeState state {
+        .current_flow = input_paths.front().targetFlow(),
+        .flow_acceleration = 1000000000.,
+        .flow_deceleration = 1000000000.,
+        .discretized_duration = .1,
+        .target_end_flow = input_paths.front().targetFlow(),
+        .flow_state = plugin::gradual_flow::FlowState::STABLE,
+    };
+    const auto output_paths = plugin::gradual_flow::coalesceGcodePaths(state.processGcodePaths(input_paths));
+
+    const TemporaryDirectory temporary_directory;
+    const auto directory = temporary_directory.path / "svg";
+    auto metrics = std::make_shared<plugin::Metrics>();
+
+    SECTION("layers are written by the background thread")
+    {
+        plugin::SvgDump svg_dump{ directory, 4, metrics };
+        REQUIRE(svg_dump.dump(3, 0, input_paths, output_paths));
+        svg_dump.stop();
+        REQUIRE(metrics->written_svg_layers == 1);
+
+        // named after the process, workers dumping to the same directory do not overwrite each other
+        std::ifstream file{ directory / fmt::format("{}_000000_layer_3_extruder_0.svg", ::getpid()), std::ios::binary };
+        const std::string svg{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+        REQUIRE_THAT(svg, Catch::Matchers::StartsWith("<svg "));
+        REQUIRE_THAT(svg, Catch::Matchers::ContainsSubstring("<g id=\"output\""));
+        // the fast line is red, the slow line and the ramp of the output are slower and bluer
+        REQUIRE_THAT(svg, Catch::Matchers::ContainsSubstring("<path d=\"M10 5 L0 5 \" fill=\"none\" stroke=\"rgb(255,0,0)\""));
+        REQUIRE_THAT(svg, Catch::Matchers::ContainsSubstring("stroke=\"black\""));
+        REQUIRE(std::ranges::count(std::string_view{ svg }, '\n') > input_paths.size() + output_paths.size());
+    }
+
+    SECTION("layers are dropped instead of waiting for a full queue")
+    {
+        plugin::SvgDump svg_dump{ directory, 0, metrics };
+        REQUIRE_FALSE(svg_dump.dump(3, 0, input_paths, output_paths));
+        svg_dump.stop();
+        REQUIRE(metrics->dropped_svg_layers == 1);
+        REQUIRE(metrics->written_svg_layers == 0);
+    }
+
+    SECTION("a disabled dump keeps nothing")
+    {
+        plugin::SvgDump svg_dump;
+        REQUIRE_FALSE(svg_dump.enabled());
+        REQUIRE_FALSE(svg_dump.dump(3, 0, input_paths, output_paths));
+    }
+}
+
+TEST_CASE("flow timeline of processed layers")
+{
+    const auto original_gcode_path_data_10mm_s = mock_msg(10);
+    const auto original_gcode_path_data_100mm_s = mock_msg(100);
+    const auto travel_gcode_path_data = mock_retract_msg();
+    const std::vector<plugin::gradual_flow::GCodePath> input_paths{
+        { .original_gcode_path_data = &original_gcode_path_data_10mm_s, .points = { { 0, 0 }, { 10000, 0 } } },
+        { .original_gcode_path_data = &original_gcode_path_data_100mm_s, .points = { { 10000, 0 }, { 10000, 1000000 } } },
+        { .original_gcode_path_data = &travel_gcode_path_data, .points = { { 10000, 1000000 }, { 0, 1000000 } } },
+        { .original_gcode_path_data = &original_gcode_path_data_10mm_s, .points = { { 0, 1000000 }, { 0, 0 } } },
+    };
+    plugin::gradual_flow::GCodeState state {
+        .current_flow = input_paths.front().targetFlow(),
+        .flow_acceleration = 10000000000.,
+        .flow_deceleration = 10000000000.,
+        .discretized_duration = .1,
+        .target_end_flow = input_paths.front().targetFlow(),
+        .flow_state = plugin::gradual_flow::FlowState::STABLE,
+    };
+    const auto output_paths = plugin::gradual_flow::coalesceGcodePaths(state.processGcodePaths(input_paths));
+
+    const TemporaryDirectory directory;
+    const auto path = directory.path / "timeline.bin";
+    {
+        plugin::FlowTimeline timeline{ path };
+        timeline.record(3, 0, input_paths, output_paths);
+        timeline.record(4, 1, input_paths, output_paths);
+    }
+
+    const plugin::FlowTimelineReader reader{ path };
+    REQUIRE(reader.layers().size() == 2);
+    const auto& layer = reader.layers()[1];
+    REQUIRE(layer.layer_nr == 4);
+    REQUIRE(layer.extruder_nr == 1);
+    REQUIRE(layer.time.size() == output_paths.size());
+    REQUIRE(layer.duration == Catch::Approx(plugin::gradual_flow::printDuration(output_paths)));
+    REQUIRE(layer.time.front() == 0.0);
+    REQUIRE(std::ranges::is_sorted(layer.time));
+    REQUIRE(layer.path_index.front() == 0);
+    REQUIRE(layer.path_index.back() == 3);
+    REQUIRE(std::ranges::is_sorted(layer.path_index));
+    REQUIRE(std::ranges::count(layer.flow_state, static_cast<std::uint8_t>(plugin::gradual_flow::FlowState::UNDEFINED)) == 1);
+
+    // the fast line ramps up from 1 to 10 mm³/s, and down again to the flow the layer ends with
+    const auto summary = plugin::summarize(layer);
+    REQUIRE(summary.ramp_count == 2);
+    REQUIRE(summary.peak_flow == Catch::Approx(10.0));
+    REQUIRE(summary.transition_duration > 0.0);
+    REQUIRE(summary.transition_duration < summary.duration);
+
+    // worker processes append to the same file, every layer is written whole
+    std::filesystem::remove(path);
+    {
+        std::vector<std::thread> workers;
+        for (auto worker = 0; worker < 4; ++worker)
+        {
+            workers.emplace_back(
+                [&path, &input_paths, &output_paths, worker]()
+                {
+                    plugin::FlowTimeline timeline{ path };
+                    for (auto layer_nr = 0; layer_nr < 100; ++layer_nr)
+                    {
+                        timeline.record(layer_nr, worker, input_paths, output_paths);
+                    }
+                });
+        }
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+    }
+    const plugin::FlowTimelineReader shared_reader{ path };
+    REQUIRE(shared_reader.layers().size() == 400);
+    REQUIRE(std::ranges::all_of(shared_reader.layers(), [&output_paths](const auto& shared_layer) { return shared_layer.time.size() == output_paths.size(); }));
+
+    // a layer answered from the response cache is in the timeline as well
+    std::filesystem::remove(path);
+    {
+        const auto no_deadline = plugin::AdmissionControl::clock_t::time_point::max();
+        generate_t generate{};
+        generate.response_cache = std::make_shared<plugin::ResponseCache<response_t>>(1 << 24, generate.metrics);
+        generate.flow_timeline = std::make_shared<plugin::FlowTimeline>(path);
+        generate.settings->insert_or_assign("a", mock_settings());
+        generate.settings->insert_or_assign("b", mock_settings());
+        const auto layer_request = mock_layer_request(100);
+        generate.call("a", layer_request, no_deadline);
+        generate.call("b", layer_request, no_deadline);
+        REQUIRE(generate.metrics->cache_hits == 1);
+    }
+    const plugin::FlowTimelineReader cached_reader{ path };
+    REQUIRE(cached_reader.layers().size() == 2);
+    REQUIRE(std::ranges::equal(cached_reader.layers()[1].time, cached_reader.layers()[0].time));
+    REQUIRE(std::ranges::equal(cached_reader.layers()[1].path_index, cached_reader.layers()[0].path_index));
+    REQUIRE(cached_reader.layers()[1].path_index.back() == 99);
+}
+
+TEST_CASE("print time impact per session")
+{
+    const auto original_gcode_path_data_10mm_s = mock_msg(10);
+    const auto original_gcode_path_data_100mm_s = mock_msg(100);
+    const auto travel_gcode_path_data = mock_retract_msg();
+    const std::vector<plugin::gradual_flow::GCodePath> input_paths{
+        { .original_gcode_path_data = &original_gcode_path_data_10mm_s, .points = { { 0, 0 }, { 10000, 0 } } },
+        { .original_gcode_path_data = &original_gcode_path_data_100mm_s, .points = { { 10000, 0 }, { 10000, 100000 } } },
+        { .original_gcode_path_data = &travel_gcode_path_data, .points = { { 10000, 100000 }, { 0, 100000 } } },
+    };
+    plugin::gradual_flow::GCodeState state {
+        .current_flow = input_paths.front().targetFlow(),
+        .flow_acceleration = 1000000000.,
+        .flow_deceleration = 1000000000.,
+        .discretized_duration = .1,
+        .target_end_flow = input_paths.front().targetFlow(),
+        .flow_state = plugin::gradual_flow::FlowState::STABLE,
+    };
+    const auto output_paths = plugin::gradual_flow::coalesceGcodePaths(state.processGcodePaths(input_paths));
+
+    // the travel is not counted, the 10 mm line takes 1 s and the 100 mm line 1 s at their target speeds
+    const auto impact = plugin::printTimeImpact(input_paths, output_paths);
+    REQUIRE(impact.layers == 1);
+    REQUIRE(impact.original_paths == 2);
+    REQUIRE(impact.original_duration == Catch::Approx(2.0));
+    REQUIRE(impact.modified_paths == output_paths.size() - 1);
+    REQUIRE(impact.splitPaths() == impact.modified_paths - 2);
+    REQUIRE(impact.addedDuration() > 0.0);
+    REQUIRE(impact.modified_duration == Catch::Approx(plugin::gradual_flow::printDuration(output_paths) - output_paths.back().totalDuration()));
+
+    plugin::PrintTimeImpacts impacts;
+    impacts.add("a", impact);
+    impacts.add("a", impact);
+    impacts.add("b", impact);
+    REQUIRE(impacts.find("a")->layers == 2);
+    REQUIRE(impacts.find("a")->addedDuration() == Catch::Approx(2. * impact.addedDuration()));
+    REQUIRE(impacts.find("a")->addedFraction() == Catch::Approx(impact.addedFraction()));
+    impacts.erase("a");
+    REQUIRE_FALSE(impacts.find("a").has_value());
+    REQUIRE(impacts.find("b")->layers == 1);
+}
+
+TEST_CASE("feature policies")
+{
+    using cura::plugins::v0::PrintFeature;
+    auto wall_gcode_path_data = mock_msg(10);
+    wall_gcode_path_data.set_feature(PrintFeature::OUTERWALL);
+    auto infill_gcode_path_data = mock_msg(100);
+    infill_gcode_path_data.set_feature(PrintFeature::INFILL);
+    const std::vector<plugin::gradual_flow::GCodePath> gcode_paths{
+        { .original_gcode_path_data = &wall_gcode_path_data, .points = { { 0, 0 }, { 10000, 0 } } },
+        { .original_gcode_path_data = &infill_gcode_path_data, .points = { { 10000, 0 }, { 10000, 100000 } } },
+        { .original_gcode_path_data = &wall_gcode_path_data, .points = { { 10000, 100000 }, { 0, 100000 } } },
+    };
+    const auto process = [&gcode_paths](const plugin::gradual_flow::FeaturePolicies* feature_policies)
+    {
+        plugin::gradual_flow::GCodeState state {
+            .current_flow = gcode_paths.front().targetFlow(),
+            .flow_acceleration = 1000000000.,
+            .flow_deceleration = 1000000000.,
+            .discretized_duration = .1,
+            .target_end_flow = gcode_paths.front().targetFlow(),
+            .flow_state = plugin::gradual_flow::FlowState::STABLE,
+            .feature_policies = feature_policies,
+        };
+        return plugin::gradual_flow::coalesceGcodePaths(state.processGcodePaths(gcode_paths));
+    };
+    const auto ramped_paths = process(nullptr);
+    REQUIRE(ramped_paths.size() > 3);
+
+    SECTION("exempt features keep their speed")
+    {
+        plugin::gradual_flow::FeaturePolicies feature_policies{};
+        feature_policies[PrintFeature::INFILL].exempt = true;
+        const auto paths = process(&feature_policies);
+        REQUIRE(paths.size() == 3);
+        for (const auto& path : paths)
+        {
+            REQUIRE(path.speed == path.targetSpeed());
+        }
+    }
+
+    SECTION("features ramp with their own flow acceleration")
+    {
+        plugin::gradual_flow::FeaturePolicies feature_policies{};
+        feature_policies[PrintFeature::INFILL].flow_acceleration = 5000000000.;
+        const auto paths = process(&feature_policies);
+        REQUIRE(paths.size() > 3);
+        REQUIRE(paths.size() < ramped_paths.size());
+        REQUIRE(plugin::gradual_flow::printDuration(paths) < plugin::gradual_flow::printDuration(ramped_paths));
+        REQUIRE(plugin::gradual_flow::test::flowLimitViolation(plugin::gradual_flow::GCodeState{ .flow_acceleration = 5000000000., .flow_deceleration = 5000000000., .discretized_duration = .1 }, paths) == std::nullopt);
+    }
+
+    SECTION("policies are read from the settings")
+    {
+        auto settings = mock_settings();
+        request_t layer_request;
+        layer_request.set_layer_nr(3);
+        REQUIRE_FALSE(generate_t::featurePolicies(layer_request, settings).has_value());
+
+        settings.gradual_flow_support_exempt = { true };
+        settings.gradual_flow_infill_max_flow_acceleration = { 2e9 };
+        const auto feature_policies = generate_t::featurePolicies(layer_request, settings);
+        REQUIRE(feature_policies.has_value());
+        REQUIRE((*feature_policies)[PrintFeature::SUPPORTINFILL].exempt);
+        REQUIRE((*feature_policies)[PrintFeature::INFILL].flow_acceleration == 2e9);
+        REQUIRE((*feature_policies)[PrintFeature::OUTERWALL] == plugin::gradual_flow::FeaturePolicy{});
+
+        // the initial layer ramps every feature with its own limit
+        layer_request.set_layer_nr(0);
+        REQUIRE((*generate_t::featurePolicies(layer_request, settings))[PrintFeature::INFILL].flow_acceleration == 0.0);
+    }
+}
+
+TEST_CASE("engines honor the feature policies")
+{
+    // the serial engine applies the policies per path; the others have to give the same paths
+    const auto seed = GENERATE(range(0u, 100u));
+    auto layer = plugin::gradual_flow::test::fuzzedLayer(plugin::gradual_flow::test::randomFuzzInput(seed));
+    std::mt19937 generator{ seed };
+    plugin::gradual_flow::FeaturePolicies feature_policies{};
+    for (auto& policy : feature_policies)
+    {
+        policy.exempt = generator() % 4 == 0;
+        policy.flow_acceleration = generator() % 2 == 0 ? 0. : std::pow(10., 7.5 + 3. * std::generate_canonical<double, 32>(generator));
+    }
+    for (auto& message : layer.messages)
+    {
+        message.set_feature(static_cast<cura::plugins::v0::PrintFeature>(generator() % cura::plugins::v0::PrintFeature_ARRAYSIZE));
+    }
+    layer.state.feature_policies = &feature_policies;
+
+    auto serial_state = layer.state;
+    const auto serial_paths = serial_state.processGcodePaths(layer.gcode_paths);
+    INFO("seed " << seed);
+    REQUIRE(plugin::gradual_flow::test::flowLimitViolation(layer.state, serial_paths) == std::nullopt);
+    for (const auto& engine : plugin::gradual_flow::test::engines())
+    {
+        auto state = layer.state;
+        const auto difference = plugin::gradual_flow::test::pathsDifference(serial_paths, engine.process(state, layer.gcode_paths));
+        INFO(engine.name << ", seed " << seed);
+        REQUIRE(difference == std::nullopt);
+    }
+}
+
+TEST_CASE("fixed point arithmetic at the limits of its ranges")
+{
+    using plugin::gradual_flow::fixed_point::isqrt;
+    using plugin::gradual_flow::fixed_point::segmentLength;
+    constexpr auto length_unit = 1 << plugin::gradual_flow::fixed_point::length_bits;
+
+    REQUIRE(isqrt(0) == 0);
+    REQUIRE(isqrt(99) == 9);
+    REQUIRE(isqrt(100) == 10);
+    REQUIRE(isqrt(std::numeric_limits<std::uint64_t>::max()) == 0xffffffffULL);
+
+    REQUIRE(segmentLength({ 0, 0 }, { 3000, 4000 }) == 5000 * length_unit);
+    REQUIRE(segmentLength({ 0, 0 }, { -1000000, 0 }) == 1000000 * length_unit);
+    // 14 m is exact to 1/256 um, 20 m to 1 um
+    REQUIRE(std::abs(static_cast<double>(segmentLength({ 0, 0 }, { 10000000, 10000000 })) - std::hypot(1e7, 1e7) * length_unit) <= 1.);
+    REQUIRE(std::abs(static_cast<double>(segmentLength({ 0, 0 }, { 12000000, 16000000 })) - 2e7 * length_unit) <= length_unit);
+    // longer segments saturate instead of wrapping around
+    const auto saturated_length = segmentLength({ 0, 0 }, { 4000000000, 0 });
+    REQUIRE(saturated_length >= segmentLength({ 0, 0 }, { 2000000000, 0 }));
+    REQUIRE(saturated_length == segmentLength({ -4000000000, 0 }, { 4000000000, 0 }));
+}
+
+TEST_CASE("fixed point kernel gives the same paths everywhere")
+{
+    // The layers, and thus the digests, only depend on integer arithmetic and on the basic floating
+    // point operations; a change of the digests is a change of the output of the kernel.
+    const auto digest = [](const std::uint32_t seed, const bool with_policies)
+    {
+        std::mt19937 generator{ seed };
+        std::vector<std::uint8_t> data(1000);
+        for (auto& value : data)
+        {
+            value = static_cast<std::uint8_t>(generator() & 0xffU);
+        }
+        auto layer = plugin::gradual_flow::test::fuzzedLayer(data);
+        layer.state = plugin::gradual_flow::GCodeState{
+            .current_flow = 2e9,
+            .flow_acceleration = 1e9,
+            .flow_deceleration = 5e8,
+            .discretized_duration = .1,
+            .target_end_flow = 1e9,
+            .reset_flow_duration = 2.,
+            .flow_state = plugin::gradual_flow::FlowState::STABLE,
+        };
+        plugin::gradual_flow::FeaturePolicies feature_policies{};
+        if (with_policies)
+        {
+            feature_policies[cura::plugins::v0::PrintFeature::INFILL].exempt = true;
+            feature_policies[cura::plugins::v0::PrintFeature::OUTERWALL].flow_acceleration = 2e8;
+            for (auto [index, message] : layer.messages | ranges::views::enumerate)
+            {
+                message.set_feature(static_cast<cura::plugins::v0::PrintFeature>(index % cura::plugins::v0::PrintFeature_ARRAYSIZE));
+            }
+            layer.state.flow_step_tolerance = 5e7;
+            layer.state.feature_policies = &feature_policies;
+        }
+
+        plugin::gradual_flow::FixedPointGCodeState state{ layer.state };
+        const auto paths = state.processGcodePaths(layer.gcode_paths);
+        REQUIRE(paths.size() > layer.gcode_paths.size()); // the layer has ramps
+        std::string text;
+        for (const auto& path : paths)
+        {
+            for (const auto& point : path.points)
+            {
+                text += fmt::format("{} {} ", point.X, point.Y);
+            }
+            text += fmt::format("{}\n", path.speed); // the shortest exact representation
+        }
+        return plugin::hashBytes(text);
+    };
+
+    CHECK(digest(1, false) == 0xd116806b5e7dd5e4ULL);
+    CHECK(digest(2, false) == 0xe29bda18254c7348ULL);
+    CHECK(digest(3, true) == 0x399b12e554e14d89ULL);
+}
+
+TEST_CASE("fixed point kernel quantified against the double kernel")
+{
+    // The double kernel truncates partition points towards zero and measures the rest of a path on
+    // them, so its pieces drift along a ramp; the fixed point kernel measures on the original
+    // segments. Where the drift moves the end of a ramp across a path or a step, the two split a
+    // layer differently, so the differences are bounded over many layers instead of per path.
+    std::vector<double> duration_differences; // relative, of the extrusion time of a layer
+    auto max_speed_difference = 0.0; // relative, of the layers that both split into the same pieces
+    std::size_t same_pieces = 0;
+    for (auto seed = 0u; seed < 500u; ++seed)
+    {
+        auto layer = plugin::gradual_flow::test::fuzzedLayer(plugin::gradual_flow::test::randomFuzzInput(seed));
+        std::mt19937 generator{ seed };
+        plugin::gradual_flow::FeaturePolicies feature_policies{};
+        if (seed % 2 == 1)
+        {
+            for (auto& policy : feature_policies)
+            {
+                policy.exempt = generator() % 4 == 0;
+                policy.flow_acceleration = generator() % 2 == 0 ? 0. : std::pow(10., 7.5 + 3. * std::generate_canonical<double, 32>(generator));
+            }
+            for (auto& message : layer.messages)
+            {
+                message.set_feature(static_cast<cura::plugins::v0::PrintFeature>(generator() % cura::plugins::v0::PrintFeature_ARRAYSIZE));
+            }
+            layer.state.feature_policies = &feature_policies;
+        }
+
+        auto double_state = layer.state;
+        const auto double_paths = plugin::gradual_flow::coalesceGcodePaths(double_state.processGcodePaths(layer.gcode_paths));
+        plugin::gradual_flow::FixedPointGCodeState fixed_state{ layer.state };
+        const auto fixed_paths = fixed_state.processGcodePaths(layer.gcode_paths);
+        INFO("seed " << seed);
+        REQUIRE(plugin::gradual_flow::test::flowLimitViolation(layer.state, fixed_paths) == std::nullopt);
+
+        // processing the layer again gives exactly the same paths
+        plugin::gradual_flow::FixedPointGCodeState repeated_state{ layer.state };
+        const auto repeated_paths = repeated_state.processGcodePaths(layer.gcode_paths);
+        REQUIRE(repeated_paths.size() == fixed_paths.size());
+        for (std::size_t index = 0; index < fixed_paths.size(); ++index)
+        {
+            REQUIRE(repeated_paths[index].points == fixed_paths[index].points);
+            REQUIRE(repeated_paths[index].speed == fixed_paths[index].speed);
+        }
+
+        const auto extrusion_duration = [](const std::vector<plugin::gradual_flow::GCodePath>& paths)
+        {
+            auto duration = 0.0;
+            for (const auto& path : paths)
+            {
+                duration += path.isTravel() ? 0.0 : path.totalDuration();
+            }
+            return duration;
+        };
+        const auto double_duration = extrusion_duration(double_paths);
+        const auto fixed_duration = extrusion_duration(fixed_paths);
+        duration_differences.emplace_back(double_duration > 0.0 ? std::abs(fixed_duration - double_duration) / double_duration : 0.0);
+
+        const auto coalesced_fixed_paths = plugin::gradual_flow::coalesceGcodePaths(std::vector<plugin::gradual_flow::GCodePath>(fixed_paths));
+        auto same = coalesced_fixed_paths.size() == double_paths.size();
+        for (std::size_t index = 0; same && index < double_paths.size(); ++index)
+        {
+            same = coalesced_fixed_paths[index].original_gcode_path_data == double_paths[index].original_gcode_path_data
+                && coalesced_fixed_paths[index].points.size() == double_paths[index].points.size();
+        }
+        if (same)
+        {
+            same_pieces++;
+            for (std::size_t index = 0; index < double_paths.size(); ++index)
+            {
+                max_speed_difference = std::max(max_speed_difference, std::abs(coalesced_fixed_paths[index].speed - double_paths[index].speed) / double_paths[index].speed);
+            }
+        }
+    }
+
+    std::sort(duration_differences.begin(), duration_differences.end());
+    const auto quantile = [&duration_differences](const double fraction)
+    {
+        return duration_differences[static_cast<std::size_t>(fraction * static_cast<double>(duration_differences.size() - 1))];
+    };
+    // measured: a median of 4e-5, 5e-4 at 90% and 1e-2 at 99%; the largest differences are layers where
+    // the double kernel holds a flow through a run of pieces shorter than the carried step duration
+    CHECK(quantile(0.5) < 1e-4);
+    CHECK(quantile(0.9) < 1e-3);
+    CHECK(quantile(0.99) < 5e-2);
+    // measured: 1e-7, the speeds are in 2^-24 um/s and the flows in um^3/s
+    CHECK(max_speed_difference < 1e-6);
+    // measured: about half of the layers
+    CHECK(same_pieces >= 200);
+}
@@ -0,0 +1,206 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#ifndef TESTS_REFERENCE_GCODE_STATE_H
+#define TESTS_REFERENCE_GCODE_STATE_H
+
+#include "gradual_flow/gcode_path.h"
+
+#include <algorithm>
+#include <cmath>
+#include <list>
+#include <optional>
+#include <tuple>
+#include <vector>
+
+/*
+ * The gradual flow passes as GCodeState::processGcodePaths implemented them before any of them were
+ * optimized, frozen as the reference the optimized engines are compared with.
+ *
+ * Keep this implementation simple and do not optimize it; it only uses the data of GCodePath and
+ * GCodeState, not the processing functions under test.
+ */
+namespace plugin::gradual_flow::reference
+{
+
+/*
+ * Splits either the beginning or the end of the path into a new path.
+ *
+ * @return a tuple of the partitioned path, the remaining path if any, and the duration that is left
+ * when the partitioned path is the whole path
+ */
+inline std::tuple<GCodePath, std::optional<GCodePath>, double>
+    partition(const GCodePath& path, const double partition_duration, const double partition_speed, const utils::Direction direction)
+{
+    const auto& points = path.points;
+    const auto total_path_duration = path.total_length / partition_speed;
+    if (partition_duration >= total_path_duration)
+    {
+        const GCodePath gcode_path{ .original_gcode_path_data = path.original_gcode_path_data, .points = points, .speed = partition_speed };
+        return std::make_tuple(gcode_path, std::nullopt, partition_duration - total_path_duration);
+    }
+
+    auto current_partition_duration = 0.0;
+    auto partition_index = direction == utils::Direction::Forward ? 0 : points.size() - 1;
+    const auto iteration_direction = direction == utils::Direction::Forward ? 1 : -1;
+    auto prev_point = points[partition_index];
+    while (true)
+    {
+        const auto next_point = points[partition_index + iteration_direction];
+        const auto segment_length = std::hypot(next_point.X - prev_point.X, next_point.Y - prev_point.Y);
+        const auto segment_duration = segment_length / partition_speed;
+        if (current_partition_duration + segment_duration < partition_duration)
+        {
+            prev_point = next_point;
+            current_partition_duration += segment_duration;
+            partition_index += iteration_direction;
+            continue;
+        }
+
+        const auto segment_ratio = (partition_duration - current_partition_duration) / segment_duration;
+        const auto partition_x = prev_point.X + static_cast<long long>(static_cast<double>(next_point.X - prev_point.X) * segment_ratio);
+        const auto partition_y = prev_point.Y + static_cast<long long>(static_cast<double>(next_point.Y - prev_point.Y) * segment_ratio);
+        const auto partition_point = ClipperLib::IntPoint(partition_x, partition_y);
+
+        // the points up to partition_point_index are left of the partition point, the others right of it
+        const auto partition_point_index = direction == utils::Direction::Forward ? partition_index + 1 : partition_index;
+        geometry::polyline<> left_points;
+        for (unsigned int i = 0; i < partition_point_index; ++i)
+        {
+            left_points.emplace_back(points[i]);
+        }
+        left_points.emplace_back(partition_point);
+        geometry::polyline<> right_points;
+        right_points.emplace_back(partition_point);
+        for (unsigned int i = partition_point_index; i < points.size(); ++i)
+        {
+            right_points.emplace_back(points[i]);
+        }
+
+        const auto& partition_points = direction == utils::Direction::Forward ? left_points : right_points;
+        const auto& remaining_points = direction == utils::Direction::Forward ? right_points : left_points;
+        const GCodePath partition_gcode_path{ .original_gcode_path_data = path.original_gcode_path_data, .points = partition_points, .speed = partition_speed };
+        const GCodePath remaining_gcode_path{ .original_gcode_path_data = path.original_gcode_path_data, .points = remaining_points, .speed = path.speed };
+        return std::make_tuple(partition_gcode_path, remaining_gcode_path, .0);
+    }
+}
+
+inline double stepDuration(const GCodeState& state, const utils::Direction direction)
+{
+    const auto acceleration = direction == utils::Direction::Forward ? state.flow_acceleration : state.flow_deceleration;
+    if (state.flow_step_tolerance <= 0. || acceleration <= 0.)
+    {
+        return state.discretized_duration;
+    }
+    return std::max(GCodeState::min_discretized_duration, state.flow_step_tolerance / acceleration);
+}
+
+inline std::vector<GCodePath> processGcodePath(GCodeState& state, const GCodePath& path, const utils::Direction direction)
+{
+    const auto is_travel = path.extrusionVolumePerMm() * path.targetSpeed() <= 0;
+    if (is_travel)
+    {
+        if (path.original_gcode_path_data->retract() || path.total_length / path.speed > state.reset_flow_duration)
+        {
+            state.flow_state = FlowState::UNDEFINED;
+        }
+        return { path };
+    }
+
+    if (state.flow_state == FlowState::UNDEFINED && direction == utils::Direction::Forward)
+    {
+        state.current_flow = path.extrusionVolumePerMm() * path.targetSpeed();
+    }
+
+    const auto target_flow = path.flow_;
+    if (target_flow <= state.current_flow)
+    {
+        state.current_flow = target_flow;
+        state.discretized_duration_remaining = 0;
+        state.flow_state = FlowState::STABLE;
+        return { path };
+    }
+
+    const auto extrusion_volume_per_mm = path.extrusionVolumePerMm();
+    std::vector<GCodePath> discretized_paths;
+    GCodePath remaining_path = path;
+
+    if (state.discretized_duration_remaining > 0.)
+    {
+        const auto [partitioned_gcode_path, new_remaining_path, remaining_partition_duration]
+            = partition(path, state.discretized_duration_remaining, state.current_flow / extrusion_volume_per_mm, direction);
+        state.discretized_duration_remaining = std::max(.0, state.discretized_duration_remaining - remaining_partition_duration);
+        if (! new_remaining_path.has_value())
+        {
+            state.flow_state = FlowState::TRANSITION;
+            return { partitioned_gcode_path };
+        }
+        remaining_path = new_remaining_path.value();
+        discretized_paths.emplace_back(partitioned_gcode_path);
+    }
+
+    const auto step_duration = stepDuration(state, direction);
+    while (state.current_flow < target_flow)
+    {
+        const auto flow_delta = (direction == utils::Direction::Forward ? state.flow_acceleration : state.flow_deceleration) * step_duration;
+        state.current_flow = std::min(target_flow, state.current_flow + flow_delta);
+        const auto segment_speed = state.current_flow / extrusion_volume_per_mm;
+
+        if (state.current_flow == target_flow)
+        {
+            remaining_path.speed = segment_speed;
+            state.discretized_duration_remaining = std::max(state.discretized_duration_remaining - remaining_path.total_length / remaining_path.speed, .0);
+            state.flow_state = state.discretized_duration_remaining > 0. ? FlowState::TRANSITION : FlowState::STABLE;
+            discretized_paths.emplace_back(remaining_path);
+            return discretized_paths;
+        }
+
+        const auto [partitioned_gcode_path, new_remaining_path, remaining_partition_duration] = partition(remaining_path, step_duration, segment_speed, direction);
+        discretized_paths.emplace_back(partitioned_gcode_path);
+        if (! new_remaining_path.has_value())
+        {
+            state.flow_state = FlowState::TRANSITION;
+            state.discretized_duration_remaining = remaining_partition_duration;
+            return discretized_paths;
+        }
+        remaining_path = new_remaining_path.value();
+    }
+    discretized_paths.emplace_back(remaining_path);
+    state.flow_state = state.discretized_duration_remaining > 0. ? FlowState::TRANSITION : FlowState::STABLE;
+    return discretized_paths;
+}
+
+/*
+ * Applies the forward pass, that limits the flow acceleration, and then the backward pass, that
+ * limits the flow deceleration, to the paths of a layer.
+ *
+ * @param state the state to start the layer with, updated to the state after the backward pass
+ */
+inline std::vector<GCodePath> processGcodePaths(GCodeState& state, const std::vector<GCodePath>& gcode_paths)
+{
+    std::vector<GCodePath> forward_pass_gcode_paths;
+    for (const auto& gcode_path : gcode_paths)
+    {
+        for (auto& path : processGcodePath(state, gcode_path, utils::Direction::Forward))
+        {
+            forward_pass_gcode_paths.emplace_back(path);
+        }
+    }
+
+    state.discretized_duration_remaining = 0;
+    state.current_flow = std::min(state.current_flow, state.target_end_flow);
+
+    std::list<GCodePath> backward_pass_gcode_paths;
+    for (auto it = forward_pass_gcode_paths.rbegin(); it != forward_pass_gcode_paths.rend(); ++it)
+    {
+        for (auto& path : processGcodePath(state, *it, utils::Direction::Backward))
+        {
+            backward_pass_gcode_paths.emplace_front(path);
+        }
+    }
+    return { backward_pass_gcode_paths.begin(), backward_pass_gcode_paths.end() };
+}
+
+} // namespace plugin::gradual_flow::reference
+
+#endif // TESTS_REFERENCE_GCODE_STATE_H
@@ -0,0 +1,232 @@
+// Copyright (c) 2023 UltiMaker
+// CuraEngine is released under the terms of the AGPLv3 or higher.
+
+#define CATCH_CONFIG_MAIN
+
+#include "gradual_flow/flow_ramp_planner.h"
+#include "gradual_flow/gcode_path.h"
+#include "gradual_flow/worker_pool.h"
+#include "plugin/modify.h"
+#include "allocation_counter.h"
+
+#include <catch2/catch_all.hpp>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+ * The scaling suite processes layers of doubling size and fits how the time and the allocated
+ * memory of every stage of the pipeline grow with the size of the layer. A stage fails when it grows
+ * faster than linear beyond the tolerance, e.g. because it copies the rest of a path for every piece
+ * it splits off.
+ *
+ * The suite runs for several seconds and is labelled "scaling", run it with `ctest -L scaling`.
+ */
+
+using request_t = cura::plugins::slots::gcode_paths::v0::modify::CallRequest;
+using response_t = cura::plugins::slots::gcode_paths::v0::modify::CallResponse;
+using generate_t = plugin::gradual_flow::Generate<cura::plugins::slots::gcode_paths::v0::modify::GCodePathsModifyService::AsyncService, response_t, request_t>;
+
+// The largest layers no longer fit in the caches and are slower per path than the smallest ones, a
+// linear stage can measure an exponent of up to 1.3 for time. A stage that is quadratic in the size
+// of a path or a layer measures an exponent between 1.7 and 2.
+constexpr double time_exponent_tolerance{ 0.5 };
+constexpr double memory_exponent_tolerance{ 0.1 };
+
+constexpr double flow_acceleration{ 1e6 }; // um^3/s^2, slow enough that a ramp spans the largest path
+constexpr double step_duration{ 0.2 }; // s
+
+/*
+ * Mocks a layer of alternating slow and fast paths, with a retracted travel after every 64 paths.
+ *
+ * @param path_count the number of paths in the layer
+ * @param points_per_path the number of points of every extruding path, 0.5 mm apart
+ */
+request_t scaling_layer_request(const int path_count, const int points_per_path)
+{
+    request_t layer_request;
+    layer_request.set_extruder_nr(0);
+    layer_request.set_layer_nr(3);
+    long long x = 0;
+    long long y = 0;
+    for (auto index = 0; index < path_count; ++index)
+    {
+        auto& path = *layer_request.add_gcode_paths();
+        const auto retract = index % 64 == 63;
+        path.set_flow(retract ? 0.0 : 1.0);
+        path.set_width_factor(1.0);
+        path.set_speed_back_pressure_factor(1.0);
+        path.set_speed_factor(1.0);
+        path.set_line_width(400);
+        path.set_layer_thickness(200);
+        path.set_flow_ratio(1.0);
+        path.set_retract(retract);
+        path.mutable_speed_derivatives()->set_velocity(retract ? 200. : index % 2 == 0 ? 10. : 150.);
+
+        // zig-zag in rows of 100 mm
+        for (auto point_index = 0; point_index < (retract ? 1 : points_per_path); ++point_index)
+        {
+            x += y % 2 == 0 ? 500 : -500;
+            if (x == 0 || x == 100000)
+            {
+                y += 1;
+            }
+            auto& point = *path.mutable_path()->add_path();
+            point.set_x(x);
+            point.set_y(y * 500);
+        }
+    }
+    return layer_request;
+}
+
+struct Measurement
+{
+    double size{ 0.0 };
+    double seconds{ 0.0 };
+    double bytes{ 0.0 };
+};
+
+/*
+ * Fits `value = c * size^exponent` through the measurements with least squares on a log-log scale.
+ *
+ * @return the exponent
+ */
+double growthExponent(const std::vector<Measurement>& measurements, const std::function<double(const Measurement&)>& value)
+{
+    double mean_x{ 0.0 };
+    double mean_y{ 0.0 };
+    for (const auto& measurement : measurements)
+    {
+        mean_x += std::log(measurement.size);
+        mean_y += std::log(std::max(value(measurement), 1e-12));
+    }
+    mean_x /= static_cast<double>(measurements.size());
+    mean_y /= static_cast<double>(measurements.size());
+
+    double covariance{ 0.0 };
+    double variance{ 0.0 };
+    for (const auto& measurement : measurements)
+    {
+        const auto dx = std::log(measurement.size) - mean_x;
+        covariance += dx * (std::log(std::max(value(measurement), 1e-12)) - mean_y);
+        variance += dx * dx;
+    }
+    return covariance / variance;
+}
+
+/*
+ * Runs the stages of the pipeline on the layer, and adds the fastest time of a few runs and the
+ * allocated bytes of every stage to the measurements.
+ */
+void measureStages(const request_t& layer_request, const double size, std::map<std::string, std::vector<Measurement>>& measurements)
+{
+    constexpr auto runs{ 3 };
+
+    std::map<std::string, Measurement> layer_measurements;
+    for (auto run = 0; run <= runs; ++run)
+    {
+        // the first run counts the allocations, the others are timed
+        const auto count_allocations = run == 0;
+        const auto measure = [&](const std::string& stage, auto&& function)
+        {
+            auto& measurement = layer_measurements[stage];
+            measurement.size = size;
+            if (count_allocations)
+            {
+                const plugin::gradual_flow::test::AllocationCounter counter;
+                auto result = function();
+                measurement.bytes = static_cast<double>(counter.allocations().bytes);
+                return result;
+            }
+            const auto start = std::chrono::steady_clock::now();
+            auto result = function();
+            const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            measurement.seconds = run == 1 ? seconds : std::min(measurement.seconds, seconds);
+            return result;
+        };
+
+        const auto gcode_paths = measure("parse", [&] { return generate_t::gcodePaths(layer_request); });
+        const auto target_flow = gcode_paths.front().targetFlow();
+        plugin::gradual_flow::GCodeState state{
+            .current_flow = target_flow,
+            .flow_acceleration = flow_acceleration,
+            .flow_deceleration = flow_acceleration,
+            .discretized_duration = step_duration,
+            .target_end_flow = target_flow,
+            .reset_flow_duration = 2.0,
+        };
+        auto processed_paths = measure("process", [&] { return state.processGcodePaths(gcode_paths); });
+        const auto coalesced_paths = measure("coalesce", [&] { return plugin::gradual_flow::coalesceGcodePaths(std::move(processed_paths)); });
+
+        const plugin::gradual_flow::FlowRampPlanner planner{
+            .flow_acceleration = flow_acceleration,
+            .flow_deceleration = flow_acceleration,
+            .acceleration_step_duration = step_duration,
+            .deceleration_step_duration = step_duration,
+            .reset_flow_duration = 2.0,
+        };
+        plugin::gradual_flow::WorkerPool pool{ 1 };
+        measure("plan", [&] { return planner.plan(gcode_paths, plugin::gradual_flow::FlowRampPlanner::unlimited_flow, target_flow, pool); });
+
+        measure(
+            "response",
+            [&]
+            {
+                response_t response;
+                generate_t::addGcodePaths(response, coalesced_paths);
+                return response;
+            });
+    }
+
+    for (const auto& [stage, measurement] : layer_measurements)
+    {
+        measurements[stage].push_back(measurement);
+    }
+}
+
+void requireLinearGrowth(const std::map<std::string, std::vector<Measurement>>& measurements)
+{
+    for (const auto& [stage, stage_measurements] : measurements)
+    {
+        const auto time_exponent = growthExponent(stage_measurements, [](const Measurement& measurement) { return measurement.seconds; });
+        const auto memory_exponent = growthExponent(stage_measurements, [](const Measurement& measurement) { return measurement.bytes; });
+        std::string sizes;
+        for (const auto& measurement : stage_measurements)
+        {
+            sizes += fmt::format("\n  size {}: {:.3f} ms, {:.3f} MB", measurement.size, measurement.seconds * 1e3, measurement.bytes / 1e6);
+        }
+        INFO(stage << ": time grows with exponent " << time_exponent << ", memory with exponent " << memory_exponent << sizes);
+        CHECK(time_exponent <= 1.0 + time_exponent_tolerance);
+        CHECK(memory_exponent <= 1.0 + memory_exponent_tolerance);
+    }
+}
+
+TEST_CASE("stages scale linearly with the number of points in a path")
+{
+    // A few huge paths, up to a few million points in total. The flow acceleration is so low that
+    // every fast path is one long ramp, which is split into a number of pieces that grows with the
+    // length of the path.
+    std::map<std::string, std::vector<Measurement>> measurements;
+    for (auto points_per_path = 1 << 14; points_per_path <= 1 << 19; points_per_path *= 2)
+    {
+        measureStages(scaling_layer_request(4, points_per_path), points_per_path, measurements);
+    }
+    requireLinearGrowth(measurements);
+}
+
+TEST_CASE("stages scale linearly with the number of paths in a layer")
+{
+    std::map<std::string, std::vector<Measurement>> measurements;
+    for (auto path_count = 1 << 11; path_count <= 1 << 16; path_count *= 2)
+    {
+        measureStages(scaling_layer_request(path_count, 8), path_count, measurements);
+    }
+    requireLinearGrowth(measurements);
+}